@@ -0,0 +1,131 @@
+#include "binning.h"
+#include "workerpool.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <thread>
+#include <vector>
+
+/*
+ * Microbenchmark for the binning kernels: checks that every specialisation gives the same
+ * output as the reference implementation and reports ns/pixel and input MB/s.
+ */
+
+static double timeIt(int iterations, const std::function<void()> &f)
+{
+    f(); // warm up
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        f();
+    }
+    auto stop = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(stop - start).count() / iterations;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t width = 2048;
+    size_t height = 2048;
+    int iterations = 20;
+    int maxThreads = static_cast<int>(std::thread::hardware_concurrency());
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+            width = strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "-h") && i + 1 < argc) {
+            height = strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            maxThreads = atoi(argv[++i]);
+        } else {
+            fprintf(stderr,
+                    "usage: %s [-w width] [-h height] [-n iterations] [-t threads]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<uint16_t> in(width * height);
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> dist(0, 65535);
+    for (uint16_t &v : in) {
+        v = static_cast<uint16_t>(dist(gen));
+    }
+
+    std::vector<uint16_t> ref(width * height), out(width * height);
+    WorkerPool pool(maxThreads > 1 ? maxThreads - 1 : 0);
+
+    const double pixels = static_cast<double>(width * height);
+    const double bytes = 2 * pixels;
+    bool allOk = true;
+
+    printf("# frame %zux%zu, %d iterations, best ISA %s\n",
+           width,
+           height,
+           iterations,
+           Binning::isaName(Binning::detectISA()));
+    printf("%-8s %-10s %-8s %10s %12s %10s %s\n",
+           "binning",
+           "isa",
+           "threads",
+           "ns/frame",
+           "ns/pixel",
+           "MB/s",
+           "check");
+
+    for (unsigned int factor : {1u, 2u, 4u, 8u}) {
+        size_t outPixels = (width / factor) * (height / factor);
+
+        double t = timeIt(iterations, [&]() {
+            Binning::binReference(factor, in.data(), ref.data(), width, height);
+        });
+        printf("%-8u %-10s %-8d %10.0f %12.3f %10.1f %s\n",
+               factor,
+               "reference",
+               1,
+               t,
+               t / pixels,
+               bytes / t * 1e3,
+               "-");
+
+        std::vector<int> threadCounts = {1};
+        if (maxThreads > 1) {
+            threadCounts.push_back(maxThreads);
+        }
+
+        for (int isa = Binning::ISA_SCALAR; isa <= Binning::detectISA(); ++isa) {
+            for (int threads : threadCounts) {
+                Binning b(factor, width, height);
+                b.setISA(static_cast<Binning::ISA>(isa));
+                b.setWorkerPool(&pool);
+                b.setMaxThreads(threads);
+                for (int k = 1; k < threads; ++k) {
+                    b.setTimeBudget(1e-9); // force growth to the maximum
+                    b.bin(in.data(), out.data());
+                }
+                b.setTimeBudget(0);
+
+                memset(out.data(), 0, out.size() * sizeof(uint16_t));
+                t = timeIt(iterations, [&]() { b.bin(in.data(), out.data()); });
+                bool ok = !memcmp(out.data(), ref.data(), outPixels * sizeof(uint16_t));
+                allOk = allOk && ok;
+
+                printf("%-8u %-10s %-8d %10.0f %12.3f %10.1f %s\n",
+                       factor,
+                       Binning::isaName(static_cast<Binning::ISA>(isa)),
+                       b.getThreads(),
+                       t,
+                       t / pixels,
+                       bytes / t * 1e3,
+                       ok ? "ok" : "MISMATCH");
+            }
+        }
+    }
+
+    return allOk ? 0 : 1;
+}
@@ -0,0 +1,229 @@
+#include "binning.h"
+#include "rampwaveform.h"
+#include "workerpool.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Microbenchmark for the CPU hot paths of an acquisition:
+ *
+ * - binning of saved frames (SaveStackWorker), across frame sizes and binning factors;
+ * - live view conversion (DisplayWorker): binning to display resolution and conversion to double;
+ * - galvo waveform generation (GalvoRamp::computeWaveform()), across channel and sample counts.
+ *
+ * Each kernel is timed against its baseline implementation, its output is checked against the
+ * baseline, and ns per input pixel (or per output sample) and MB/s are reported.
+ */
+
+static double timeIt(int iterations, const std::function<void()> &f)
+{
+    f(); // warm up
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        f();
+    }
+    auto stop = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(stop - start).count() / iterations;
+}
+
+static void printHeader()
+{
+    printf("%-9s %-18s %-10s %-8s %12s %10s %10s %s\n",
+           "kernel",
+           "config",
+           "impl",
+           "threads",
+           "ns/call",
+           "ns/unit",
+           "MB/s",
+           "check");
+}
+
+/**
+ * @brief Prints one result: \a units are pixels or samples, \a bytes the bytes processed per call.
+ */
+static void printRow(const char *kernel,
+                     const std::string &config,
+                     const char *impl,
+                     int threads,
+                     double t,
+                     double units,
+                     double bytes,
+                     const char *check)
+{
+    printf("%-9s %-18s %-10s %-8d %12.0f %10.3f %10.1f %s\n",
+           kernel,
+           config.c_str(),
+           impl,
+           threads,
+           t,
+           t / units,
+           bytes / t * 1e3,
+           check);
+}
+
+static std::vector<size_t> parseList(char *arg)
+{
+    std::vector<size_t> list;
+    for (char *tok = strtok(arg, ","); tok; tok = strtok(nullptr, ",")) {
+        list.push_back(strtoul(tok, nullptr, 10));
+    }
+    return list;
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = 20;
+    int maxThreads = static_cast<int>(std::thread::hardware_concurrency());
+    std::vector<size_t> sizes = {512, 1024, 2048};
+    std::vector<size_t> factors = {2, 4, 8};
+    std::vector<size_t> channels = {1, 2, 4};
+    std::vector<size_t> samples = {1000, 10000, 100000};
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            maxThreads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            sizes = parseList(argv[++i]);
+        } else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+            factors = parseList(argv[++i]);
+        } else if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+            channels = parseList(argv[++i]);
+        } else if (!strcmp(argv[i], "-m") && i + 1 < argc) {
+            samples = parseList(argv[++i]);
+        } else {
+            fprintf(stderr,
+                    "usage: %s [-n iterations] [-t threads] [-s sizes] [-b factors] "
+                    "[-c channels] [-m samples]\n"
+                    "  lists are comma separated, sizes are square frame sides\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    WorkerPool pool(maxThreads > 1 ? maxThreads - 1 : 0);
+    const Binning::ISA bestISA = Binning::detectISA();
+    bool allOk = true;
+
+    printf("# %d iterations, best ISA %s, up to %d threads\n",
+           iterations,
+           Binning::isaName(bestISA),
+           maxThreads);
+    printHeader();
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> dist(0, 65535);
+
+    for (size_t side : sizes) {
+        const size_t pixels = side * side;
+        const double bytes = 2. * pixels;
+        std::vector<uint16_t> in(pixels);
+        for (uint16_t &v : in) {
+            v = static_cast<uint16_t>(dist(gen));
+        }
+        std::vector<uint16_t> ref(pixels), out(pixels);
+        std::vector<double> refDisplay(pixels), display(pixels);
+
+        for (size_t f : factors) {
+            unsigned int factor = static_cast<unsigned int>(f);
+            const size_t outPixels = (side / factor) * (side / factor);
+            std::string config = std::to_string(side) + "x" + std::to_string(side) + " /"
+                                 + std::to_string(factor);
+
+            // saved frames: reference, then the dispatched kernel on one and on all threads
+            double t = timeIt(iterations, [&]() {
+                Binning::binReference(factor, in.data(), ref.data(), side, side);
+            });
+            printRow("binning", config, "reference", 1, t, pixels, bytes, "-");
+
+            std::vector<int> threadCounts = {1};
+            if (maxThreads > 1) {
+                threadCounts.push_back(maxThreads);
+            }
+            for (int threads : threadCounts) {
+                Binning b(factor, side, side);
+                b.setWorkerPool(&pool);
+                b.setMaxThreads(threads);
+                for (int k = 1; k < threads; ++k) {
+                    b.setTimeBudget(1e-9); // force growth to the maximum
+                    b.bin(in.data(), out.data());
+                }
+                b.setTimeBudget(0);
+
+                memset(out.data(), 0, out.size() * sizeof(uint16_t));
+                t = timeIt(iterations, [&]() { b.bin(in.data(), out.data()); });
+                bool ok = !memcmp(out.data(), ref.data(), outPixels * sizeof(uint16_t));
+                allOk = allOk && ok;
+                printRow("binning",
+                         config,
+                         Binning::isaName(bestISA),
+                         b.getThreads(),
+                         t,
+                         pixels,
+                         bytes,
+                         ok ? "ok" : "MISMATCH");
+            }
+
+            // live view: same binning on the display thread, plus the conversion to double
+            t = timeIt(iterations, [&]() {
+                Binning::binReference(factor, in.data(), ref.data(), side, side);
+                Binning::toDouble(ref.data(), refDisplay.data(), outPixels);
+            });
+            printRow("display", config, "reference", 1, t, pixels, bytes, "-");
+
+            Binning d(factor, side, side);
+            t = timeIt(iterations, [&]() {
+                d.bin(in.data(), out.data());
+                Binning::toDouble(out.data(), display.data(), outPixels);
+            });
+            bool ok = !memcmp(display.data(), refDisplay.data(), outPixels * sizeof(double));
+            allOk = allOk && ok;
+            printRow("display",
+                     config,
+                     Binning::isaName(bestISA),
+                     1,
+                     t,
+                     pixels,
+                     bytes,
+                     ok ? "ok" : "MISMATCH");
+        }
+    }
+
+    for (size_t nCh : channels) {
+        for (size_t n : samples) {
+            const double total = double(nCh) * n;
+            std::vector<double> ref(nCh * n), out(nCh * n);
+            std::string config = std::to_string(nCh) + "ch x " + std::to_string(n);
+
+            // as in GalvoRamp::computeWaveform(): channels staggered over the period
+            auto run = [&](decltype(&RampWaveform::generate) generate, double *dst) {
+                for (size_t c = 0; c < nCh; ++c) {
+                    long nDelay = static_cast<long>(n / 10 + n * c / nCh);
+                    generate(dst + c * n, n, 0.1 * c, 2.0, 0.85, nDelay);
+                }
+            };
+
+            double t = timeIt(iterations, [&]() {
+                run(&RampWaveform::generateReference, ref.data());
+            });
+            printRow("waveform", config, "reference", 1, t, total, 8 * total, "-");
+
+            t = timeIt(iterations, [&]() { run(&RampWaveform::generate, out.data()); });
+            bool ok = !memcmp(out.data(), ref.data(), out.size() * sizeof(double));
+            allOk = allOk && ok;
+            printRow("waveform", config, "direct", 1, t, total, 8 * total, ok ? "ok" : "MISMATCH");
+        }
+    }
+
+    return allOk ? 0 : 1;
+}
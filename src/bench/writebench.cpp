@@ -0,0 +1,596 @@
+#include "binning.h"
+#include "bufferplanner.h"
+#include "framelease.h"
+#include "framepool.h"
+#include "framering.h"
+#include "stackwriter.h"
+#include "workerpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <QDir>
+
+/*
+ * Write-throughput benchmark for the stack writer pipeline.
+ *
+ * Each output directory stands for a camera. A capture thread per camera copies synthetic frames
+ * into a FrameRing at the trigger rate, as SaveStackWorker::captureFrames() does, and writer
+ * threads bin them and hand them to the StackWriter backend, as SaveStackWorker::writerLoop()
+ * does. Frames come from a simulated DCAM ring buffer: a frame that is overwritten by the camera
+ * before the capture thread has copied it is counted as lost. With -z frames are not copied but
+ * leased to the writers, as in zero-copy mode (see FrameLeases): a leased frame that is
+ * overwritten by the camera before it has been written is counted as lost too.
+ *
+ * For each binning factor, reports the sustained write rate, the per-frame write latency and the
+ * trigger-to-write latency percentiles, the growth of dirty pages in the page cache and the lost
+ * frames, either as a table or as JSON lines (-j).
+ */
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options
+{
+    size_t width = 2048;
+    size_t height = 2048;
+    double rate = 100;       // Hz, 0 = as fast as the writers go
+    int frames = 1000;       // per stack
+    int stacks = 1;
+    int dcamFrames = BufferPlanner::DEFAULT_FRAMES;
+    int ringDepth = 32;
+    int writerThreads = 1;
+    StackWriter::Backend backend = StackWriter::BACKEND_BUFFERED;
+    size_t writebackWindow = Writeback::DEFAULT_WINDOW_BYTES; // 0 = left to the kernel
+    bool zeroCopy = false;
+    std::vector<unsigned int> binnings = {1, 2, 4};
+    std::vector<std::string> dirs;
+    bool json = false;
+};
+
+struct Result
+{
+    int camera;
+    std::string dir;
+    size_t written = 0;
+    size_t lost = 0;
+    double bytes = 0;
+    double seconds = 0;
+    double closeTime = 0; // s
+    size_t highWaterMark = 0;
+    double stallTime = 0; // s, capture thread waiting for a free slot
+    size_t copied = 0;    // zero-copy: frames copied because the DCAM buffer was about to wrap
+    std::vector<double> writeTimes; // us, StackWriter::writeFrame()
+    std::vector<double> latencies;  // us, trigger to end of writeFrame()
+    bool ok = true;
+    std::string error;
+};
+
+/**
+ * @brief Dirty bytes in the page cache (Dirty + Writeback in /proc/meminfo).
+ */
+static double dirtyBytes()
+{
+    std::ifstream meminfo("/proc/meminfo");
+    std::string line;
+    double bytes = 0;
+    while (std::getline(meminfo, line)) {
+        if (line.compare(0, 6, "Dirty:") == 0) {
+            bytes += std::stod(line.substr(6)) * 1024; // kB
+        } else if (line.compare(0, 10, "Writeback:") == 0) {
+            bytes += std::stod(line.substr(10)) * 1024;
+        }
+    }
+    return bytes;
+}
+
+/**
+ * @brief Samples dirtyBytes() in the background and keeps the peak.
+ */
+class DirtySampler
+{
+public:
+    DirtySampler()
+        : start(dirtyBytes())
+        , peak(start)
+        , thread(&DirtySampler::loop, this)
+    {}
+
+    ~DirtySampler() { stop(); }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        cv.notify_all();
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+
+    double start;
+    double peak;
+
+private:
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool quit = false;
+    std::thread thread;
+
+    void loop()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!quit) {
+            peak = std::max(peak, dirtyBytes());
+            cv.wait_for(lock, std::chrono::milliseconds(20));
+        }
+    }
+};
+
+static double percentile(std::vector<double> v, double p)
+{
+    if (v.empty()) {
+        return 0;
+    }
+    size_t k = static_cast<size_t>(std::ceil(p / 100 * v.size()));
+    k = std::min(std::max<size_t>(k, 1), v.size()) - 1;
+    std::nth_element(v.begin(), v.begin() + static_cast<long>(k), v.end());
+    return v[k];
+}
+
+static Clock::time_point triggerTime(Clock::time_point t0, size_t frame, double period)
+{
+    return t0
+           + std::chrono::duration_cast<Clock::duration>(
+               std::chrono::duration<double, std::micro>(frame * period));
+}
+
+static std::vector<std::vector<uint16_t>> makeSources(size_t width, size_t height)
+{
+    // a few distinct frames with camera-like statistics (offset + shot noise), so that copies do
+    // not hit the cache and compressed backends see realistic data
+    std::vector<std::vector<uint16_t>> sources(4, std::vector<uint16_t>(width * height));
+    std::mt19937 gen(42);
+    std::normal_distribution<double> noise(0, 8);
+    for (std::vector<uint16_t> &frame : sources) {
+        for (size_t y = 0; y < height; ++y) {
+            for (size_t x = 0; x < width; ++x) {
+                double v = 100 + 400 * x / width + noise(gen);
+                frame[y * width + x] = static_cast<uint16_t>(std::max(v, 0.));
+            }
+        }
+    }
+    return sources;
+}
+
+static void runCamera(const Options &opt,
+                      unsigned int binning,
+                      const std::vector<std::vector<uint16_t>> &sources,
+                      Result *res)
+{
+    const size_t frameBytes = 2 * opt.width * opt.height;
+    const size_t frameCount = static_cast<size_t>(opt.frames);
+
+    FrameRing ring;
+    ring.allocate(static_cast<size_t>(opt.ringDepth), frameBytes);
+    std::unique_ptr<StackWriter> writer(StackWriter::create(opt.backend));
+    writer->setWritebackWindow(opt.writebackWindow);
+    const int nWriters = writer->supportsConcurrentWrites() ? std::max(opt.writerThreads, 1) : 1;
+    const double period = opt.rate > 0 ? 1e6 / opt.rate : 0; // us
+
+    std::vector<Clock::time_point> triggerTimes(frameCount);
+    std::vector<double> writeTimes(frameCount, -1), latencies(frameCount, -1);
+    std::atomic<bool> writeError(false);
+    FrameLeases leases;
+    std::atomic<size_t> overwritten(0);
+
+    Clock::time_point begin = Clock::now();
+
+    for (int s = 0; s < opt.stacks && !writeError; ++s) {
+        QString fileName = QDir(QString::fromStdString(res->dir))
+                               .filePath(QString("write-bench_cam%1_%2.%3")
+                                             .arg(res->camera)
+                                             .arg(s)
+                                             .arg(StackWriter::fileExtension(opt.backend)));
+        Binning probe(binning, opt.width, opt.height);
+        size_t binnedBytes = 2 * probe.getOutputPixels();
+        if (!writer->open(fileName, binnedBytes, frameCount)) {
+            res->ok = false;
+            res->error = writer->errorString().toStdString();
+            return;
+        }
+        ring.reset();
+        leases.reset(opt.dcamFrames);
+        overwritten = 0;
+        std::fill(writeTimes.begin(), writeTimes.end(), -1);
+        Clock::time_point t0; // set before the first frame is pushed
+
+        std::vector<std::thread> writers;
+        for (int i = 0; i < nWriters; ++i) {
+            writers.emplace_back([&]() {
+                Binning binner(binning, opt.width, opt.height);
+                binner.setWorkerPool(&WorkerPool::global());
+                binner.setMaxThreads(WorkerPool::global().threadCount() + 1);
+                binner.setTimeBudget(period / 2);
+
+                FramePool::Buffer binnedBuf;
+                if (binning > 1) {
+                    binnedBuf = FramePool::global().acquire(2 * binner.getOutputPixels());
+                }
+
+                while (true) {
+                    FrameRing::Slot *slot = ring.beginPop();
+                    if (slot == nullptr) {
+                        if (ring.isClosed() && ring.isEmpty()) {
+                            break;
+                        }
+                        std::this_thread::sleep_for(std::chrono::microseconds(100));
+                        continue;
+                    }
+
+                    const void *data = slot->frame;
+                    if (binning > 1) {
+                        binner.bin(slot->frame, binnedBuf.as<uint16_t>());
+                        data = binnedBuf.data();
+                    }
+                    size_t index = static_cast<size_t>(slot->frameIndex);
+                    Clock::time_point writeStart = Clock::now();
+                    bool ok = writeError || writer->writeFrame(index, data);
+                    Clock::time_point t1 = Clock::now();
+                    if (slot->leased) {
+                        // the camera reached the DCAM slot of this frame while it was in flight
+                        // (t0 is the start of the capture)
+                        if (period > 0
+                            && std::chrono::duration<double, std::micro>(t1 - t0).count() / period
+                                   >= index + opt.dcamFrames) {
+                            overwritten++;
+                        }
+                        leases.release(slot->frameIndex);
+                    }
+                    ring.endPop(slot);
+
+                    writeTimes[index] = std::chrono::duration<double, std::micro>(t1 - writeStart)
+                                            .count();
+                    latencies[index] = std::chrono::duration<double, std::micro>(
+                                           t1 - triggerTimes[index])
+                                           .count();
+                    if (!ok) {
+                        writeError = true;
+                    }
+                }
+            });
+        }
+
+        // capture: frame k is ready in DCAM slot k % dcamFrames at t0 + k * period
+        t0 = Clock::now();
+        size_t readFrames = 0;
+        while (readFrames < frameCount && !writeError) {
+            std::this_thread::sleep_until(triggerTime(t0, readFrames, period));
+
+            FrameRing::Slot *slot = ring.beginPush();
+            if (slot == nullptr) {
+                Clock::time_point stallStart = Clock::now();
+                while (!writeError && (slot = ring.beginPush()) == nullptr) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                }
+                res->stallTime += std::chrono::duration<double>(Clock::now() - stallStart).count();
+                if (slot == nullptr) {
+                    break;
+                }
+            }
+
+            if (period > 0) {
+                // frames triggered meanwhile may have overwritten the DCAM slot of this one
+                double elapsed = std::chrono::duration<double, std::micro>(Clock::now() - t0)
+                                     .count();
+                size_t produced = std::min(frameCount,
+                                           static_cast<size_t>(elapsed / period) + 1);
+                size_t dcamFrames = static_cast<size_t>(opt.dcamFrames);
+                if (produced - readFrames > dcamFrames) {
+                    res->lost += produced - dcamFrames - readFrames;
+                    readFrames = produced - dcamFrames;
+                }
+            }
+
+            triggerTimes[readFrames] = period > 0 ? triggerTime(t0, readFrames, period)
+                                                  : Clock::now();
+            const uint16_t *frame = sources[readFrames % sources.size()].data();
+            bool lease = opt.zeroCopy
+                         && leases.span(static_cast<int32_t>(readFrames))
+                                < FrameLeases::limit(opt.dcamFrames);
+            if (lease) {
+                leases.acquire(static_cast<int32_t>(readFrames));
+                slot->frame = frame;
+            } else {
+                memcpy(slot->data, frame, frameBytes);
+                slot->frame = slot->data;
+                res->copied += opt.zeroCopy ? 1 : 0;
+            }
+            slot->leased = lease;
+            slot->frameIndex = static_cast<int32_t>(readFrames);
+            ring.endPush(slot);
+            readFrames++;
+        }
+
+        ring.close();
+        for (std::thread &t : writers) {
+            t.join();
+        }
+        Clock::time_point closeStart = Clock::now();
+        if (!writer->close()) {
+            writeError = true;
+        }
+        res->closeTime += std::chrono::duration<double>(Clock::now() - closeStart).count();
+        res->highWaterMark = std::max(res->highWaterMark, ring.highWaterMark());
+        res->lost += overwritten;
+
+        for (size_t i = 0; i < frameCount; ++i) {
+            if (writeTimes[i] >= 0) {
+                res->writeTimes.push_back(writeTimes[i]);
+                res->latencies.push_back(latencies[i]);
+            }
+        }
+        res->written = res->writeTimes.size();
+        res->bytes = double(binnedBytes) * res->written;
+
+        if (writeError) {
+            res->ok = false;
+            res->error = writer->errorString().toStdString();
+        }
+        unlink(fileName.toLatin1());
+    }
+
+    res->seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+}
+
+static void printHeader(const Options &opt)
+{
+    printf("# frame %zux%zu, %d x %d frames at %.1f Hz, backend %s, DCAM buffer %d frames, "
+           "ring %d, %d writer threads, writeback window %zu MB%s\n",
+           opt.width,
+           opt.height,
+           opt.stacks,
+           opt.frames,
+           opt.rate,
+           StackWriter::backendName(opt.backend).toLatin1().constData(),
+           opt.dcamFrames,
+           opt.ringDepth,
+           opt.writerThreads,
+           opt.writebackWindow >> 20,
+           opt.zeroCopy ? ", zero-copy" : "");
+    printf("%-8s %-6s %10s %8s %8s %10s %10s %10s %10s %10s %10s %s\n",
+           "binning",
+           "cam",
+           "MB/s",
+           "written",
+           "lost",
+           "write p50",
+           "write p99",
+           "write max",
+           "lat p99",
+           "dirty MB",
+           "close ms",
+           "dir");
+}
+
+static void printResult(const Options &opt,
+                        unsigned int binning,
+                        const Result &r,
+                        double dirtyGrowth,
+                        double dirtyEnd)
+{
+    double mbs = r.seconds > 0 ? r.bytes / r.seconds / 1e6 : 0;
+    double wp50 = percentile(r.writeTimes, 50);
+    double wp90 = percentile(r.writeTimes, 90);
+    double wp99 = percentile(r.writeTimes, 99);
+    double wp999 = percentile(r.writeTimes, 99.9);
+    double wmax = percentile(r.writeTimes, 100);
+    double lp50 = percentile(r.latencies, 50);
+    double lp99 = percentile(r.latencies, 99);
+    double lmax = percentile(r.latencies, 100);
+
+    if (!opt.json) {
+        printf("%-8u %-6s %10.1f %8zu %8zu %10.0f %10.0f %10.0f %10.0f %10.0f %10.1f %s%s\n",
+               binning,
+               r.camera < 0 ? "all" : std::to_string(r.camera).c_str(),
+               mbs,
+               r.written,
+               r.lost,
+               wp50,
+               wp99,
+               wmax,
+               lp99,
+               dirtyGrowth / 1e6,
+               r.closeTime * 1e3,
+               r.dir.c_str(),
+               r.ok ? "" : (" ERROR: " + r.error).c_str());
+        return;
+    }
+
+    // one object per line; camera -1 is the aggregate of all cameras
+    printf("{\"backend\":\"%s\",\"width\":%zu,\"height\":%zu,\"binning\":%u,\"rate_hz\":%.3f,"
+           "\"frames\":%d,\"stacks\":%d,\"dcam_frames\":%d,\"ring_depth\":%d,"
+           "\"writer_threads\":%d,\"writeback_mb\":%zu,\"zero_copy\":%s,\"camera\":%d,"
+           "\"dir\":\"%s\",\"ok\":%s,\"written\":%zu,"
+           "\"lost\":%zu,\"bytes\":%.0f,\"seconds\":%.6f,\"mb_per_s\":%.3f,\"close_ms\":%.3f,"
+           "\"stall_ms\":%.3f,\"ring_high_water\":%zu,\"copied\":%zu,"
+           "\"write_us\":{\"p50\":%.1f,\"p90\":%.1f,"
+           "\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f},\"latency_us\":{\"p50\":%.1f,\"p99\":%.1f,"
+           "\"max\":%.1f},\"dirty_peak_growth_mb\":%.1f,\"dirty_end_growth_mb\":%.1f}\n",
+           StackWriter::backendName(opt.backend).toLatin1().constData(),
+           opt.width,
+           opt.height,
+           binning,
+           opt.rate,
+           opt.frames,
+           opt.stacks,
+           opt.dcamFrames,
+           opt.ringDepth,
+           opt.writerThreads,
+           opt.writebackWindow >> 20,
+           opt.zeroCopy ? "true" : "false",
+           r.camera,
+           r.dir.c_str(),
+           r.ok ? "true" : "false",
+           r.written,
+           r.lost,
+           r.bytes,
+           r.seconds,
+           mbs,
+           r.closeTime * 1e3,
+           r.stallTime * 1e3,
+           r.highWaterMark,
+           r.copied,
+           wp50,
+           wp90,
+           wp99,
+           wp999,
+           wmax,
+           lp50,
+           lp99,
+           lmax,
+           dirtyGrowth / 1e6,
+           dirtyEnd / 1e6);
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [-o dir]... [-b factors] [-r rate] [-n frames] [-s stacks] [-w width] "
+            "[-h height] [-d dcam_frames] [-q ring_depth] [-t writer_threads] [-k backend] "
+            "[-W writeback_mb] [-z] [-j]\n"
+            "  -b  comma separated binning factors (default 1,2,4)\n"
+            "  -r  trigger rate in Hz, 0 = as fast as possible (default 100)\n"
+            "  -k  %s (default buffered)\n"
+            "  -W  writeback window in MB, 0 = left to the kernel (default 32)\n"
+            "  -z  zero-copy: writers read frames from the DCAM buffer\n"
+            "  -j  print results as JSON lines\n",
+            argv0,
+            StackWriter::backendNames().join(", ").toLatin1().constData());
+}
+
+int main(int argc, char *argv[])
+{
+    Options opt;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            opt.dirs.push_back(argv[++i]);
+        } else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+            opt.binnings.clear();
+            for (char *tok = strtok(argv[++i], ","); tok; tok = strtok(nullptr, ",")) {
+                opt.binnings.push_back(static_cast<unsigned int>(atoi(tok)));
+            }
+        } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            opt.rate = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            opt.frames = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            opt.stacks = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+            opt.width = strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "-h") && i + 1 < argc) {
+            opt.height = strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+            opt.dcamFrames = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-q") && i + 1 < argc) {
+            opt.ringDepth = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            opt.writerThreads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-k") && i + 1 < argc) {
+            opt.backend = StackWriter::backendFromName(argv[++i]);
+        } else if (!strcmp(argv[i], "-W") && i + 1 < argc) {
+            opt.writebackWindow = strtoul(argv[++i], nullptr, 10) << 20;
+        } else if (!strcmp(argv[i], "-z")) {
+            opt.zeroCopy = true;
+        } else if (!strcmp(argv[i], "-j")) {
+            opt.json = true;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (opt.dirs.empty()) {
+        opt.dirs.push_back(".");
+    }
+    if (opt.frames < 1 || opt.stacks < 1 || opt.dcamFrames < 1 || opt.ringDepth < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    for (unsigned int factor : opt.binnings) {
+        if (!Binning::isSupportedFactor(factor)) {
+            fprintf(stderr, "unsupported binning factor %u\n", factor);
+            return 1;
+        }
+    }
+
+    std::vector<std::vector<uint16_t>> sources = makeSources(opt.width, opt.height);
+    bool allOk = true;
+
+    if (!opt.json) {
+        printHeader(opt);
+    }
+
+    for (unsigned int binning : opt.binnings) {
+        sync(); // start every run with a clean page cache
+        const int nCams = static_cast<int>(opt.dirs.size());
+        std::vector<Result> results(opt.dirs.size());
+        DirtySampler dirty;
+
+        std::vector<std::thread> cameras;
+        for (int c = 0; c < nCams; ++c) {
+            results[c].camera = c;
+            results[c].dir = opt.dirs[c];
+            cameras.emplace_back(runCamera,
+                                 std::cref(opt),
+                                 binning,
+                                 std::cref(sources),
+                                 &results[c]);
+        }
+        for (std::thread &t : cameras) {
+            t.join();
+        }
+        dirty.stop();
+        double growth = dirty.peak - dirty.start;
+        double end = dirtyBytes() - dirty.start;
+
+        Result all;
+        all.camera = -1;
+        for (const Result &r : results) {
+            printResult(opt, binning, r, growth, end);
+            all.written += r.written;
+            all.lost += r.lost;
+            all.bytes += r.bytes;
+            all.seconds = std::max(all.seconds, r.seconds);
+            all.closeTime = std::max(all.closeTime, r.closeTime);
+            all.stallTime = std::max(all.stallTime, r.stallTime);
+            all.highWaterMark = std::max(all.highWaterMark, r.highWaterMark);
+            all.copied += r.copied;
+            all.writeTimes.insert(all.writeTimes.end(), r.writeTimes.begin(), r.writeTimes.end());
+            all.latencies.insert(all.latencies.end(), r.latencies.begin(), r.latencies.end());
+            all.ok = all.ok && r.ok;
+            allOk = allOk && r.ok;
+        }
+        if (nCams > 1) {
+            printResult(opt, binning, all, growth, end);
+        }
+        fflush(stdout);
+    }
+
+    return allOk ? 0 : 1;
+}
@@ -0,0 +1,356 @@
+#include "acquisitionplanner.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+#include <vector>
+
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+
+AcquisitionPlanner::AcquisitionPlanner(int nCams)
+    : nCams(nCams)
+    , stackBytes(nCams, 0)
+    , frameBytes(nCams, 0)
+    , bufferFrames(nCams, 0)
+{}
+
+void AcquisitionPlanner::setStackFrames(int value)
+{
+    stackFrames = value;
+}
+
+void AcquisitionPlanner::setTriggerRate(double value)
+{
+    triggerRate = value;
+}
+
+/**
+ * @brief Bytes written by camera \a cam for each stack, including pyramids and projections.
+ */
+void AcquisitionPlanner::setStackBytes(int cam, double value)
+{
+    stackBytes[cam] = value;
+}
+
+void AcquisitionPlanner::setFrameBytes(int cam, double value)
+{
+    frameBytes[cam] = value;
+}
+
+/**
+ * @brief Frames the DCAM buffer of camera \a cam can hold while the disk lags behind.
+ */
+void AcquisitionPlanner::setBufferFrames(int cam, int value)
+{
+    bufferFrames[cam] = value;
+}
+
+void AcquisitionPlanner::setTileMoves(const QVector<double> &value)
+{
+    tileMoves = value;
+}
+
+void AcquisitionPlanner::setTileOverhead(double value)
+{
+    tileOverhead = value;
+}
+
+/**
+ * @brief Sets the output path of each camera and groups the cameras by file system.
+ */
+void AcquisitionPlanner::setOutputPaths(const QStringList &paths)
+{
+    QList<QStringList> p;
+    QList<QVector<int>> w;
+    for (const QString &path : paths) {
+        p << QStringList{path};
+        w << QVector<int>{1};
+    }
+    setOutputPaths(p, w);
+}
+
+/**
+ * @brief Sets the output paths of each camera, whose frames are striped over \a paths with the
+ * given \a weights (see StripedStackWriter), and groups them by file system.
+ */
+void AcquisitionPlanner::setOutputPaths(const QList<QStringList> &paths,
+                                        const QList<QVector<int>> &weights)
+{
+    disks.clear();
+    QVector<dev_t> devices;
+    for (int i = 0; i < nCams && i < paths.size(); ++i) {
+        const QStringList &stripes = paths.at(i);
+        double total = 0;
+        for (int k = 0; k < stripes.size(); ++k) {
+            total += weights.value(i).value(k, 1);
+        }
+        for (int k = 0; k < stripes.size(); ++k) {
+            struct stat st;
+            bool known = stat(stripes.at(k).toLatin1(), &st) == 0;
+            int d = known ? devices.indexOf(st.st_dev) : -1;
+            if (d < 0) {
+                Disk disk;
+                disk.path = stripes.at(k);
+                disk.bandwidth = 0;
+                disk.freeBytes = freeSpace(stripes.at(k));
+                disk.bytes = disk.peakRate = disk.busyTime = 0;
+                disks << disk;
+                devices << (known ? st.st_dev : dev_t(-1));
+                d = disks.size() - 1;
+            }
+            double share = weights.value(i).value(k, 1) / total;
+            int c = disks[d].cameras.indexOf(i);
+            if (c < 0) {
+                disks[d].cameras << i;
+                disks[d].shares << share;
+            } else {
+                disks[d].shares[c] += share;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Measures the write bandwidth of each disk by writing \a bytes to it.
+ */
+void AcquisitionPlanner::benchmarkDisks(size_t bytes)
+{
+    for (Disk &disk : disks) {
+        disk.bandwidth = measureWriteBandwidth(disk.path, bytes);
+    }
+}
+
+void AcquisitionPlanner::setBandwidth(int disk, double value)
+{
+    disks[disk].bandwidth = value;
+}
+
+void AcquisitionPlanner::run()
+{
+    problems.clear();
+    for (Disk &disk : disks) {
+        disk.bytes = disk.peakRate = disk.busyTime = 0;
+        for (int j = 0; j < disk.cameras.size(); ++j) {
+            disk.peakRate += frameBytes.at(disk.cameras.at(j)) * disk.shares.at(j) * triggerRate;
+        }
+    }
+
+    double stackTime = triggerRate > 0 ? stackFrames / triggerRate : 0;
+    int nStacks = tileMoves.size() + 1;
+
+    double ready = 0; // stages on target
+    double saved = 0; // previous stack saved on all disks
+    double captureEnd = 0;
+    captureTime = deadTime = 0;
+    for (int k = 0; k < nStacks; ++k) {
+        double start = std::max(ready, saved);
+        if (k > 0) {
+            deadTime += start - captureEnd;
+        }
+        captureEnd = start + stackTime;
+        captureTime += stackTime;
+
+        double done = captureEnd;
+        for (Disk &disk : disks) {
+            double b = 0;
+            for (int j = 0; j < disk.cameras.size(); ++j) {
+                b += stackBytes.at(disk.cameras.at(j)) * disk.shares.at(j);
+            }
+            disk.bytes += b;
+            if (disk.bandwidth > 0) {
+                double w = b / disk.bandwidth;
+                disk.busyTime += w;
+                done = std::max(done, start + w);
+            }
+        }
+        saved = done;
+
+        if (k < tileMoves.size()) {
+            ready = captureEnd + std::max(tileMoves.at(k), tileOverhead);
+        }
+    }
+    duration = std::max(captureEnd, saved);
+
+    for (const Disk &disk : disks) {
+        if (disk.bytes > disk.freeBytes) {
+            problems << QString("%1: %2 GB needed, %3 GB free")
+                            .arg(disk.path)
+                            .arg(disk.bytes / 1e9, 0, 'f', 1)
+                            .arg(disk.freeBytes / 1e9, 0, 'f', 1);
+        }
+        if (disk.bandwidth <= 0) {
+            problems << QString("%1: write bandwidth unknown").arg(disk.path);
+            continue;
+        }
+        if (disk.peakRate <= disk.bandwidth) {
+            continue;
+        }
+        // the disk drains frames slower than they are captured: the backlog of a stack must fit
+        // in the DCAM buffers
+        double drain = disk.bandwidth / disk.peakRate * triggerRate;
+        for (int j = 0; j < disk.cameras.size(); ++j) {
+            int c = disk.cameras.at(j);
+            double backlog = stackFrames * disk.shares.at(j) * (1 - drain / triggerRate);
+            if (backlog > bufferFrames.at(c)) {
+                problems << QString("Camera %1: backlog of %2 frames per stack exceeds the DCAM "
+                                    "buffer (%3 frames)")
+                                .arg(c)
+                                .arg(backlog, 0, 'f', 0)
+                                .arg(bufferFrames.at(c));
+            }
+        }
+    }
+}
+
+double AcquisitionPlanner::getDuration() const
+{
+    return duration;
+}
+
+double AcquisitionPlanner::getCaptureTime() const
+{
+    return captureTime;
+}
+
+QVector<AcquisitionPlanner::Disk> AcquisitionPlanner::getDisks() const
+{
+    return disks;
+}
+
+bool AcquisitionPlanner::fits() const
+{
+    return problems.isEmpty();
+}
+
+QStringList AcquisitionPlanner::getProblems() const
+{
+    return problems;
+}
+
+QString AcquisitionPlanner::report() const
+{
+    QStringList lines;
+    lines << QString("Stacks: %1 x %2 frames at %3 Hz")
+                 .arg(tileMoves.size() + 1)
+                 .arg(stackFrames)
+                 .arg(triggerRate, 0, 'f', 1);
+    lines << QString("Duration: %1 (capture %2, dead time %3), ending %4")
+                 .arg(formatDuration(duration))
+                 .arg(formatDuration(captureTime))
+                 .arg(formatDuration(deadTime))
+                 .arg(QDateTime::currentDateTime()
+                          .addSecs(static_cast<qint64>(duration))
+                          .toString());
+    for (const Disk &disk : disks) {
+        QStringList cams;
+        for (int c : disk.cameras) {
+            cams << QString::number(c);
+        }
+        QString bw = disk.bandwidth > 0 ? QString("%1 MB/s").arg(disk.bandwidth / 1e6, 0, 'f', 0)
+                                        : QString("unknown");
+        lines << QString("%1 (cam %2): %3 GB of %4 GB free, peak write rate %5 MB/s, "
+                         "bandwidth %6, busy %7%")
+                     .arg(disk.path)
+                     .arg(cams.join(", "))
+                     .arg(disk.bytes / 1e9, 0, 'f', 1)
+                     .arg(disk.freeBytes / 1e9, 0, 'f', 1)
+                     .arg(disk.peakRate / 1e6, 0, 'f', 0)
+                     .arg(bw)
+                     .arg(duration > 0 ? 100 * disk.busyTime / duration : 0., 0, 'f', 0);
+    }
+    if (fits()) {
+        lines << "The plan fits";
+    } else {
+        lines << "The plan does NOT fit:";
+        lines << problems;
+    }
+    return lines.join("\n");
+}
+
+/**
+ * @brief Writes \a bytes to a temporary file in \a dir and returns the sustained write
+ * bandwidth in bytes/s (including the final flush to disk), 0 on error.
+ */
+double AcquisitionPlanner::measureWriteBandwidth(const QString &dir, size_t bytes)
+{
+    QString fileName = QDir(dir).filePath(".spimlab_write_test");
+    int fd = open(fileName.toLatin1(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        return 0;
+    }
+
+    const size_t chunk = size_t(8) << 20;
+    std::vector<uint16_t> buf(chunk / 2);
+    for (size_t i = 0; i < buf.size(); ++i) {
+        buf[i] = static_cast<uint16_t>(i * 2654435761u >> 16); // not trivially compressible
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    size_t written = 0;
+    bool ok = true;
+    while (written < bytes) {
+        ssize_t ret = write(fd, buf.data(), chunk);
+        if (ret <= 0) {
+            ok = false;
+            break;
+        }
+        written += static_cast<size_t>(ret);
+    }
+    ok = ok && fdatasync(fd) == 0;
+    double elapsed = timer.nsecsElapsed() * 1e-9;
+    close(fd);
+    unlink(fileName.toLatin1());
+
+    return ok && elapsed > 0 ? written / elapsed : 0;
+}
+
+/**
+ * @brief Write bandwidth available to camera \a cam, in bytes/s: each disk is shared among its
+ * cameras in proportion to their output, and the slowest stripe limits the camera. 0 if unknown.
+ */
+double AcquisitionPlanner::cameraBandwidth(int cam) const
+{
+    double bandwidth = -1;
+    for (const Disk &disk : disks) {
+        int j = disk.cameras.indexOf(cam);
+        if (j < 0) {
+            continue;
+        }
+        double total = 0;
+        for (int k = 0; k < disk.cameras.size(); ++k) {
+            total += disk.shares.at(k) * frameBytes.at(disk.cameras.at(k));
+        }
+        double mine = disk.shares.at(j) * frameBytes.at(cam);
+        double b = total > 0 ? disk.bandwidth * mine / total / disk.shares.at(j) : disk.bandwidth;
+        bandwidth = bandwidth < 0 ? b : std::min(bandwidth, b);
+    }
+    return std::max(bandwidth, 0.);
+}
+
+double AcquisitionPlanner::freeSpace(const QString &dir)
+{
+    struct statvfs st;
+    if (statvfs(dir.toLatin1(), &st) != 0) {
+        return 0;
+    }
+    return double(st.f_bavail) * st.f_frsize;
+}
+
+/**
+ * @brief Formats \a s seconds as "[Nd ]hh:mm:ss".
+ */
+QString AcquisitionPlanner::formatDuration(double s)
+{
+    qint64 t = static_cast<qint64>(s + 0.5);
+    qint64 d = t / 86400;
+    QString hms = QString("%1:%2:%3")
+                      .arg((t % 86400) / 3600, 2, 10, QChar('0'))
+                      .arg((t % 3600) / 60, 2, 10, QChar('0'))
+                      .arg(t % 60, 2, 10, QChar('0'));
+    return d > 0 ? QString("%1d %2").arg(d).arg(hms) : hms;
+}
@@ -0,0 +1,80 @@
+#ifndef ACQUISITIONPLANNER_H
+#define ACQUISITIONPLANNER_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+/**
+ * @brief Dry run of an acquisition: simulates the stack schedule and the output of each camera
+ * to estimate duration, data volume and write rate on each disk, before committing to a run.
+ *
+ * Each stack is captured at the trigger rate while the cameras' disks write it; the next stack
+ * starts when the stages have reached the next tile (the move starts at the end of the capture,
+ * see SPIM::advanceToNextTile()) and the previous stack has been saved. Cameras whose output
+ * paths are on the same file system share its bandwidth.
+ */
+class AcquisitionPlanner
+{
+public:
+    struct Disk
+    {
+        QString path;     // output path of the first camera on this disk
+        QVector<int> cameras;
+        QVector<double> shares; // fraction of the output of each camera written to this disk
+        double bandwidth; // bytes/s, 0 if unknown
+        double freeBytes;
+        double bytes;     // planned
+        double peakRate;  // bytes/s demanded while capturing
+        double busyTime;  // s spent writing
+    };
+
+    explicit AcquisitionPlanner(int nCams = 1);
+
+    void setStackFrames(int value);
+    void setTriggerRate(double value); // Hz
+    void setStackBytes(int cam, double value);
+    void setFrameBytes(int cam, double value); // bytes per frame written, to compute rates
+    void setBufferFrames(int cam, int value);
+    void setTileMoves(const QVector<double> &value); // s, after each stack but the last one
+    void setTileOverhead(double value);              // s, lower bound of the dead time per tile
+
+    void setOutputPaths(const QStringList &paths);
+    void setOutputPaths(const QList<QStringList> &paths, const QList<QVector<int>> &weights);
+    void benchmarkDisks(size_t bytes = size_t(512) << 20);
+    void setBandwidth(int disk, double value);
+
+    void run();
+
+    double getDuration() const;    // s
+    double getCaptureTime() const; // s
+    QVector<Disk> getDisks() const;
+    bool fits() const;
+    QStringList getProblems() const;
+    QString report() const;
+
+    static double measureWriteBandwidth(const QString &dir, size_t bytes);
+    static double freeSpace(const QString &dir);
+
+    double cameraBandwidth(int cam) const;
+    static QString formatDuration(double s);
+
+private:
+    int nCams;
+    int stackFrames = 0;
+    double triggerRate = 0;
+    QVector<double> stackBytes;
+    QVector<double> frameBytes;
+    QVector<int> bufferFrames;
+    QVector<double> tileMoves;
+    double tileOverhead = 0;
+
+    QVector<Disk> disks;
+
+    double duration = 0;
+    double captureTime = 0;
+    double deadTime = 0;
+    QStringList problems;
+};
+
+#endif // ACQUISITIONPLANNER_H
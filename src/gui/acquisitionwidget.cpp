@@ -13,6 +13,7 @@
 #include <QLabel>
 #include <QPushButton>
 #include <QRadioButton>
+#include <QSpinBox>
 
 AcquisitionWidget::AcquisitionWidget(QWidget *parent)
     : QWidget(parent)
@@ -145,7 +146,44 @@ void AcquisitionWidget::setupUI()
     grid->addWidget(new QLabel("Binning"), row, col++);
     grid->addWidget(noBinningRadioButton, row, col++);
     grid->addWidget(twoBinningRadioButton, row, col++);
-    grid->addWidget(fourBinningRadioButton, row, col++);
+    grid->addWidget(fourBinningRadioButton, row++, col++);
+
+    QCheckBox *serpentineCheckBox = new QCheckBox("Serpentine scan");
+    serpentineCheckBox->setToolTip("Acquire odd stacks in reverse and traverse the mosaic in "
+                                   "boustrophedon order");
+    serpentineCheckBox->setChecked(spim().isSerpentineEnabled());
+    col = 0;
+    grid->addWidget(serpentineCheckBox, row++, col, 1, 4);
+
+    QCheckBox *positionTriggerCheckBox = new QCheckBox("Position trigger");
+    positionTriggerCheckBox->setToolTip("Trigger the cameras from the position pulses of the "
+                                        "stack stage and scan at full frame rate");
+    positionTriggerCheckBox->setChecked(spim().isPositionTriggerEnabled());
+    col = 0;
+    grid->addWidget(positionTriggerCheckBox, row++, col, 1, 4);
+
+    QCheckBox *mipCheckBox = new QCheckBox("Save MIP");
+    mipCheckBox->setToolTip("Save the maximum intensity projection of each stack");
+    mipCheckBox->setChecked(spim().isMIPEnabled());
+    QCheckBox *meanCheckBox = new QCheckBox("Save mean projection");
+    meanCheckBox->setChecked(spim().isMeanProjectionEnabled());
+    col = 0;
+    grid->addWidget(mipCheckBox, row, col, 1, 2);
+    col += 2;
+    grid->addWidget(meanCheckBox, row++, col, 1, 2);
+
+    QSpinBox *pyramidSpinBox = new QSpinBox();
+    pyramidSpinBox->setRange(0, 3);
+    pyramidSpinBox->setSpecialValueText("None");
+    pyramidSpinBox->setToolTip("Number of downsampled levels (2x, 4x, 8x) saved with each stack");
+    pyramidSpinBox->setValue(spim().getPyramidLevels());
+    QCheckBox *zDecimationCheckBox = new QCheckBox("Z decimation");
+    zDecimationCheckBox->setToolTip("Also average consecutive frames in each pyramid level");
+    zDecimationCheckBox->setChecked(spim().isPyramidZDecimationEnabled());
+    col = 0;
+    grid->addWidget(new QLabel("Pyramid levels"), row, col++);
+    grid->addWidget(pyramidSpinBox, row, col++);
+    grid->addWidget(zDecimationCheckBox, row++, col, 1, 2);
 
     QBoxLayout *boxLayout;
 
@@ -162,6 +200,20 @@ void AcquisitionWidget::setupUI()
 
     connect(runNameLineEdit, &QLineEdit::textChanged, &spim(), &SPIM::setRunName);
 
+    connect(serpentineCheckBox, &QCheckBox::toggled, &spim(), &SPIM::setSerpentineEnabled);
+    connect(positionTriggerCheckBox,
+            &QCheckBox::toggled,
+            &spim(),
+            &SPIM::setPositionTriggerEnabled);
+    connect(mipCheckBox, &QCheckBox::toggled, &spim(), &SPIM::setMIPEnabled);
+    connect(meanCheckBox, &QCheckBox::toggled, &spim(), &SPIM::setMeanProjectionEnabled);
+    void (QSpinBox::*valueChanged)(int) = &QSpinBox::valueChanged;
+    connect(pyramidSpinBox, valueChanged, &spim(), &SPIM::setPyramidLevels);
+    connect(zDecimationCheckBox,
+            &QCheckBox::toggled,
+            &spim(),
+            &SPIM::setPyramidZDecimationEnabled);
+
     connect(setExpTimePushButton, &QPushButton::clicked, [=]() {
         spim().setExposureTime(expTimeSpinBox->value());
     });
@@ -0,0 +1,471 @@
+#include "binning.h"
+
+#include "workerpool.h"
+
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BINNING_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+/*
+ * Row primitives. Binning of an output row is done in three steps on a row of 32 bit
+ * accumulators: vertical sum of the B input rows (widen + accumulate), log2(B) passes of
+ * pairwise horizontal sums, and final division (shift) and narrowing to 16 bit.
+ */
+
+struct ScalarOps
+{
+    static void widen(const uint16_t *src, uint32_t *acc, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i) {
+            acc[i] = src[i];
+        }
+    }
+
+    static void accumulate(const uint16_t *src, uint32_t *acc, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i) {
+            acc[i] += src[i];
+        }
+    }
+
+    static void pairSum(uint32_t *acc, size_t n)
+    {
+        for (size_t i = 0; i < n / 2; ++i) {
+            acc[i] = acc[2 * i] + acc[2 * i + 1];
+        }
+    }
+
+    static void pack(const uint32_t *acc, uint16_t *out, size_t n, unsigned int shift)
+    {
+        for (size_t i = 0; i < n; ++i) {
+            out[i] = static_cast<uint16_t>(acc[i] >> shift);
+        }
+    }
+};
+
+#ifdef BINNING_X86
+
+struct SSE41Ops
+{
+    __attribute__((target("sse4.1"))) static void widen(const uint16_t *src,
+                                                         uint32_t *acc,
+                                                         size_t n)
+    {
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+            __m128i lo = _mm_cvtepu16_epi32(v);
+            __m128i hi = _mm_cvtepu16_epi32(_mm_srli_si128(v, 8));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(acc + i), lo);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(acc + i + 4), hi);
+        }
+        ScalarOps::widen(src + i, acc + i, n - i);
+    }
+
+    __attribute__((target("sse4.1"))) static void accumulate(const uint16_t *src,
+                                                              uint32_t *acc,
+                                                              size_t n)
+    {
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+            __m128i *a0 = reinterpret_cast<__m128i *>(acc + i);
+            __m128i *a1 = reinterpret_cast<__m128i *>(acc + i + 4);
+            _mm_storeu_si128(a0, _mm_add_epi32(_mm_loadu_si128(a0), _mm_cvtepu16_epi32(v)));
+            _mm_storeu_si128(a1,
+                             _mm_add_epi32(_mm_loadu_si128(a1),
+                                           _mm_cvtepu16_epi32(_mm_srli_si128(v, 8))));
+        }
+        ScalarOps::accumulate(src + i, acc + i, n - i);
+    }
+
+    __attribute__((target("sse4.1"))) static void pairSum(uint32_t *acc, size_t n)
+    {
+        size_t i = 0;
+        for (; 2 * i + 8 <= n; i += 4) {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(acc + 2 * i));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(acc + 2 * i + 4));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(acc + i), _mm_hadd_epi32(a, b));
+        }
+        for (; i < n / 2; ++i) {
+            acc[i] = acc[2 * i] + acc[2 * i + 1];
+        }
+    }
+
+    __attribute__((target("sse4.1"))) static void pack(const uint32_t *acc,
+                                                        uint16_t *out,
+                                                        size_t n,
+                                                        unsigned int shift)
+    {
+        __m128i count = _mm_cvtsi32_si128(static_cast<int>(shift));
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(acc + i));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(acc + i + 4));
+            a = _mm_srl_epi32(a, count);
+            b = _mm_srl_epi32(b, count);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_packus_epi32(a, b));
+        }
+        ScalarOps::pack(acc + i, out + i, n - i, shift);
+    }
+};
+
+struct AVX2Ops
+{
+    __attribute__((target("avx2"))) static void widen(const uint16_t *src,
+                                                       uint32_t *acc,
+                                                       size_t n)
+    {
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+            __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 8));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(acc + i), _mm256_cvtepu16_epi32(v0));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(acc + i + 8),
+                                _mm256_cvtepu16_epi32(v1));
+        }
+        ScalarOps::widen(src + i, acc + i, n - i);
+    }
+
+    __attribute__((target("avx2"))) static void accumulate(const uint16_t *src,
+                                                            uint32_t *acc,
+                                                            size_t n)
+    {
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+            __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 8));
+            __m256i *a0 = reinterpret_cast<__m256i *>(acc + i);
+            __m256i *a1 = reinterpret_cast<__m256i *>(acc + i + 8);
+            _mm256_storeu_si256(a0,
+                                _mm256_add_epi32(_mm256_loadu_si256(a0),
+                                                 _mm256_cvtepu16_epi32(v0)));
+            _mm256_storeu_si256(a1,
+                                _mm256_add_epi32(_mm256_loadu_si256(a1),
+                                                 _mm256_cvtepu16_epi32(v1)));
+        }
+        ScalarOps::accumulate(src + i, acc + i, n - i);
+    }
+
+    __attribute__((target("avx2"))) static void pairSum(uint32_t *acc, size_t n)
+    {
+        size_t i = 0;
+        for (; 2 * i + 16 <= n; i += 8) {
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(acc + 2 * i));
+            __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(acc + 2 * i + 8));
+            // hadd works within 128 bit lanes: restore the order of the 64 bit quarters
+            __m256i h = _mm256_permute4x64_epi64(_mm256_hadd_epi32(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(acc + i), h);
+        }
+        for (; i < n / 2; ++i) {
+            acc[i] = acc[2 * i] + acc[2 * i + 1];
+        }
+    }
+
+    __attribute__((target("avx2"))) static void pack(const uint32_t *acc,
+                                                      uint16_t *out,
+                                                      size_t n,
+                                                      unsigned int shift)
+    {
+        __m128i count = _mm_cvtsi32_si128(static_cast<int>(shift));
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(acc + i));
+            __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(acc + i + 8));
+            a = _mm256_srl_epi32(a, count);
+            b = _mm256_srl_epi32(b, count);
+            __m256i p = _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b),
+                                                 _MM_SHUFFLE(3, 1, 2, 0));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), p);
+        }
+        ScalarOps::pack(acc + i, out + i, n - i, shift);
+    }
+};
+
+#endif
+
+typedef void (*RowFn)(const uint16_t *in,
+                      uint16_t *out,
+                      size_t width,
+                      size_t outWidth,
+                      size_t rowFrom,
+                      size_t rowTo);
+
+template<unsigned int B>
+struct Log2
+{
+    static constexpr unsigned int value = 1 + Log2<B / 2>::value;
+};
+
+template<>
+struct Log2<1>
+{
+    static constexpr unsigned int value = 0;
+};
+
+template<unsigned int B, typename Ops>
+void binRowsImpl(const uint16_t *in,
+                 uint16_t *out,
+                 size_t width,
+                 size_t outWidth,
+                 size_t rowFrom,
+                 size_t rowTo)
+{
+    static thread_local std::vector<uint32_t> accBuf;
+    const size_t n = outWidth * B;
+    if (accBuf.size() < n) {
+        accBuf.resize(n);
+    }
+    uint32_t *acc = accBuf.data();
+
+    for (size_t r = rowFrom; r < rowTo; ++r) {
+        const uint16_t *src = in + r * B * width;
+        Ops::widen(src, acc, n);
+        for (unsigned int j = 1; j < B; ++j) {
+            Ops::accumulate(src + j * width, acc, n);
+        }
+        size_t m = n;
+        for (unsigned int k = B; k > 1; k /= 2) {
+            Ops::pairSum(acc, m);
+            m /= 2;
+        }
+        Ops::pack(acc, out + r * outWidth, outWidth, 2 * Log2<B>::value);
+    }
+}
+
+template<typename Ops>
+void copyRows(const uint16_t *in,
+              uint16_t *out,
+              size_t width,
+              size_t outWidth,
+              size_t rowFrom,
+              size_t rowTo)
+{
+    (void) outWidth;
+    memcpy(out + rowFrom * width,
+           in + rowFrom * width,
+           (rowTo - rowFrom) * width * sizeof(uint16_t));
+}
+
+RowFn rowFunction(unsigned int factor, Binning::ISA isa)
+{
+#ifdef BINNING_X86
+#define BINNING_ROW_FNS(Ops)                                                                       \
+    {                                                                                              \
+        copyRows<Ops>, binRowsImpl<2, Ops>, binRowsImpl<4, Ops>, binRowsImpl<8, Ops>               \
+    }
+    static const RowFn table[3][4] = {
+        BINNING_ROW_FNS(ScalarOps),
+        BINNING_ROW_FNS(SSE41Ops),
+        BINNING_ROW_FNS(AVX2Ops),
+    };
+#undef BINNING_ROW_FNS
+#else
+    static const RowFn table[1][4] = {
+        {copyRows<ScalarOps>,
+         binRowsImpl<2, ScalarOps>,
+         binRowsImpl<4, ScalarOps>,
+         binRowsImpl<8, ScalarOps>},
+    };
+    isa = Binning::ISA_SCALAR;
+#endif
+    int idx = factor == 8 ? 3 : factor == 4 ? 2 : factor == 2 ? 1 : 0;
+    return table[isa][idx];
+}
+
+} // namespace
+
+Binning::Binning(unsigned int factor, size_t width, size_t height)
+    : factor(factor)
+    , width(width)
+    , height(height)
+    , isa(detectISA())
+    , threads(1)
+{}
+
+Binning::ISA Binning::detectISA()
+{
+#ifdef BINNING_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return ISA_AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return ISA_SSE41;
+    }
+#endif
+    return ISA_SCALAR;
+}
+
+const char *Binning::isaName(ISA isa)
+{
+    switch (isa) {
+    case ISA_AVX2:
+        return "AVX2";
+    case ISA_SSE41:
+        return "SSE4.1";
+    case ISA_SCALAR:
+    default:
+        return "scalar";
+    }
+}
+
+bool Binning::isSupportedFactor(unsigned int factor)
+{
+    return factor == 1 || factor == 2 || factor == 4 || factor == 8;
+}
+
+void Binning::setFactor(unsigned int value)
+{
+    factor = value;
+}
+
+unsigned int Binning::getFactor() const
+{
+    return factor;
+}
+
+void Binning::setFrameSize(size_t width, size_t height)
+{
+    this->width = width;
+    this->height = height;
+}
+
+size_t Binning::getOutputWidth() const
+{
+    return width / factor;
+}
+
+size_t Binning::getOutputHeight() const
+{
+    return height / factor;
+}
+
+size_t Binning::getOutputPixels() const
+{
+    return getOutputWidth() * getOutputHeight();
+}
+
+void Binning::setISA(ISA value)
+{
+    isa = value > detectISA() ? detectISA() : value;
+}
+
+Binning::ISA Binning::getISA() const
+{
+    return isa;
+}
+
+void Binning::setWorkerPool(WorkerPool *value)
+{
+    pool = value;
+}
+
+/**
+ * @brief Maximum number of row bands a frame is split into (1 = single threaded).
+ */
+void Binning::setMaxThreads(int value)
+{
+    maxThreads = value < 1 ? 1 : value;
+    if (threads > maxThreads) {
+        threads = maxThreads;
+    }
+}
+
+/**
+ * @brief Time available to bin one frame (us).
+ *
+ * When set, the number of row bands is increased while binning a frame takes more than half of
+ * the budget, and decreased again when it takes less than a fifth of it.
+ */
+void Binning::setTimeBudget(double us)
+{
+    timeBudget = us;
+}
+
+int Binning::getThreads() const
+{
+    return threads;
+}
+
+void Binning::bin(const uint16_t *in, uint16_t *out)
+{
+    if (!isSupportedFactor(factor)) {
+        binReference(factor, in, out, width, height);
+        return;
+    }
+
+    const size_t outHeight = getOutputHeight();
+    const int nBands = pool == nullptr ? 1 : threads.load();
+
+    auto start = std::chrono::steady_clock::now();
+
+    if (nBands <= 1) {
+        binRows(in, out, 0, outHeight);
+    } else {
+        pool->run(nBands, [&](int band) {
+            size_t from = outHeight * static_cast<size_t>(band) / nBands;
+            size_t to = outHeight * static_cast<size_t>(band + 1) / nBands;
+            binRows(in, out, from, to);
+        });
+    }
+
+    if (timeBudget > 0 && pool != nullptr) {
+        double elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now()
+                                                                   - start)
+                             .count();
+        int t = threads;
+        if (elapsed > 0.5 * timeBudget && t < maxThreads) {
+            threads = t + 1;
+        } else if (elapsed < 0.2 * timeBudget && t > 1) {
+            threads = t - 1;
+        }
+    }
+}
+
+/**
+ * @brief Converts binned pixels to double, the format of the live view (see DisplayWorker).
+ */
+void Binning::toDouble(const uint16_t *in, double *out, size_t pixels)
+{
+    for (size_t i = 0; i < pixels; ++i) {
+        out[i] = in[i];
+    }
+}
+
+void Binning::binRows(const uint16_t *in, uint16_t *out, size_t rowFrom, size_t rowTo) const
+{
+    rowFunction(factor, isa)(in, out, width, getOutputWidth(), rowFrom, rowTo);
+}
+
+/**
+ * @brief Straightforward implementation with double accumulators, kept as reference.
+ */
+void Binning::binReference(
+    unsigned int factor, const uint16_t *in, uint16_t *out, size_t width, size_t height)
+{
+    size_t outWidth = width / factor;
+    size_t outHeight = height / factor;
+    unsigned int factorSq = factor * factor;
+
+    for (size_t oj = 0; oj < outHeight; ++oj) {
+        for (size_t oi = 0; oi < outWidth; ++oi) {
+            size_t jFrom = oj * factor;
+            size_t iFrom = oi * factor;
+            double temp = 0;
+            for (unsigned int j = 0; j < factor; ++j) {
+                for (unsigned int i = 0; i < factor; ++i) {
+                    temp += in[(jFrom + j) * width + iFrom + i];
+                }
+            }
+            *(out++) = temp / factorSq;
+        }
+    }
+}
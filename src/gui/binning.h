@@ -0,0 +1,72 @@
+#ifndef BINNING_H
+#define BINNING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+class WorkerPool;
+
+/**
+ * @brief XY binning of uint16 frames.
+ *
+ * Each output pixel is the sum of a binning x binning block of input pixels divided by
+ * binning^2 and truncated, i.e. the same rounding as the original double-based implementation.
+ * Kernels are specialised at compile time for 1x1, 2x2, 4x4 and 8x8 and for the scalar, SSE4.1
+ * and AVX2 instruction sets; the instruction set is selected at runtime.
+ */
+class Binning
+{
+public:
+    enum ISA : int {
+        ISA_SCALAR,
+        ISA_SSE41,
+        ISA_AVX2,
+    };
+
+    Binning(unsigned int factor = 1, size_t width = 2048, size_t height = 2048);
+
+    static ISA detectISA();
+    static const char *isaName(ISA isa);
+    static bool isSupportedFactor(unsigned int factor);
+
+    void setFactor(unsigned int value);
+    unsigned int getFactor() const;
+
+    void setFrameSize(size_t width, size_t height);
+    size_t getOutputWidth() const;
+    size_t getOutputHeight() const;
+    size_t getOutputPixels() const;
+
+    void setISA(ISA value);
+    ISA getISA() const;
+
+    void setWorkerPool(WorkerPool *value);
+    void setMaxThreads(int value);
+    void setTimeBudget(double us);
+    int getThreads() const;
+
+    void bin(const uint16_t *in, uint16_t *out);
+
+    static void toDouble(const uint16_t *in, double *out, size_t pixels);
+
+    static void binReference(unsigned int factor,
+                             const uint16_t *in,
+                             uint16_t *out,
+                             size_t width,
+                             size_t height);
+
+private:
+    unsigned int factor;
+    size_t width, height;
+    ISA isa;
+
+    WorkerPool *pool = nullptr;
+    int maxThreads = 1;
+    std::atomic<int> threads;
+    double timeBudget = 0; // us per frame, 0 = no adaptive threading
+
+    void binRows(const uint16_t *in, uint16_t *out, size_t rowFrom, size_t rowTo) const;
+};
+
+#endif // BINNING_H
@@ -0,0 +1,127 @@
+#include "bufferplanner.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <string>
+
+#include <unistd.h>
+
+constexpr int BufferPlanner::MIN_FRAMES;
+constexpr int BufferPlanner::DEFAULT_FRAMES;
+
+void BufferPlanner::setFrameBytes(size_t value)
+{
+    frameBytes = value;
+}
+
+void BufferPlanner::setCameraCount(int value)
+{
+    nCams = std::max(value, 1);
+}
+
+void BufferPlanner::setFramesPerStack(int value)
+{
+    framesPerStack = value;
+}
+
+void BufferPlanner::setTriggerRate(double value)
+{
+    triggerRate = value;
+}
+
+void BufferPlanner::setBinning(int value)
+{
+    binning = std::max(value, 1);
+}
+
+void BufferPlanner::setWriteThroughput(double value)
+{
+    writeThroughput = value;
+}
+
+void BufferPlanner::setAvailableMemory(size_t value)
+{
+    memory = value;
+}
+
+void BufferPlanner::setMemoryFraction(double value)
+{
+    memoryFraction = value;
+}
+
+/**
+ * @brief Seconds of frames the buffer holds on top of the backlog, to ride out disk stalls.
+ */
+void BufferPlanner::setHeadroom(double value)
+{
+    headroom = value;
+}
+
+BufferPlanner::Plan BufferPlanner::plan() const
+{
+    Plan p;
+    p.drainRate = 0;
+    p.fillTime = -1;
+
+    size_t binnedBytes = std::max<size_t>(frameBytes / (binning * binning), 1);
+    if (writeThroughput > 0) {
+        p.drainRate = writeThroughput / binnedBytes;
+    }
+
+    double needed = std::max<double>(MIN_FRAMES, std::ceil(headroom * triggerRate));
+    if (p.drainRate == 0) {
+        // unknown write speed: hold a whole stack
+        needed = std::max<double>(needed, framesPerStack);
+    } else if (p.drainRate < triggerRate) {
+        needed += std::ceil(framesPerStack * (1 - p.drainRate / triggerRate));
+    }
+    if (framesPerStack > 0) {
+        needed = std::min<double>(needed, framesPerStack);
+    }
+
+    double cap = 0;
+    if (frameBytes > 0) {
+        cap = std::floor(memory * memoryFraction / nCams / frameBytes);
+    }
+
+    p.neededFrames = static_cast<int>(needed);
+    p.sustainable = needed <= cap;
+    p.frames = static_cast<int>(std::min(needed, cap));
+    if (p.drainRate > 0 && p.drainRate < triggerRate) {
+        p.fillTime = p.frames / (triggerRate - p.drainRate);
+    }
+    return p;
+}
+
+QString BufferPlanner::describe(const BufferPlanner::Plan &p) const
+{
+    QString drain = p.drainRate > 0 ? QString("%1 frames/s").arg(p.drainRate, 0, 'f', 1)
+                                    : QString("unknown");
+    QString s = QString("%1 frames (%2 GB), needed %3, trigger rate %4 Hz, write rate %5")
+                    .arg(p.frames)
+                    .arg(double(p.frames) * frameBytes / 1e9, 0, 'f', 2)
+                    .arg(p.neededFrames)
+                    .arg(triggerRate, 0, 'f', 1)
+                    .arg(drain);
+    if (p.fillTime >= 0) {
+        s += QString(", full after %1 s").arg(p.fillTime, 0, 'f', 1);
+    }
+    return s;
+}
+
+/**
+ * @brief Physical memory available for new allocations (MemAvailable in /proc/meminfo), in
+ * bytes.
+ */
+size_t BufferPlanner::availableMemory()
+{
+    std::ifstream meminfo("/proc/meminfo");
+    std::string line;
+    while (std::getline(meminfo, line)) {
+        if (line.compare(0, 13, "MemAvailable:") == 0) {
+            return std::stoull(line.substr(13)) * 1024; // kB
+        }
+    }
+    return static_cast<size_t>(sysconf(_SC_AVPHYS_PAGES)) * sysconf(_SC_PAGESIZE);
+}
@@ -0,0 +1,59 @@
+#ifndef BUFFERPLANNER_H
+#define BUFFERPLANNER_H
+
+#include <cstddef>
+
+#include <QString>
+
+/**
+ * @brief Sizes the DCAM ring buffer of a camera.
+ *
+ * Frames enter the buffer at the trigger rate and leave it at the rate the writers can sustain,
+ * i.e. the measured write throughput divided by the size of a binned frame. If the writers keep
+ * up, the buffer only has to absorb disk stalls (a few seconds' worth of frames); otherwise it
+ * must also hold the backlog that builds up during a stack. The result is bounded by the size of
+ * a stack and by the share of physical memory available to each camera.
+ */
+class BufferPlanner
+{
+public:
+    static constexpr int MIN_FRAMES = 32;
+    static constexpr int DEFAULT_FRAMES = 256; // before any acquisition has been planned
+
+    struct Plan
+    {
+        int frames;        // buffer size
+        int neededFrames;  // buffer size needed to sustain the trigger rate
+        bool sustainable;  // neededFrames fit in memory
+        double drainRate;  // frames/s, 0 if the write throughput is unknown
+        double fillTime;   // s, time before a full buffer, < 0 if it never fills up
+    };
+
+    void setFrameBytes(size_t value);
+    void setCameraCount(int value);
+    void setFramesPerStack(int value);
+    void setTriggerRate(double value); // Hz
+    void setBinning(int value);
+    void setWriteThroughput(double value); // bytes/s of binned frames, per camera, 0 = unknown
+    void setAvailableMemory(size_t value); // bytes
+    void setMemoryFraction(double value);
+    void setHeadroom(double value); // s
+
+    Plan plan() const;
+    QString describe(const Plan &p) const;
+
+    static size_t availableMemory();
+
+private:
+    size_t frameBytes = 0;
+    int nCams = 1;
+    int framesPerStack = 0;
+    double triggerRate = 0;
+    int binning = 1;
+    double writeThroughput = 0;
+    size_t memory = 0;
+    double memoryFraction = 0.75; // of the available memory, for all cameras
+    double headroom = 2;
+};
+
+#endif // BUFFERPLANNER_H
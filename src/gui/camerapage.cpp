@@ -7,6 +7,7 @@
 #include "settings.h"
 #include "spim.h"
 
+#include <qtlab/hw/hamamatsu/orcaflash.h>
 #include <qtlab/widgets/cameradisplay.h>
 #include <qtlab/widgets/cameraplot.h>
 #include <qtlab/widgets/customspinbox.h>
@@ -40,15 +41,20 @@ void CameraPage::setupUI()
         cd->setPlotSize(QSize(2048, 2048));
         cd->getPlot()->fillGradient();
         DisplayWorker *worker = new DisplayWorker(spim().getCamera(i));
-        void (CameraPlot::*fp)(const double *, const size_t) = &CameraPlot::setData;
-        connect(worker, &DisplayWorker::newImage, cd->getPlot(), fp);
+        CameraPlot *plot = cd->getPlot();
+        connect(worker, &DisplayWorker::newImage, plot, [=](const QVector<double> &data) {
+            plot->setData(data.constData(), static_cast<size_t>(data.size()));
+            worker->frameConsumed();
+        });
         cd->setLUTPath(LUTPath);
         vLayout->addWidget(cd);
         cameraHLayout->addLayout(vLayout);
         connect(&spim(), &SPIM::captureStarted, this, [=]() {
-            int binning = spim().getBinning();
-            worker->setBinning(binning);
-            cd->setPlotSize(QSize(2048 / binning, 2048 / binning));
+            worker->setBinning(spim().getBinning());
+            worker->setDisplaySize(plot->size());
+            int f = static_cast<int>(worker->getDisplayFactor());
+            OrcaFlash *orca = spim().getCamera(i);
+            cd->setPlotSize(QSize(orca->getImageWidth() / f, orca->getImageHeight() / f));
         });
     }
 
@@ -117,6 +123,23 @@ void CameraPage::setupUI()
         QMetaObject::invokeMethod(&spim(), &SPIM::startAcquisition, Qt::QueuedConnection);
     });
 
+    QPushButton *planPushButton = new QPushButton("Plan acquisition");
+    planPushButton->setToolTip("Estimate duration, data volume and disk load of the acquisition "
+                               "(benchmarks the output disks)");
+    connect(planPushButton, &QPushButton::clicked, [=]() {
+        QMetaObject::invokeMethod(&spim(), &SPIM::planAcquisition, Qt::QueuedConnection);
+    });
+    connect(&spim(), &SPIM::acquisitionPlanned, this, [=](const QString &report) {
+        QMessageBox::information(this, "Acquisition plan", report);
+    });
+
+    QPushButton *calibratePushButton = new QPushButton("Calibrate trigger rate");
+    calibratePushButton->setToolTip("Find the highest trigger rate the cameras follow without "
+                                    "losing frames at the current exposure time and binning");
+    connect(calibratePushButton, &QPushButton::clicked, [=]() {
+        QMetaObject::invokeMethod(&spim(), &SPIM::startTriggerCalibration, Qt::QueuedConnection);
+    });
+
     QPushButton *stopCapturePushButton = new QPushButton("Stop capture");
     connect(stopCapturePushButton, &QPushButton::clicked, &spim(), &SPIM::stop);
 
@@ -130,6 +153,8 @@ void CameraPage::setupUI()
     QState *s;
 
     s = spim().getState(SPIM::STATE_UNINITIALIZED);
+    s->assignProperty(planPushButton, "enabled", false);
+    s->assignProperty(calibratePushButton, "enabled", false);
     s->assignProperty(initPushButton, "enabled", true);
     s->assignProperty(startFreeRunPushButton, "enabled", false);
     s->assignProperty(startAcqPushButton, "enabled", false);
@@ -138,6 +163,8 @@ void CameraPage::setupUI()
     s->assignProperty(statusLabel, "text", "Uninitialized");
 
     s = spim().getState(SPIM::STATE_READY);
+    s->assignProperty(planPushButton, "enabled", true);
+    s->assignProperty(calibratePushButton, "enabled", true);
     s->assignProperty(initPushButton, "enabled", false);
     s->assignProperty(startFreeRunPushButton, "enabled", true);
     s->assignProperty(startAcqPushButton, "enabled", true);
@@ -146,6 +173,8 @@ void CameraPage::setupUI()
     s->assignProperty(statusLabel, "text", "Ready");
 
     s = spim().getState(SPIM::STATE_CAPTURING);
+    s->assignProperty(planPushButton, "enabled", false);
+    s->assignProperty(calibratePushButton, "enabled", false);
     s->assignProperty(startFreeRunPushButton, "enabled", false);
     s->assignProperty(startAcqPushButton, "enabled", false);
     s->assignProperty(stopCapturePushButton, "enabled", true);
@@ -160,6 +189,8 @@ void CameraPage::setupUI()
     layout->addWidget(initPushButton);
     layout->addWidget(startFreeRunPushButton);
     layout->addWidget(startAcqPushButton);
+    layout->addWidget(planPushButton);
+    layout->addWidget(calibratePushButton);
     layout->addWidget(stopCapturePushButton);
     layout->addStretch();
     layout->addWidget(emergencyStopPushButton);
@@ -20,7 +20,8 @@ CameraTrigger::CameraTrigger(QObject *parent)
     waiter = new TaskWaiter(this);
 
     connect(this, &CameraTrigger::started, this, [=]() {
-        if (!isFreeRun) {
+        // in position trigger mode the task is retriggered until stopped: it is never done
+        if (!isFreeRun && !positionTrigger) {
             setLogErrorsEnabled(false);
             waiter->start();
         }
@@ -80,10 +81,37 @@ void CameraTrigger::initializeTask_impl()
 
     if (isFreeRun) {
         cfgImplicitTiming(SampMode_ContSamps, 10);
+    } else if (positionTrigger) {
+        // one pulse per position pulse of the stage controller
+        cfgImplicitTiming(SampMode_FiniteSamps, 1);
+        cfgDigEdgeStartTrig(startTriggerTerm, Edge_Rising);
+        setStartTrigRetriggerable(true);
     } else {
         cfgImplicitTiming(SampMode_FiniteSamps, nPulses);
         cfgDigEdgeStartTrig(startTriggerTerm, Edge_Rising);
     }
+
+    committedConfiguration = configuration();
+}
+
+/**
+ * @brief Parameters the task is built from: if any of them differs from the ones used for the
+ * current task, the task has to be rebuilt.
+ */
+QVariantList CameraTrigger::configuration() const
+{
+    return {isFreeRun,
+            pulseFreq,
+            nPulses,
+            positionTrigger,
+            startTriggerTerm,
+            pulseTerms,
+            blankingPulseTerms};
+}
+
+bool CameraTrigger::needsRebuild() const
+{
+    return !isInitialized() || configuration() != committedConfiguration;
 }
 
 int CameraTrigger::getNPulses() const
@@ -96,6 +124,21 @@ void CameraTrigger::setNPulses(int value)
     nPulses = value;
 }
 
+bool CameraTrigger::isPositionTriggerEnabled() const
+{
+    return positionTrigger;
+}
+
+/**
+ * @brief In position trigger mode every pulse on the start trigger terminal (the position pulse
+ * output of the stack stage) fires one camera pulse, instead of starting a train of nPulses
+ * pulses at a fixed frequency.
+ */
+void CameraTrigger::setPositionTriggerEnabled(bool enable)
+{
+    positionTrigger = enable;
+}
+
 void CameraTrigger::setFreeRunEnabled(const bool enable)
 {
     isFreeRun = enable;
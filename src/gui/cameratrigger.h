@@ -4,6 +4,7 @@
 #include <qtlab/hw/ni/nitask.h>
 
 #include <QThread>
+#include <QVariantList>
 
 class TaskWaiter : public QThread
 {
@@ -68,6 +69,11 @@ public:
     int getNPulses() const;
     void setNPulses(int value);
 
+    bool isPositionTriggerEnabled() const;
+    void setPositionTriggerEnabled(bool enable);
+
+    bool needsRebuild() const;
+
 signals:
     void done();
 
@@ -78,11 +84,16 @@ private:
     bool isFreeRun;
     double pulseFreq;
     int nPulses = 0;
+    bool positionTrigger = false;
     QString startTriggerTerm;
     QStringList pulseTerms;
     QStringList blankingPulseTerms;
 
+    QVariantList committedConfiguration;
+
     TaskWaiter *waiter;
+
+    QVariantList configuration() const;
 };
 
 #endif // CAMERATRIGGER_H
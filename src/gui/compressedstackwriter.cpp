@@ -0,0 +1,432 @@
+#include "compressedstackwriter.h"
+
+#ifdef WITH_ZSTD
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <memory>
+#include <unistd.h>
+#include <zstd.h>
+
+#include <QtEndian>
+
+#define COMPRESSEDSTACK_MAGIC "SPIMZST1"
+#define COMPRESSEDSTACK_VERSION 1
+#define COMPRESSEDSTACK_FLAG_BYTESHUFFLE 0x1
+#define COMPRESSEDSTACK_HEADER_BYTES 64
+
+namespace {
+
+struct Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t frameBytes;
+    uint64_t frameCount;
+    uint64_t chunkBytes;
+    uint64_t indexOffset;
+    uint8_t reserved[16];
+};
+
+static_assert(sizeof(Header) == COMPRESSEDSTACK_HEADER_BYTES, "unexpected header size");
+
+/**
+ * @brief Per-thread scratch memory and zstd context, kept for the lifetime of the pool threads.
+ */
+struct ThreadContext
+{
+    ZSTD_CCtx *cctx = nullptr;
+    std::vector<uint8_t> shuffled;
+    std::vector<uint8_t> compressed;
+
+    ~ThreadContext()
+    {
+        ZSTD_freeCCtx(cctx);
+    }
+};
+
+thread_local ThreadContext threadContext;
+
+int64_t threadCpuTime()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// uint16 little endian pixels: all low bytes first, then all high bytes
+void shuffle(const uint8_t *in, uint8_t *out, size_t bytes)
+{
+    size_t n = bytes / 2;
+    uint8_t *lo = out;
+    uint8_t *hi = out + n;
+    for (size_t i = 0; i < n; ++i) {
+        lo[i] = in[2 * i];
+        hi[i] = in[2 * i + 1];
+    }
+    if (bytes % 2) {
+        out[bytes - 1] = in[bytes - 1];
+    }
+}
+
+void unshuffle(const uint8_t *in, uint8_t *out, size_t bytes)
+{
+    size_t n = bytes / 2;
+    const uint8_t *lo = in;
+    const uint8_t *hi = in + n;
+    for (size_t i = 0; i < n; ++i) {
+        out[2 * i] = lo[i];
+        out[2 * i + 1] = hi[i];
+    }
+    if (bytes % 2) {
+        out[bytes - 1] = in[bytes - 1];
+    }
+}
+
+bool pwriteAll(int fd, const void *data, size_t bytes, off_t offset)
+{
+    const uint8_t *buf = static_cast<const uint8_t *>(data);
+    while (bytes > 0) {
+        ssize_t written = pwrite(fd, buf, bytes, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buf += written;
+        bytes -= static_cast<size_t>(written);
+        offset += written;
+    }
+    return true;
+}
+
+bool preadAll(int fd, void *data, size_t bytes, off_t offset)
+{
+    uint8_t *buf = static_cast<uint8_t *>(data);
+    while (bytes > 0) {
+        ssize_t n = pread(fd, buf, bytes, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        bytes -= static_cast<size_t>(n);
+        offset += n;
+    }
+    return true;
+}
+
+} // namespace
+
+CompressedStackWriter::CompressedStackWriter(int level, int nThreads, size_t chunkBytes)
+    : level(level)
+    , chunkBytes(chunkBytes)
+    , pool(std::max(nThreads - 1, 0))
+{
+    writePos = 0;
+    compressedBytes = 0;
+    cpuTime = 0;
+    failed = false;
+    writtenFrames = 0;
+}
+
+CompressedStackWriter::~CompressedStackWriter()
+{
+    if (fd >= 0) {
+        writeback.finish();
+        ::close(fd);
+    }
+}
+
+StackWriter::Backend CompressedStackWriter::backend() const
+{
+    return BACKEND_COMPRESSED;
+}
+
+void CompressedStackWriter::setLevel(int value)
+{
+    level = value;
+}
+
+/**
+ * @brief Sets the number of threads compressing the chunks of a frame, including the writer
+ * thread calling writeFrame().
+ */
+void CompressedStackWriter::setThreadCount(int value)
+{
+    pool.setThreadCount(std::max(value - 1, 0));
+}
+
+bool CompressedStackWriter::open(const QString &fileName, size_t frameBytes, size_t frameCount)
+{
+    this->frameBytes = frameBytes;
+    this->frameCount = frameCount;
+    chunksPerFrame = (frameBytes + chunkBytes - 1) / chunkBytes;
+
+    fd = ::open(fileName.toLatin1(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        setErrno(QString("Cannot create output file %1").arg(fileName));
+        return false;
+    }
+
+    index.assign(frameCount * chunksPerFrame, IndexEntry{0, 0, 0});
+    writePos = COMPRESSEDSTACK_HEADER_BYTES;
+    compressedBytes = 0;
+    cpuTime = 0;
+    failed = false;
+    writtenFrames = 0;
+    wallTime = 0;
+    wallTimer.start();
+    writeback.start(fd);
+    return true;
+}
+
+bool CompressedStackWriter::writeFrame(size_t index, const void *data)
+{
+    if (index >= frameCount) {
+        errString = QString("frame %1 out of range (%2 frames)").arg(index).arg(frameCount);
+        return false;
+    }
+    const uint8_t *src = static_cast<const uint8_t *>(data);
+    pool.run(static_cast<int>(chunksPerFrame), [&](int chunk) {
+        if (!failed) {
+            compressChunk(index, static_cast<size_t>(chunk), src + chunk * chunkBytes);
+        }
+    });
+    writtenFrames++;
+    return !failed;
+}
+
+/**
+ * @brief Shuffles and compresses one chunk, then appends it to the file at a freshly reserved
+ * offset and records it in the index.
+ */
+bool CompressedStackWriter::compressChunk(size_t frame, size_t chunk, const uint8_t *src)
+{
+    int64_t t0 = threadCpuTime();
+    ThreadContext &ctx = threadContext;
+    if (ctx.cctx == nullptr) {
+        ctx.cctx = ZSTD_createCCtx();
+    }
+
+    size_t rawSize = std::min(chunkBytes, frameBytes - chunk * chunkBytes);
+    ctx.shuffled.resize(rawSize);
+    ctx.compressed.resize(ZSTD_compressBound(rawSize));
+    shuffle(src, ctx.shuffled.data(), rawSize);
+
+    size_t size = ZSTD_compressCCtx(ctx.cctx,
+                                    ctx.compressed.data(),
+                                    ctx.compressed.size(),
+                                    ctx.shuffled.data(),
+                                    rawSize,
+                                    level);
+    if (ZSTD_isError(size)) {
+        setError(QString("zstd: %1").arg(ZSTD_getErrorName(size)));
+        return false;
+    }
+    const uint8_t *out = ctx.compressed.data();
+    if (size >= rawSize) {
+        out = ctx.shuffled.data();
+        size = rawSize;
+    }
+
+    uint64_t offset = writePos.fetch_add(size);
+    if (!pwriteAll(fd, out, size, static_cast<off_t>(offset))) {
+        setError(QString("write at offset %1: %2").arg(offset).arg(strerror(errno)));
+        return false;
+    }
+    writeback.completed(offset, size);
+
+    IndexEntry &e = this->index[frame * chunksPerFrame + chunk];
+    e.offset = qToLittleEndian<quint64>(offset);
+    e.size = qToLittleEndian<quint32>(static_cast<uint32_t>(size));
+    e.rawSize = qToLittleEndian<quint32>(static_cast<uint32_t>(rawSize));
+
+    compressedBytes += size;
+    cpuTime += threadCpuTime() - t0;
+    return true;
+}
+
+bool CompressedStackWriter::close()
+{
+    if (fd < 0) {
+        return true;
+    }
+    bool ok = !failed;
+    uint64_t indexOffset = writePos;
+
+    Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, COMPRESSEDSTACK_MAGIC, sizeof(h.magic));
+    h.version = qToLittleEndian<quint32>(COMPRESSEDSTACK_VERSION);
+    h.flags = qToLittleEndian<quint32>(COMPRESSEDSTACK_FLAG_BYTESHUFFLE);
+    h.frameBytes = qToLittleEndian<quint64>(frameBytes);
+    h.frameCount = qToLittleEndian<quint64>(frameCount);
+    h.chunkBytes = qToLittleEndian<quint64>(chunkBytes);
+    h.indexOffset = qToLittleEndian<quint64>(indexOffset);
+
+    if (ok
+        && (!pwriteAll(fd,
+                       index.data(),
+                       index.size() * sizeof(IndexEntry),
+                       static_cast<off_t>(indexOffset))
+            || !pwriteAll(fd, &h, sizeof(h), 0))) {
+        setErrno("Cannot write chunk index");
+        ok = false;
+    }
+    if (!writeback.finish() && ok) {
+        setErrno("writeback");
+        ok = false;
+    }
+    if (::close(fd) != 0) {
+        setErrno("close");
+        ok = false;
+    }
+    fd = -1;
+    wallTime = wallTimer.nsecsElapsed() * 1e-9;
+    return ok;
+}
+
+bool CompressedStackWriter::supportsConcurrentWrites() const
+{
+    return true;
+}
+
+double CompressedStackWriter::getCompressionRatio() const
+{
+    uint64_t c = compressedBytes;
+    return c == 0 ? 0 : static_cast<double>(writtenFrames * frameBytes) / c;
+}
+
+double CompressedStackWriter::getCpuTime() const
+{
+    return cpuTime * 1e-9;
+}
+
+/**
+ * @brief Compression ratio, CPU time and compression throughput for the last stack.
+ *
+ * The throughput is the raw data rate that the pool threads can sustain when fully busy: with
+ * two cameras it must stay above twice the frame size times the trigger rate.
+ */
+QString CompressedStackWriter::report() const
+{
+    double cpu = getCpuTime();
+    size_t frames = writtenFrames;
+    double rawMB = frames * frameBytes / 1e6;
+    int nThreads = pool.threadCount() + 1;
+    return QString("zstd level %1, %2 frames, compression ratio %3, CPU time %4 s (%5 ms/frame), "
+                   "capacity %6 MB/s with %7 threads, wall time %8 s")
+        .arg(level)
+        .arg(frames)
+        .arg(getCompressionRatio(), 0, 'f', 2)
+        .arg(cpu, 0, 'f', 2)
+        .arg(frames > 0 ? 1e3 * cpu / frames : 0., 0, 'f', 2)
+        .arg(cpu > 0 ? rawMB / cpu * nThreads : 0., 0, 'f', 0)
+        .arg(nThreads)
+        .arg(wallTime, 0, 'f', 2)
+        + (writeback.isEnabled() ? ", " + writeback.report() : QString());
+}
+
+void CompressedStackWriter::setError(const QString &msg)
+{
+    std::lock_guard<std::mutex> lock(errorMutex);
+    if (!failed) {
+        errString = msg;
+        failed = true;
+    }
+}
+
+/**
+ * @brief Reads and decompresses frame \a index of a compressed stack into \a out, which must hold
+ * at least \a outBytes (the frame size stored in the file header).
+ */
+bool CompressedStackWriter::readFrame(const QString &fileName,
+                                      size_t index,
+                                      void *out,
+                                      size_t outBytes,
+                                      QString *errorString)
+{
+    auto fail = [errorString](const QString &msg) {
+        if (errorString != nullptr) {
+            *errorString = msg;
+        }
+        return false;
+    };
+
+    int fd = ::open(fileName.toLatin1(), O_RDONLY);
+    if (fd < 0) {
+        return fail(QString("Cannot open %1: %2").arg(fileName).arg(strerror(errno)));
+    }
+    // closes fd on every return path
+    std::unique_ptr<int, void (*)(int *)> fdGuard(&fd, [](int *p) { ::close(*p); });
+
+    Header h;
+    if (!preadAll(fd, &h, sizeof(h), 0) || memcmp(h.magic, COMPRESSEDSTACK_MAGIC, 8) != 0) {
+        return fail(QString("%1 is not a compressed stack").arg(fileName));
+    }
+    size_t frameBytes = qFromLittleEndian<quint64>(h.frameBytes);
+    size_t frameCount = qFromLittleEndian<quint64>(h.frameCount);
+    size_t chunkBytes = qFromLittleEndian<quint64>(h.chunkBytes);
+    uint64_t indexOffset = qFromLittleEndian<quint64>(h.indexOffset);
+    bool shuffled = qFromLittleEndian<quint32>(h.flags) & COMPRESSEDSTACK_FLAG_BYTESHUFFLE;
+
+    if (index >= frameCount) {
+        return fail(QString("frame %1 out of range (%2 frames)").arg(index).arg(frameCount));
+    }
+    if (outBytes < frameBytes) {
+        return fail(QString("output buffer too small (%1/%2 bytes)").arg(outBytes).arg(frameBytes));
+    }
+
+    size_t chunksPerFrame = (frameBytes + chunkBytes - 1) / chunkBytes;
+    std::vector<IndexEntry> entries(chunksPerFrame);
+    off_t entriesOffset = static_cast<off_t>(indexOffset
+                                             + index * chunksPerFrame * sizeof(IndexEntry));
+    if (!preadAll(fd, entries.data(), chunksPerFrame * sizeof(IndexEntry), entriesOffset)) {
+        return fail(QString("Cannot read chunk index of %1").arg(fileName));
+    }
+
+    std::vector<uint8_t> compressed, raw(chunkBytes);
+    uint8_t *dst = static_cast<uint8_t *>(out);
+    for (size_t i = 0; i < chunksPerFrame; ++i) {
+        uint64_t offset = qFromLittleEndian<quint64>(entries[i].offset);
+        size_t size = qFromLittleEndian<quint32>(entries[i].size);
+        size_t rawSize = qFromLittleEndian<quint32>(entries[i].rawSize);
+        if (rawSize == 0) {
+            // stack aborted before this frame was written
+            return fail(QString("frame %1 missing from %2").arg(index).arg(fileName));
+        }
+        if (rawSize > chunkBytes) {
+            return fail(QString("corrupted chunk index in %1").arg(fileName));
+        }
+
+        compressed.resize(size);
+        if (!preadAll(fd, compressed.data(), size, static_cast<off_t>(offset))) {
+            return fail(QString("Cannot read chunk at offset %1").arg(offset));
+        }
+        if (size == rawSize) {
+            memcpy(raw.data(), compressed.data(), size);
+        } else {
+            size_t ret = ZSTD_decompress(raw.data(), rawSize, compressed.data(), size);
+            if (ZSTD_isError(ret) || ret != rawSize) {
+                return fail(QString("Cannot decompress chunk at offset %1").arg(offset));
+            }
+        }
+        if (shuffled) {
+            unshuffle(raw.data(), dst, rawSize);
+        } else {
+            memcpy(dst, raw.data(), rawSize);
+        }
+        dst += rawSize;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef COMPRESSEDSTACKWRITER_H
+#define COMPRESSEDSTACKWRITER_H
+
+#include "stackwriter.h"
+
+#ifdef WITH_ZSTD
+
+#include "workerpool.h"
+
+#include <atomic>
+#include <mutex>
+
+#include <QElapsedTimer>
+
+/**
+ * @brief Lossless compressed writer: each frame is split into chunks that are byte-shuffled
+ * (low bytes first, then high bytes) and compressed with zstd in a thread pool.
+ *
+ * Chunks are appended to the file in completion order; a chunk index written at the end of the
+ * file records where every chunk of every frame lives, so that single planes can be read back
+ * with readFrame() without decompressing the whole stack. File layout (little endian):
+ *
+ *     header     magic "SPIMZST1", uint32 version, uint32 flags, uint64 frameBytes,
+ *                uint64 frameCount, uint64 chunkBytes, uint64 indexOffset (64 bytes in total)
+ *     chunks     compressed data
+ *     index      frameCount * chunksPerFrame entries of
+ *                {uint64 offset, uint32 size, uint32 rawSize}
+ *
+ * Chunks that do not shrink are stored shuffled but uncompressed (size == rawSize).
+ *
+ * The file is not a MetaImage data file: SaveStackWorker describes it in a <name>.txt sidecar
+ * (DataFormat = SPIMZST1) instead of a .mhd header.
+ */
+class CompressedStackWriter : public StackWriter
+{
+public:
+    CompressedStackWriter(int level = 1, int nThreads = 4, size_t chunkBytes = 1 << 20);
+    virtual ~CompressedStackWriter() override;
+
+    virtual Backend backend() const override;
+    virtual bool open(const QString &fileName, size_t frameBytes, size_t frameCount) override;
+    virtual bool writeFrame(size_t index, const void *data) override;
+    virtual bool close() override;
+    virtual bool supportsConcurrentWrites() const override;
+    virtual QString report() const override;
+
+    void setLevel(int value);
+    void setThreadCount(int value);
+
+    double getCompressionRatio() const;
+    double getCpuTime() const; // s
+
+    static bool readFrame(const QString &fileName,
+                          size_t index,
+                          void *out,
+                          size_t outBytes,
+                          QString *errorString = nullptr);
+
+private:
+    struct IndexEntry
+    {
+        uint64_t offset;
+        uint32_t size;
+        uint32_t rawSize;
+    };
+
+    int fd = -1;
+    int level;
+    size_t chunkBytes;
+    size_t chunksPerFrame = 0;
+    WorkerPool pool;
+
+    std::vector<IndexEntry> index;
+    std::atomic<uint64_t> writePos;
+    std::atomic<uint64_t> compressedBytes;
+    std::atomic<int64_t> cpuTime; // ns, summed over pool threads
+    std::atomic<bool> failed;
+    std::mutex errorMutex;
+    std::atomic<size_t> writtenFrames;
+    QElapsedTimer wallTimer;
+    double wallTime = 0; // s
+
+    bool compressChunk(size_t frame, size_t chunk, const uint8_t *src);
+    void setError(const QString &msg);
+};
+
+#endif
+
+#endif // COMPRESSEDSTACKWRITER_H
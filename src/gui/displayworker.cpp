@@ -1,64 +1,125 @@
 #include "displayworker.h"
 
+#include "framepool.h"
+
+#include <algorithm>
+
 #include <qtlab/hw/hamamatsu/orcaflash.h>
-#include <qtlab/widgets/cameradisplay.h>
-#include <qtlab/widgets/cameraplot.h>
+
+#define DISPLAYWORKER_MAX_FACTOR 8
 
 DisplayWorker::DisplayWorker(OrcaFlash *camera, QObject *parent)
     : QThread(parent)
 {
-    qRegisterMetaType<size_t>("size_t");
-
-    mybufDouble = new double[2048 * 2048];
+    qRegisterMetaType<QVector<double>>("QVector<double>");
 
     orca = camera;
+    running = false;
+    pending = false;
+    displayFactor = 1;
 
-    connect(orca, &OrcaFlash::captureStarted, this, [=]() { start(); });
+    connect(orca, &OrcaFlash::captureStarted, this, [=]() {
+        pending = false;
+        start();
+    });
     connect(orca, &OrcaFlash::stopped, this, [=]() { running = false; });
 }
 
-DisplayWorker::~DisplayWorker()
-{
-    delete[] mybufDouble;
-}
+DisplayWorker::~DisplayWorker() {}
 
 void DisplayWorker::run()
 {
     void *buf = nullptr;
-    int w = orca->getImageWidth();
-    int h = orca->getImageHeight();
-    int bufsize = w * h;
+    size_t w = static_cast<size_t>(orca->getImageWidth());
+    size_t h = static_cast<size_t>(orca->getImageHeight());
+
+    binner.setFrameSize(w, h);
+    binner.setFactor(displayFactor);
+    const size_t pixels = binner.getOutputPixels();
+
+    // both recycled at every capture start
+    FramePool::Buffer binnedBuf, demoFrame;
+    try {
+        binnedBuf = FramePool::global().acquire(2 * pixels);
 #ifdef QTLAB_DCAM_DEMO
-    quint16 *bufInt = new quint16[bufsize];
-    buf = bufInt;
+        demoFrame = FramePool::global().acquire(2 * w * h);
+        buf = demoFrame.data();
 #endif
+    } catch (std::bad_alloc) {
+        return;
+    }
+
     running = true;
     while (true) {
         msleep(250);
         if (!running) {
-#ifdef QTLAB_DCAM_DEMO
-            delete[] bufInt;
-#endif
             break;
         }
+        if (pending) {
+            continue; // GUI still busy with the previous frame
+        }
         try {
             orca->lockFrame(-1, &buf);
         } catch (std::exception) {
             continue;
         }
-        quint16 *mybuf = static_cast<quint16 *>(buf);
-        int c = 0;
-        for (int i = 0; i < h; i += binning) {
-            for (int j = 0; j < w; j += binning) {
-                mybufDouble[c++] = mybuf[i * w + j];
-            }
-        }
 
-        emit newImage(mybufDouble, bufsize / binning / binning);
+        binner.bin(static_cast<const uint16_t *>(buf), binnedBuf.as<uint16_t>());
+
+        // data() detaches if the GUI still holds this buffer, so it is never written under its feet
+        QVector<double> &frame = frames[currentFrame];
+        currentFrame = 1 - currentFrame;
+        frame.resize(static_cast<int>(pixels));
+        Binning::toDouble(binnedBuf.as<uint16_t>(), frame.data(), pixels);
+
+        pending = true;
+        emit newImage(frame);
     }
 }
 
+/**
+ * @brief To be called by the receiver of newImage() once the frame has been handed to the plot.
+ */
+void DisplayWorker::frameConsumed()
+{
+    pending = false;
+}
+
 void DisplayWorker::setBinning(uint value)
 {
     binning = value;
+    updateDisplayFactor();
+}
+
+/**
+ * @brief Sets the on-screen size of the plot, frames are downsampled to (about) this size.
+ */
+void DisplayWorker::setDisplaySize(const QSize &size)
+{
+    displaySize = size;
+    updateDisplayFactor();
+}
+
+/**
+ * @brief Downsampling factor of displayed frames, which is never smaller than the acquisition
+ * binning so that the live view has the same geometry as the saved stacks.
+ */
+uint DisplayWorker::getDisplayFactor() const
+{
+    return displayFactor;
+}
+
+void DisplayWorker::updateDisplayFactor()
+{
+    size_t w = static_cast<size_t>(orca->getImageWidth());
+    size_t h = static_cast<size_t>(orca->getImageHeight());
+    uint f = std::max(binning, 1u);
+    if (displaySize.isValid() && !displaySize.isEmpty()) {
+        while (f < DISPLAYWORKER_MAX_FACTOR
+               && (w / f > static_cast<size_t>(displaySize.width())
+                   || h / f > static_cast<size_t>(displaySize.height()))) {
+            f *= 2;
+        }
+    }
+    displayFactor = f;
 }
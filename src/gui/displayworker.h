@@ -1,10 +1,25 @@
 #ifndef DISPLAYWORKER_H
 #define DISPLAYWORKER_H
 
+#include "binning.h"
+
+#include <atomic>
+
+#include <QSize>
 #include <QThread>
+#include <QVector>
 
 class OrcaFlash;
 
+/**
+ * @brief Periodically grabs the latest camera frame and downsamples it to display resolution.
+ *
+ * Frames are binned straight from the uint16 DCAM buffer by the SIMD binning kernels and
+ * converted to double only at display resolution. Two output buffers are used alternately; they
+ * are implicitly shared with the receiver of newImage(), so a buffer still held by the GUI is
+ * never overwritten. A new frame is not produced until the previous one has been consumed (see
+ * frameConsumed()).
+ */
 class DisplayWorker : public QThread
 {
     Q_OBJECT
@@ -13,18 +28,30 @@ public:
     virtual ~DisplayWorker();
 
     void setBinning(uint value);
+    void setDisplaySize(const QSize &size);
+    uint getDisplayFactor() const;
+
+    void frameConsumed();
 
 signals:
-    void newImage(double *data, size_t n);
+    void newImage(const QVector<double> &data);
 
 protected:
     virtual void run();
 
 private:
     OrcaFlash *orca;
-    double *mybufDouble;
-    bool running;
+    std::atomic<bool> running;
+    std::atomic<bool> pending;
     uint binning = 1;
+    QSize displaySize;
+    std::atomic<uint> displayFactor;
+
+    Binning binner;
+    QVector<double> frames[2];
+    int currentFrame = 0;
+
+    void updateDisplayFactor();
 };
 
 #endif // DISPLAYWORKER_H
@@ -33,8 +33,9 @@ FilterWheelWidget::FilterWheelWidget(FilterWheel *fw, int idx, QWidget *parent)
     refreshTimer->setInterval(2000);
     connect(refreshTimer, &QTimer::timeout, this, &FilterWheelWidget::refreshValues);
 
-    connect(fw, &FilterWheel::connected, [=]() { refreshTimer->start(); });
-    connect(fw, &FilterWheel::disconnected, [=]() { refreshTimer->stop(); });
+    // the wheel may be connected from another thread (see SPIM::initialize())
+    connect(fw, &FilterWheel::connected, refreshTimer, [=]() { refreshTimer->start(); });
+    connect(fw, &FilterWheel::disconnected, refreshTimer, [=]() { refreshTimer->stop(); });
 }
 
 void FilterWheelWidget::setupUI()
@@ -0,0 +1,86 @@
+#include "framelease.h"
+
+#include <algorithm>
+
+FrameLeases::FrameLeases()
+    : count(0)
+{}
+
+/**
+ * @brief Clears all leases of a DCAM ring of \a bufferFrames frames.
+ */
+void FrameLeases::reset(int32_t bufferFrames)
+{
+    if (bufferFrames != this->bufferFrames) {
+        held.reset(new std::atomic<bool>[static_cast<size_t>(bufferFrames)]);
+        this->bufferFrames = bufferFrames;
+    }
+    for (int32_t i = 0; i < bufferFrames; ++i) {
+        held[i].store(false, std::memory_order_relaxed);
+    }
+    oldest = 0;
+    count.store(0, std::memory_order_release);
+    maxSpan = 0;
+}
+
+/**
+ * @brief Leases the DCAM slot of \a frame, which must be newer than any other leased frame and
+ * less than bufferFrames frames ahead of the oldest one.
+ */
+void FrameLeases::acquire(int32_t frame)
+{
+    held[frame % bufferFrames].store(true, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Gives back the DCAM slot of \a frame once the writers are done reading it.
+ */
+void FrameLeases::release(int32_t frame)
+{
+    held[frame % bufferFrames].store(false, std::memory_order_release);
+    count.fetch_sub(1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Number of frames from the oldest leased frame up to (excluding) \a next, the frame the
+ * camera has just delivered; 0 if no frame is leased.
+ *
+ * The camera overwrites the oldest leased frame when the span reaches bufferFrames.
+ */
+int32_t FrameLeases::span(int32_t next)
+{
+    while (oldest < next && !held[oldest % bufferFrames].load(std::memory_order_acquire)) {
+        oldest++;
+    }
+    int32_t s = next - oldest;
+    if (s > maxSpan) {
+        maxSpan = s;
+    }
+    return s;
+}
+
+int32_t FrameLeases::outstanding() const
+{
+    return count.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Largest span() at which a new frame may still be leased in a DCAM ring of
+ * \a bufferFrames frames.
+ *
+ * The camera may already be ahead of the frame the capture thread is reading, so leases never
+ * cover more than three quarters of the ring.
+ */
+int32_t FrameLeases::limit(int32_t bufferFrames)
+{
+    return bufferFrames - std::max(bufferFrames / 4, 1);
+}
+
+/**
+ * @brief Largest span() of the current stack.
+ */
+int32_t FrameLeases::highWaterMark() const
+{
+    return maxSpan;
+}
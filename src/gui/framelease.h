@@ -0,0 +1,44 @@
+#ifndef FRAMELEASE_H
+#define FRAMELEASE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+/**
+ * @brief Frames of the DCAM ring buffer that are still being written from the camera's memory.
+ *
+ * In zero-copy mode the capture thread does not copy frames: it leases the DCAM buffer of frame
+ * n (slot n % bufferFrames) to the writer threads, which release it once the frame has been
+ * written. The camera does not know about leases and overwrites slot n % bufferFrames with frame
+ * n + bufferFrames regardless, so the capture thread uses span() to keep leased frames well
+ * behind the camera.
+ *
+ * acquire() and span() are called by the capture thread only; release() by any thread, in any
+ * order.
+ */
+class FrameLeases
+{
+public:
+    FrameLeases();
+
+    void reset(int32_t bufferFrames);
+
+    void acquire(int32_t frame);
+    void release(int32_t frame);
+
+    int32_t span(int32_t next);
+    int32_t outstanding() const;
+    int32_t highWaterMark() const;
+
+    static int32_t limit(int32_t bufferFrames);
+
+private:
+    std::unique_ptr<std::atomic<bool>[]> held; // indexed by DCAM slot
+    int32_t bufferFrames = 0;
+    int32_t oldest = 0; // no frame before this one is leased
+    std::atomic<int32_t> count;
+    int32_t maxSpan = 0;
+};
+
+#endif // FRAMELEASE_H
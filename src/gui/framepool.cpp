@@ -0,0 +1,340 @@
+#include "framepool.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <new>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define FRAMEPOOL_PAGE_BYTES 4096
+
+constexpr size_t FramePool::HUGE_PAGE_BYTES;
+
+/* FramePool::Buffer */
+
+FramePool::Buffer::Buffer() {}
+
+FramePool::Buffer::Buffer(Buffer &&other) noexcept
+    : pool(other.pool)
+    , block(other.block)
+{
+    other.pool = nullptr;
+    other.block = Block();
+}
+
+FramePool::Buffer &FramePool::Buffer::operator=(Buffer &&other) noexcept
+{
+    if (this != &other) {
+        reset();
+        pool = other.pool;
+        block = other.block;
+        other.pool = nullptr;
+        other.block = Block();
+    }
+    return *this;
+}
+
+FramePool::Buffer::~Buffer()
+{
+    reset();
+}
+
+/**
+ * @brief Gives the buffer back to its pool.
+ */
+void FramePool::Buffer::reset()
+{
+    if (pool != nullptr) {
+        pool->release(block);
+    }
+    pool = nullptr;
+    block = Block();
+}
+
+bool FramePool::Buffer::isNull() const
+{
+    return block.ptr == nullptr;
+}
+
+/**
+ * @brief Usable size in bytes, at least the size that was asked for.
+ */
+size_t FramePool::Buffer::size() const
+{
+    return block.bytes;
+}
+
+/**
+ * @brief NUMA node the buffer was faulted in on.
+ */
+int FramePool::Buffer::node() const
+{
+    return block.node;
+}
+
+void *FramePool::Buffer::data() const
+{
+    return block.ptr;
+}
+
+/* FramePool */
+
+FramePool::FramePool() {}
+
+FramePool::~FramePool()
+{
+    trim();
+}
+
+/**
+ * @brief Returns a pre-faulted buffer of at least \a bytes bytes, page aligned (2 MB aligned from
+ * 2 MB on), on the NUMA node of the calling thread.
+ *
+ * @throw std::bad_alloc
+ */
+FramePool::Buffer FramePool::acquire(size_t bytes)
+{
+    Buffer buf;
+    bytes = roundSize(bytes);
+    int node = currentNode();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // most recently released first: its pages are the most likely to be in cache and TLB
+        for (auto it = freeBlocks.rbegin(); it != freeBlocks.rend(); ++it) {
+            if (it->bytes == bytes && it->node == node) {
+                buf.block = *it;
+                freeBlocks.erase(std::next(it).base());
+                bytesFree -= bytes;
+                break;
+            }
+        }
+    }
+
+    bool mapped = false;
+    if (buf.block.ptr == nullptr) {
+        if (!map(bytes, &buf.block)) {
+            throw std::bad_alloc();
+        }
+        buf.block.node = node;
+        mapped = true;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    buf.pool = this;
+    buffersInUse++;
+    bytesInUse += bytes;
+    peakBytesInUse = std::max(peakBytesInUse, bytesInUse);
+    if (mapped && buf.block.hugeTLB) {
+        hugeTLBBytes += bytes;
+    }
+    return buf;
+}
+
+void FramePool::release(const Block &block)
+{
+    if (block.ptr == nullptr) {
+        return;
+    }
+    std::vector<Block> unmapped;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        buffersInUse--;
+        bytesInUse -= block.bytes;
+        freeBlocks.push_back(block);
+        bytesFree += block.bytes;
+        unmapExcess(&unmapped);
+    }
+    for (const Block &b : unmapped) {
+        unmap(b);
+    }
+}
+
+/**
+ * @brief Moves the least recently released blocks beyond maxFreeBytes to \a unmapped. Called with
+ * the mutex held.
+ */
+void FramePool::unmapExcess(std::vector<Block> *unmapped)
+{
+    while (bytesFree > maxFreeBytes && !freeBlocks.empty()) {
+        const Block &b = freeBlocks.front();
+        bytesFree -= b.bytes;
+        if (b.hugeTLB) {
+            hugeTLBBytes -= b.bytes;
+        }
+        unmapped->push_back(b);
+        freeBlocks.erase(freeBlocks.begin());
+    }
+}
+
+/**
+ * @brief Amount of memory kept in released buffers for reuse.
+ */
+void FramePool::setMaxFreeBytes(size_t value)
+{
+    std::vector<Block> unmapped;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        maxFreeBytes = value;
+        unmapExcess(&unmapped);
+    }
+    for (const Block &b : unmapped) {
+        unmap(b);
+    }
+}
+
+/**
+ * @brief Unmaps all released buffers.
+ */
+void FramePool::trim()
+{
+    std::vector<Block> unmapped;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const Block &b : freeBlocks) {
+            if (b.hugeTLB) {
+                hugeTLBBytes -= b.bytes;
+            }
+        }
+        unmapped.swap(freeBlocks);
+        bytesFree = 0;
+    }
+    for (const Block &b : unmapped) {
+        unmap(b);
+    }
+}
+
+int FramePool::getBuffersInUse() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return buffersInUse;
+}
+
+size_t FramePool::getBytesInUse() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return bytesInUse;
+}
+
+size_t FramePool::getBytesFree() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return bytesFree;
+}
+
+/**
+ * @brief Memory of the pool (in use or free) backed by explicit huge pages; the rest of the
+ * buffers of 2 MB or more uses transparent huge pages where the kernel can provide them.
+ */
+size_t FramePool::getHugeTLBBytes() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return hugeTLBBytes;
+}
+
+size_t FramePool::getPeakBytesInUse() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return peakBytesInUse;
+}
+
+QString FramePool::report() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return QString("frame pool: %1 buffers (%2 MB) in use, peak %3 MB, %4 MB free, %5 MB on "
+                   "explicit huge pages")
+        .arg(buffersInUse)
+        .arg(bytesInUse >> 20)
+        .arg(peakBytesInUse >> 20)
+        .arg(bytesFree >> 20)
+        .arg(hugeTLBBytes >> 20);
+}
+
+/**
+ * @brief NUMA node of the CPU the calling thread is running on (0 if unknown).
+ */
+int FramePool::currentNode()
+{
+    unsigned int cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+        return 0;
+    }
+    return static_cast<int>(node);
+}
+
+FramePool &FramePool::global()
+{
+    static FramePool instance;
+    return instance;
+}
+
+size_t FramePool::roundSize(size_t bytes)
+{
+    size_t unit = bytes >= HUGE_PAGE_BYTES ? HUGE_PAGE_BYTES : FRAMEPOOL_PAGE_BYTES;
+    bytes = std::max(bytes, size_t(1));
+    return (bytes + unit - 1) / unit * unit;
+}
+
+/**
+ * @brief Maps \a bytes (already rounded) and touches every page from the calling thread.
+ */
+bool FramePool::map(size_t bytes, Block *block)
+{
+    void *ptr = MAP_FAILED;
+    bool hugeTLB = false;
+
+    if (bytes >= HUGE_PAGE_BYTES) {
+        ptr = mmap(nullptr,
+                   bytes,
+                   PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                   -1,
+                   0);
+        hugeTLB = ptr != MAP_FAILED;
+        if (!hugeTLB) {
+            // no reserved huge pages: map 2 MB aligned memory and ask for transparent ones
+            size_t span = bytes + HUGE_PAGE_BYTES;
+            void *raw = mmap(nullptr,
+                             span,
+                             PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS,
+                             -1,
+                             0);
+            if (raw != MAP_FAILED) {
+                uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+                uintptr_t aligned = (start + HUGE_PAGE_BYTES - 1) & ~(HUGE_PAGE_BYTES - 1);
+                if (aligned > start) {
+                    munmap(raw, aligned - start);
+                }
+                size_t tail = start + span - (aligned + bytes);
+                if (tail > 0) {
+                    munmap(reinterpret_cast<void *>(aligned + bytes), tail);
+                }
+                ptr = reinterpret_cast<void *>(aligned);
+#ifdef MADV_HUGEPAGE
+                madvise(ptr, bytes, MADV_HUGEPAGE);
+#endif
+            }
+        }
+    } else {
+        ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (ptr == MAP_FAILED) {
+        return false;
+    }
+
+    // first touch: faults the pages in now, on the NUMA node of this thread
+    memset(ptr, 0, bytes);
+
+    block->ptr = ptr;
+    block->bytes = bytes;
+    block->hugeTLB = hugeTLB;
+    return true;
+}
+
+void FramePool::unmap(const Block &block)
+{
+    munmap(block.ptr, block.bytes);
+}
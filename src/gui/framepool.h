@@ -0,0 +1,107 @@
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include <QString>
+
+/**
+ * @brief Pool of the working buffers of the per-frame path: frame ring, binned frames, O_DIRECT
+ * chunks, live view.
+ *
+ * Buffers of 2 MB or more are backed by huge pages: explicit ones (MAP_HUGETLB) if the system has
+ * reserved any, transparent huge pages otherwise. They are pre-faulted by the thread that
+ * acquires them, so that first-touch page faults happen at setup time and the pages are placed on
+ * the NUMA node of that thread.
+ *
+ * Released buffers are kept and handed out again to threads running on the same node that ask
+ * for the same size, typically at the next stack. Up to maxFreeBytes are kept; the least recently
+ * released buffers are unmapped beyond that.
+ */
+class FramePool
+{
+private:
+    struct Block
+    {
+        void *ptr = nullptr;
+        size_t bytes = 0;
+        int node = 0;
+        bool hugeTLB = false;
+    };
+
+public:
+    /**
+     * @brief A buffer acquired from a FramePool, given back when destroyed or reset.
+     */
+    class Buffer
+    {
+    public:
+        Buffer();
+        Buffer(Buffer &&other) noexcept;
+        Buffer &operator=(Buffer &&other) noexcept;
+        ~Buffer();
+
+        Buffer(const Buffer &) = delete;
+        Buffer &operator=(const Buffer &) = delete;
+
+        void reset();
+
+        bool isNull() const;
+        size_t size() const;
+        int node() const;
+
+        void *data() const;
+        template<typename T>
+        T *as() const
+        {
+            return static_cast<T *>(block.ptr);
+        }
+
+    private:
+        friend class FramePool;
+        FramePool *pool = nullptr;
+        Block block;
+    };
+
+    static constexpr size_t HUGE_PAGE_BYTES = size_t(2) << 20;
+
+    FramePool();
+    ~FramePool();
+
+    Buffer acquire(size_t bytes);
+
+    void setMaxFreeBytes(size_t value);
+    void trim();
+
+    int getBuffersInUse() const;
+    size_t getBytesInUse() const;
+    size_t getBytesFree() const;
+    size_t getHugeTLBBytes() const;
+    size_t getPeakBytesInUse() const;
+    QString report() const;
+
+    static int currentNode();
+    static FramePool &global();
+
+private:
+    mutable std::mutex mutex;
+    std::vector<Block> freeBlocks; // least recently released first
+    size_t maxFreeBytes = size_t(1) << 30;
+    int buffersInUse = 0;
+    size_t bytesInUse = 0;
+    size_t bytesFree = 0;
+    size_t hugeTLBBytes = 0; // mapped, in use or free
+    size_t peakBytesInUse = 0;
+
+    void release(const Block &block);
+    void unmapExcess(std::vector<Block> *unmapped);
+
+    static size_t roundSize(size_t bytes);
+    static bool map(size_t bytes, Block *block);
+    static void unmap(const Block &block);
+};
+
+#endif // FRAMEPOOL_H
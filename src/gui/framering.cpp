@@ -0,0 +1,170 @@
+#include "framering.h"
+
+#define FRAMERING_ALIGNMENT 4096
+
+FrameRing::FrameRing()
+    : enqueuePos(0)
+    , dequeuePos(0)
+    , maxOccupancy(0)
+    , closed(false)
+{}
+
+FrameRing::~FrameRing()
+{
+    release();
+}
+
+/**
+ * @brief Allocates \a depth slots of \a frameBytes bytes each.
+ *
+ * Memory is taken from the global FramePool (pre-faulted, on huge pages and on the NUMA node of
+ * the calling thread), kept across stacks and only given back when the geometry changes.
+ *
+ * @throw std::bad_alloc
+ */
+void FrameRing::allocate(size_t depth, size_t frameBytes)
+{
+    if (depth < 1) {
+        depth = 1;
+    }
+    size_t bytes = (frameBytes + FRAMERING_ALIGNMENT - 1) / FRAMERING_ALIGNMENT
+                   * FRAMERING_ALIGNMENT;
+    if (depth == nSlots && bytes == slotBytes) {
+        reset();
+        return;
+    }
+    release();
+
+    memory = FramePool::global().acquire(depth * bytes);
+    slots = new Slot[depth];
+    nSlots = depth;
+    slotBytes = bytes;
+    for (size_t i = 0; i < nSlots; ++i) {
+        slots[i].data = reinterpret_cast<uint16_t *>(memory.as<uint8_t>() + i * slotBytes);
+    }
+    reset();
+}
+
+void FrameRing::release()
+{
+    delete[] slots;
+    memory.reset();
+    slots = nullptr;
+    nSlots = slotBytes = 0;
+}
+
+void FrameRing::reset()
+{
+    for (size_t i = 0; i < nSlots; ++i) {
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+        slots[i].frameIndex = -1;
+        slots[i].frame = slots[i].data;
+        slots[i].leased = false;
+        slots[i].captureTime = 0;
+    }
+    enqueuePos.store(0, std::memory_order_relaxed);
+    dequeuePos.store(0, std::memory_order_relaxed);
+    maxOccupancy.store(0, std::memory_order_relaxed);
+    closed.store(false, std::memory_order_release);
+}
+
+/**
+ * @brief Claims the next free slot, or returns nullptr if the ring is full.
+ */
+FrameRing::Slot *FrameRing::beginPush()
+{
+    size_t pos = enqueuePos.load(std::memory_order_relaxed);
+    while (true) {
+        Slot *slot = &slots[pos % nSlots];
+        size_t seq = slot->sequence.load(std::memory_order_acquire);
+        intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+        if (dif == 0) {
+            if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                slot->pos = pos;
+                return slot;
+            }
+        } else if (dif < 0) {
+            return nullptr;
+        } else {
+            pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void FrameRing::endPush(Slot *slot)
+{
+    slot->sequence.store(slot->pos + 1, std::memory_order_release);
+
+    size_t occ = occupancy();
+    size_t max = maxOccupancy.load(std::memory_order_relaxed);
+    while (occ > max && !maxOccupancy.compare_exchange_weak(max, occ)) {
+    }
+}
+
+/**
+ * @brief Claims the oldest published slot, or returns nullptr if the ring is empty.
+ */
+FrameRing::Slot *FrameRing::beginPop()
+{
+    size_t pos = dequeuePos.load(std::memory_order_relaxed);
+    while (true) {
+        Slot *slot = &slots[pos % nSlots];
+        size_t seq = slot->sequence.load(std::memory_order_acquire);
+        intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+        if (dif == 0) {
+            if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                slot->pos = pos;
+                return slot;
+            }
+        } else if (dif < 0) {
+            return nullptr;
+        } else {
+            pos = dequeuePos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void FrameRing::endPop(Slot *slot)
+{
+    slot->sequence.store(slot->pos + nSlots, std::memory_order_release);
+}
+
+/**
+ * @brief Signals consumers that no more frames will be pushed.
+ */
+void FrameRing::close()
+{
+    closed.store(true, std::memory_order_release);
+}
+
+bool FrameRing::isClosed() const
+{
+    return closed.load(std::memory_order_acquire);
+}
+
+bool FrameRing::isEmpty() const
+{
+    return occupancy() == 0;
+}
+
+size_t FrameRing::depth() const
+{
+    return nSlots;
+}
+
+size_t FrameRing::frameBytes() const
+{
+    return slotBytes;
+}
+
+size_t FrameRing::occupancy() const
+{
+    size_t in = enqueuePos.load(std::memory_order_acquire);
+    size_t out = dequeuePos.load(std::memory_order_acquire);
+    return in > out ? in - out : 0;
+}
+
+size_t FrameRing::highWaterMark() const
+{
+    return maxOccupancy.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,68 @@
+#ifndef FRAMERING_H
+#define FRAMERING_H
+
+#include "framepool.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Bounded lock-free queue of preallocated frame buffers.
+ *
+ * The capture thread claims a free slot with beginPush(), copies the frame into it and publishes
+ * it with endPush(). Writer threads claim published slots with beginPop() and give them back with
+ * endPop(). Slots are handed out in order on both sides, so any number of producers and
+ * consumers can share the ring (bounded MPMC queue with per-slot sequence numbers).
+ *
+ * A slot can also carry a frame that stays in the camera's buffer (zero-copy mode, see
+ * FrameLeases): consumers always read the frame from Slot::frame.
+ */
+class FrameRing
+{
+public:
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        size_t pos;
+        int32_t frameIndex;
+        uint16_t *data;         // memory of the slot
+        const uint16_t *frame;  // data, or the leased camera buffer
+        int64_t captureTime;    // ns, Telemetry::now() when the frame was read from the camera
+        bool leased;
+    };
+
+    FrameRing();
+    ~FrameRing();
+
+    void allocate(size_t depth, size_t frameBytes);
+    void release();
+    void reset();
+
+    Slot *beginPush();
+    void endPush(Slot *slot);
+    Slot *beginPop();
+    void endPop(Slot *slot);
+
+    void close();
+    bool isClosed() const;
+    bool isEmpty() const;
+
+    size_t depth() const;
+    size_t frameBytes() const;
+    size_t occupancy() const;
+    size_t highWaterMark() const;
+
+private:
+    Slot *slots = nullptr;
+    FramePool::Buffer memory;
+    size_t nSlots = 0;
+    size_t slotBytes = 0;
+
+    alignas(64) std::atomic<size_t> enqueuePos;
+    alignas(64) std::atomic<size_t> dequeuePos;
+    alignas(64) std::atomic<size_t> maxOccupancy;
+    std::atomic<bool> closed;
+};
+
+#endif // FRAMERING_H
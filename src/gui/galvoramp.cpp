@@ -1,5 +1,7 @@
 #include "galvoramp.h"
 
+#include "rampwaveform.h"
+
 #include <cmath>
 
 #include <qtlab/core/logger.h>
@@ -37,8 +39,44 @@ void GalvoRamp::initializeTask_impl()
     cfgDigEdgeStartTrig(triggerTerm, Edge_Rising);
     setStartTrigRetriggerable(true);
 
+    committedConfiguration = configuration();
+    commitWaveform();
+}
+
+/**
+ * @brief Task parameters (waveform parameters excluded): if any of them differs from the ones
+ * used for the current task, the task has to be rebuilt.
+ */
+QVariantList GalvoRamp::configuration() const
+{
+    return {physicalChannels,
+            sampClkTimingSource,
+            sampleRate,
+            static_cast<qulonglong>(sampsPerChan),
+            triggerTerm};
+}
+
+bool GalvoRamp::needsRebuild() const
+{
+    return !isInitialized() || configuration() != committedConfiguration;
+}
+
+/**
+ * @brief True if the waveform parameters have changed since the waveform was last written.
+ */
+bool GalvoRamp::isWaveformChanged() const
+{
+    return waveformParams != committedWaveformParams;
+}
+
+/**
+ * @brief Recomputes the waveform and writes it to the output buffer of the task.
+ */
+void GalvoRamp::commitWaveform()
+{
     computeWaveform();
     write();
+    committedWaveformParams = waveformParams;
 }
 
 void GalvoRamp::setWaveformAmplitude(const int channelNumber, const double val)
@@ -94,8 +132,7 @@ void GalvoRamp::setWaveformParams(const QVector<double> &values)
 void GalvoRamp::updateWaveform()
 {
     if (isInitialized() && !isTaskDone()) {
-        computeWaveform();
-        write();
+        commitWaveform();
     }
 }
 
@@ -134,28 +171,14 @@ void GalvoRamp::appendToWaveform(double offset,
                                  const double fraction,
                                  const double delay)
 {
-    int sampsPerChan = static_cast<int>(this->sampsPerChan);
-    int nRamp = static_cast<int>(floor(sampsPerChan * fraction));
-    int nDelay = static_cast<int>(round(delay * getSampleRate()));
-    double halfAmplitude = 0.5 * amplitude;
-    QVector<double> temp(static_cast<int>(sampsPerChan), 0);
-
-    int i = 0;
-    for (; i < nRamp; ++i)
-        temp[i] = offset - halfAmplitude + amplitude * i / nRamp;
-    int nRamp2 = sampsPerChan - nRamp;
-    for (; i < sampsPerChan; ++i)
-        temp[i] = offset + halfAmplitude - amplitude * (i - nRamp) / nRamp2;
-
-    if (nDelay == 0 || nDelay == temp.size()) {
-        waveform << temp;
-    } else if (nDelay > 0) {
-        waveform << temp.mid(sampsPerChan - nDelay);
-        waveform << temp.mid(0, sampsPerChan - nDelay);
-    } else {
-        waveform << temp.mid(-nDelay);
-        waveform << temp.mid(0, -nDelay);
-    }
+    int n = waveform.size();
+    waveform.resize(n + static_cast<int>(sampsPerChan));
+    RampWaveform::generate(waveform.data() + n,
+                           static_cast<size_t>(sampsPerChan),
+                           offset,
+                           amplitude,
+                           fraction,
+                           static_cast<long>(round(delay * getSampleRate())));
 }
 
 void GalvoRamp::setWaveformParam(const int channelNumber, const int paramID, const double val)
@@ -3,6 +3,7 @@
 
 #include <qtlab/hw/ni/nitask.h>
 
+#include <QVariantList>
 #include <QVector>
 
 #define GALVORAMP_N_OF_PARAMS 4
@@ -32,6 +33,10 @@ public:
 
     void updateWaveform();
 
+    bool needsRebuild() const;
+    bool isWaveformChanged() const;
+    void commitWaveform();
+
 protected:
     virtual void initializeTask_impl() override;
 
@@ -39,6 +44,9 @@ private:
     QVector<double> waveformParams;
     QVector<double> waveform;
 
+    QVariantList committedConfiguration;
+    QVector<double> committedWaveformParams;
+
     void write();
     void computeWaveform();
     void appendToWaveform(double offset,
@@ -46,6 +54,7 @@ private:
                           const double fraction,
                           const double delay);
     void setWaveformParam(const int channelNumber, const int paramID, const double val);
+    QVariantList configuration() const;
 };
 
 #endif // GALVORAMP_H
@@ -0,0 +1,198 @@
+#include "initgraph.h"
+
+#include <algorithm>
+#include <exception>
+#include <thread>
+
+#include <QStringList>
+
+/**
+ * @brief Adds a job that runs \a func once all the jobs in \a dependencies have completed.
+ *
+ * @return The index of the new job, to be used as a dependency of later jobs.
+ */
+int InitGraph::addJob(const QString &name,
+                      const std::function<void()> &func,
+                      const std::vector<int> &dependencies)
+{
+    Job job;
+    job.name = name;
+    job.func = func;
+    job.dependencies = dependencies;
+    job.state = STATE_PENDING;
+    job.start = job.elapsed = 0;
+    jobs.push_back(job);
+    return static_cast<int>(jobs.size()) - 1;
+}
+
+void InitGraph::clear()
+{
+    jobs.clear();
+    totalTime = 0;
+}
+
+/**
+ * @brief Runs all jobs on up to \a maxThreads threads and returns when none is left.
+ *
+ * @return true if all jobs completed successfully.
+ */
+bool InitGraph::run(int maxThreads)
+{
+    clock.start();
+    int n = std::max(1, std::min(maxThreads, static_cast<int>(jobs.size())));
+    std::vector<std::thread> threads;
+    for (int i = 1; i < n; ++i) {
+        threads.emplace_back(&InitGraph::threadLoop, this);
+    }
+    threadLoop();
+    for (std::thread &t : threads) {
+        t.join();
+    }
+    totalTime = clock.nsecsElapsed() * 1e-6;
+
+    return std::all_of(jobs.begin(), jobs.end(), [](const Job &j) {
+        return j.state == STATE_DONE;
+    });
+}
+
+/**
+ * @brief Picks a job whose dependencies have completed and marks it as running, skipping the
+ * jobs that depend on failed ones. Called with the mutex held.
+ *
+ * @return The job index, or -1 if no job is ready (\a finished is set if none ever will be).
+ */
+int InitGraph::nextJob(bool *finished)
+{
+    bool changed = true;
+    while (changed) { // skipping a job may make its dependants skippable
+        changed = false;
+        for (Job &job : jobs) {
+            if (job.state != STATE_PENDING) {
+                continue;
+            }
+            for (int d : job.dependencies) {
+                State s = jobs.at(d).state;
+                if (s == STATE_FAILED || s == STATE_SKIPPED) {
+                    job.state = STATE_SKIPPED;
+                    job.error = QString("%1 not initialized").arg(jobs.at(d).name);
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    bool pending = false, running = false;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        Job &job = jobs[i];
+        if (job.state == STATE_RUNNING) {
+            running = true;
+        }
+        if (job.state != STATE_PENDING) {
+            continue;
+        }
+        pending = true;
+        bool ready = std::all_of(job.dependencies.begin(), job.dependencies.end(), [this](int d) {
+            return jobs.at(d).state == STATE_DONE;
+        });
+        if (ready) {
+            job.state = STATE_RUNNING;
+            return static_cast<int>(i);
+        }
+    }
+    *finished = !pending || !running;
+    return -1;
+}
+
+void InitGraph::threadLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        bool finished = false;
+        int i = nextJob(&finished);
+        if (i < 0) {
+            if (finished) {
+                cv.notify_all();
+                return;
+            }
+            cv.wait(lock);
+            continue;
+        }
+
+        std::function<void()> func = jobs[i].func;
+        double start = clock.nsecsElapsed() * 1e-6;
+        lock.unlock();
+
+        State state = STATE_DONE;
+        QString error;
+        try {
+            func();
+        } catch (std::exception &e) {
+            state = STATE_FAILED;
+            error = e.what();
+        }
+        double elapsed = clock.nsecsElapsed() * 1e-6 - start;
+
+        lock.lock();
+        jobs[i].state = state;
+        jobs[i].start = start;
+        jobs[i].elapsed = elapsed;
+        jobs[i].error = error;
+        cv.notify_all();
+    }
+}
+
+bool InitGraph::isDone(int job) const
+{
+    return jobs.at(job).state == STATE_DONE;
+}
+
+/**
+ * @brief Error messages of the failed jobs, one per line.
+ */
+QString InitGraph::errorString() const
+{
+    QStringList errors;
+    for (const Job &job : jobs) {
+        if (job.state == STATE_FAILED) {
+            errors << QString("%1: %2").arg(job.name).arg(job.error);
+        }
+    }
+    return errors.join("\n");
+}
+
+/**
+ * @brief Per-job timing breakdown: start time, duration and outcome of each job, and the time
+ * saved by running them concurrently.
+ */
+QString InitGraph::report() const
+{
+    QStringList lines;
+    double sum = 0;
+    for (const Job &job : jobs) {
+        QString line = QString("%1: ").arg(job.name);
+        switch (job.state) {
+        case STATE_DONE:
+        case STATE_FAILED:
+            line += QString("%1 ms (started at %2 ms)")
+                        .arg(job.elapsed, 0, 'f', 1)
+                        .arg(job.start, 0, 'f', 1);
+            if (job.state == STATE_FAILED) {
+                line += QString(", failed: %1").arg(job.error);
+            }
+            sum += job.elapsed;
+            break;
+        case STATE_SKIPPED:
+            line += QString("skipped (%1)").arg(job.error);
+            break;
+        default:
+            line += "not run";
+            break;
+        }
+        lines << line;
+    }
+    lines << QString("Total: %1 ms (%2 ms if run sequentially)")
+                 .arg(totalTime, 0, 'f', 1)
+                 .arg(sum, 0, 'f', 1);
+    return lines.join("\n");
+}
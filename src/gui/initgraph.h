@@ -0,0 +1,63 @@
+#ifndef INITGRAPH_H
+#define INITGRAPH_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include <QElapsedTimer>
+#include <QString>
+
+/**
+ * @brief Runs a set of initialization jobs concurrently, each one as soon as the jobs it depends
+ * on have completed.
+ *
+ * A job fails by throwing std::exception; jobs depending on a failed job are skipped. The time
+ * spent in each job is recorded and summarized by report().
+ */
+class InitGraph
+{
+public:
+    int addJob(const QString &name,
+               const std::function<void()> &func,
+               const std::vector<int> &dependencies = {});
+    void clear();
+
+    bool run(int maxThreads = 8);
+
+    bool isDone(int job) const;
+    QString errorString() const;
+    QString report() const;
+
+private:
+    enum State {
+        STATE_PENDING,
+        STATE_RUNNING,
+        STATE_DONE,
+        STATE_FAILED,
+        STATE_SKIPPED,
+    };
+
+    struct Job
+    {
+        QString name;
+        std::function<void()> func;
+        std::vector<int> dependencies;
+        State state;
+        double start;   // ms since run()
+        double elapsed; // ms
+        QString error;
+    };
+
+    std::vector<Job> jobs;
+    std::mutex mutex;
+    std::condition_variable cv;
+    QElapsedTimer clock;
+    double totalTime = 0; // ms
+
+    void threadLoop();
+    int nextJob(bool *finished);
+};
+
+#endif // INITGRAPH_H
@@ -6,6 +6,7 @@
 #include "settingswidget.h"
 #include "spim.h"
 #include "stagewidget.h"
+#include "telemetrywidget.h"
 #include "version.h"
 
 #include <qtlab/core/logmanager.h>
@@ -118,6 +119,13 @@ void MainWindow::setupUi()
     cw->setWindowTitle("Settings");
     closableWidgets << cw;
 
+    vLayout = new QVBoxLayout();
+    cw = new QWidget();
+    vLayout->addWidget(new TelemetryWidget());
+    cw->setLayout(vLayout);
+    cw->setWindowTitle("Telemetry");
+    closableWidgets << cw;
+
     vLayout = new QVBoxLayout();
     cw = new QWidget();
     QWidget *w = new LogWidget();
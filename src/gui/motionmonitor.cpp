@@ -0,0 +1,159 @@
+#include "motionmonitor.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+MotionMonitor::MotionMonitor(QObject *parent)
+    : QObject(parent)
+{
+    clock.start();
+    timer = new QTimer(this);
+    timer->setSingleShot(true);
+    timer->setTimerType(Qt::PreciseTimer);
+    connect(timer, &QTimer::timeout, this, &MotionMonitor::poll);
+}
+
+/**
+ * @brief Sets the function used to query whether \a axis is on target.
+ */
+void MotionMonitor::setQueryFunction(const std::function<bool(int)> &f)
+{
+    query = f;
+}
+
+void MotionMonitor::setFineInterval(int ms)
+{
+    fineInterval = std::max(ms, 1);
+}
+
+int MotionMonitor::getFineInterval() const
+{
+    return fineInterval;
+}
+
+/**
+ * @brief Polling of an axis starts \a ms before its predicted arrival.
+ */
+void MotionMonitor::setLeadTime(double ms)
+{
+    leadTime = ms;
+}
+
+double MotionMonitor::getLeadTime() const
+{
+    return leadTime;
+}
+
+void MotionMonitor::clear()
+{
+    stop();
+    moves.clear();
+}
+
+/**
+ * @brief Registers a move of \a axis over \a distance at \a velocity that has just been
+ * commanded. A move replaces any previous move of the same axis.
+ */
+void MotionMonitor::addMove(int axis, double distance, double velocity)
+{
+    Move m;
+    m.commandTime = clock.nsecsElapsed() * 1e-6;
+    m.base = velocity > 0 ? 1000 * distance / velocity : 0;
+    m.predicted = predictedDuration(axis, distance, velocity);
+    m.settleTime = -1;
+    moves[axis] = m;
+}
+
+void MotionMonitor::start()
+{
+    running = true;
+    schedule(false);
+}
+
+void MotionMonitor::stop()
+{
+    running = false;
+    timer->stop();
+}
+
+bool MotionMonitor::isRunning() const
+{
+    return running;
+}
+
+double MotionMonitor::predictedDuration(int axis, double distance, double velocity) const
+{
+    double base = velocity > 0 ? 1000 * distance / velocity : 0;
+    return std::max(base + correction.value(axis, 0), 0.);
+}
+
+double MotionMonitor::pollTime(const Move &m) const
+{
+    return m.commandTime + m.predicted - leadTime;
+}
+
+void MotionMonitor::schedule(bool polling)
+{
+    if (!running) {
+        return;
+    }
+
+    double wake = -1;
+    for (const Move &m : moves) {
+        if (m.settleTime >= 0) {
+            continue;
+        }
+        wake = wake < 0 ? pollTime(m) : std::min(wake, pollTime(m));
+    }
+
+    if (wake < 0) {
+        running = false;
+        QMap<int, double> settleTimes;
+        for (auto it = moves.constBegin(); it != moves.constEnd(); ++it) {
+            settleTimes[it.key()] = it.value().settleTime;
+        }
+        emit settled(settleTimes);
+        return;
+    }
+
+    double delay = wake - clock.nsecsElapsed() * 1e-6;
+    if (polling) {
+        delay = std::max(delay, static_cast<double>(fineInterval));
+    }
+    timer->start(static_cast<int>(std::max(delay, 0.)));
+}
+
+/**
+ * @brief Queries the axes whose predicted arrival is near and that are not on target yet.
+ */
+void MotionMonitor::poll()
+{
+    if (!running) {
+        return;
+    }
+
+    for (auto it = moves.begin(); it != moves.end(); ++it) {
+        Move &m = it.value();
+        if (m.settleTime >= 0 || clock.nsecsElapsed() * 1e-6 < pollTime(m)) {
+            continue;
+        }
+        bool onTarget;
+        try {
+            onTarget = query ? query(it.key()) : true;
+        } catch (std::runtime_error e) {
+            stop();
+            emit error(e.what());
+            return;
+        }
+        if (!onTarget) {
+            continue;
+        }
+        m.settleTime = clock.nsecsElapsed() * 1e-6 - m.commandTime;
+
+        // learn the part of the move (acceleration, settling) not explained by distance / velocity
+        double c = correction.value(it.key(), m.settleTime - m.base);
+        correction[it.key()] = 0.7 * c + 0.3 * (m.settleTime - m.base);
+    }
+
+    schedule(true);
+}
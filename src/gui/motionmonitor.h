@@ -0,0 +1,68 @@
+#ifndef MOTIONMONITOR_H
+#define MOTIONMONITOR_H
+
+#include <functional>
+
+#include <QElapsedTimer>
+#include <QMap>
+#include <QObject>
+#include <QTimer>
+
+/**
+ * @brief Detects when a set of commanded stage moves has completed.
+ *
+ * The arrival time of each axis is predicted from the commanded distance and velocity (plus a
+ * per-axis correction learned from previous moves). Axes are not queried at all until shortly
+ * before their predicted arrival, then only axes that have not reached the target yet are
+ * polled at a fine interval. settled() carries, for each axis, the time elapsed between the move
+ * command and the first on-target reply.
+ */
+class MotionMonitor : public QObject
+{
+    Q_OBJECT
+public:
+    explicit MotionMonitor(QObject *parent = nullptr);
+
+    void setQueryFunction(const std::function<bool(int)> &f);
+
+    void setFineInterval(int ms);
+    int getFineInterval() const;
+    void setLeadTime(double ms);
+    double getLeadTime() const;
+
+    void clear();
+    void addMove(int axis, double distance, double velocity);
+    void start();
+    void stop();
+    bool isRunning() const;
+
+    double predictedDuration(int axis, double distance, double velocity) const; // ms
+
+signals:
+    void settled(const QMap<int, double> &settleTimes);
+    void error(const QString &msg);
+
+private:
+    struct Move
+    {
+        double commandTime; // ms
+        double base;        // ms, distance / velocity
+        double predicted;   // ms, base + learned correction
+        double settleTime;  // ms, < 0 while moving
+    };
+
+    std::function<bool(int)> query;
+    QElapsedTimer clock;
+    QTimer *timer;
+    QMap<int, Move> moves;
+    QMap<int, double> correction; // ms, observed - predicted (moving average)
+    int fineInterval = 5;
+    double leadTime = 50;
+    bool running = false;
+
+    void schedule(bool polling);
+    void poll();
+    double pollTime(const Move &m) const;
+};
+
+#endif // MOTIONMONITOR_H
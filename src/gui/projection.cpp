@@ -0,0 +1,198 @@
+#include "projection.h"
+
+#include "binning.h"
+
+#include <algorithm>
+#include <limits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PROJECTION_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+void maxScalar(const uint16_t *src, uint16_t *acc, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        acc[i] = std::max(acc[i], src[i]);
+    }
+}
+
+void sumScalar(const uint16_t *src, uint32_t *acc, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        acc[i] += src[i];
+    }
+}
+
+#ifdef PROJECTION_X86
+
+__attribute__((target("sse4.1"))) void maxSSE41(const uint16_t *src, uint16_t *acc, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i *a = reinterpret_cast<__m128i *>(acc + i);
+        _mm_storeu_si128(a, _mm_max_epu16(_mm_loadu_si128(a), v));
+    }
+    maxScalar(src + i, acc + i, n - i);
+}
+
+__attribute__((target("sse4.1"))) void sumSSE41(const uint16_t *src, uint32_t *acc, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i *a0 = reinterpret_cast<__m128i *>(acc + i);
+        __m128i *a1 = reinterpret_cast<__m128i *>(acc + i + 4);
+        _mm_storeu_si128(a0, _mm_add_epi32(_mm_loadu_si128(a0), _mm_cvtepu16_epi32(v)));
+        _mm_storeu_si128(a1,
+                         _mm_add_epi32(_mm_loadu_si128(a1),
+                                       _mm_cvtepu16_epi32(_mm_srli_si128(v, 8))));
+    }
+    sumScalar(src + i, acc + i, n - i);
+}
+
+__attribute__((target("avx2"))) void maxAVX2(const uint16_t *src, uint16_t *acc, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        __m256i *a = reinterpret_cast<__m256i *>(acc + i);
+        _mm256_storeu_si256(a, _mm256_max_epu16(_mm256_loadu_si256(a), v));
+    }
+    maxScalar(src + i, acc + i, n - i);
+}
+
+__attribute__((target("avx2"))) void sumAVX2(const uint16_t *src, uint32_t *acc, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 8));
+        __m256i *a0 = reinterpret_cast<__m256i *>(acc + i);
+        __m256i *a1 = reinterpret_cast<__m256i *>(acc + i + 8);
+        _mm256_storeu_si256(a0,
+                            _mm256_add_epi32(_mm256_loadu_si256(a0), _mm256_cvtepu16_epi32(v0)));
+        _mm256_storeu_si256(a1,
+                            _mm256_add_epi32(_mm256_loadu_si256(a1), _mm256_cvtepu16_epi32(v1)));
+    }
+    sumScalar(src + i, acc + i, n - i);
+}
+
+#endif
+
+} // namespace
+
+Projection::Projection()
+{
+    maxFn = maxScalar;
+    sumFn = sumScalar;
+#ifdef PROJECTION_X86
+    switch (Binning::detectISA()) {
+    case Binning::ISA_AVX2:
+        maxFn = maxAVX2;
+        sumFn = sumAVX2;
+        break;
+    case Binning::ISA_SSE41:
+        maxFn = maxSSE41;
+        sumFn = sumSSE41;
+        break;
+    default:
+        break;
+    }
+#endif
+}
+
+/**
+ * @brief Clears the accumulators (memory is kept across stacks of the same size).
+ */
+void Projection::reset(size_t pixels, bool withMax, bool withMean)
+{
+    this->pixels = pixels;
+    this->withMax = withMax;
+    this->withMean = withMean;
+    count = 0;
+    if (withMax) {
+        maxBuf.assign(pixels, 0);
+    } else {
+        maxBuf.clear();
+    }
+    if (withMean) {
+        sumBuf.assign(pixels, 0);
+    } else {
+        sumBuf.clear();
+    }
+}
+
+void Projection::accumulate(const uint16_t *frame)
+{
+    if (withMax) {
+        maxFn(frame, maxBuf.data(), pixels);
+    }
+    if (withMean) {
+        sumFn(frame, sumBuf.data(), pixels);
+    }
+    count++;
+}
+
+void Projection::merge(const Projection &other)
+{
+    if (other.count == 0) {
+        return;
+    }
+    if (withMax && other.withMax) {
+        maxFn(other.maxBuf.data(), maxBuf.data(), pixels);
+    }
+    if (withMean && other.withMean) {
+        for (size_t i = 0; i < pixels; ++i) {
+            sumBuf[i] += other.sumBuf[i];
+        }
+    }
+    count += other.count;
+}
+
+size_t Projection::getPixels() const
+{
+    return pixels;
+}
+
+size_t Projection::getCount() const
+{
+    return count;
+}
+
+bool Projection::hasMax() const
+{
+    return withMax;
+}
+
+bool Projection::hasMean() const
+{
+    return withMean;
+}
+
+const uint16_t *Projection::max() const
+{
+    return maxBuf.data();
+}
+
+/**
+ * @brief Mean intensity, rounded to the nearest integer.
+ */
+void Projection::mean(uint16_t *out) const
+{
+    if (count == 0 || !withMean) {
+        std::fill(out, out + pixels, 0);
+        return;
+    }
+    for (size_t i = 0; i < pixels; ++i) {
+        out[i] = static_cast<uint16_t>((sumBuf[i] + count / 2) / count);
+    }
+}
+
+size_t Projection::maxMeanFrames()
+{
+    return std::numeric_limits<uint32_t>::max() / std::numeric_limits<uint16_t>::max();
+}
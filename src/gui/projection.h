@@ -0,0 +1,49 @@
+#ifndef PROJECTION_H
+#define PROJECTION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Streaming per-pixel reduction of a stack of uint16 frames: running maximum (MIP) and/or
+ * running sum for the mean intensity projection.
+ *
+ * Each writer thread feeds its frames to its own instance with accumulate(); the partial results
+ * are combined with merge() when the stack is complete. Kernels are selected at runtime for the
+ * scalar, SSE4.1 and AVX2 instruction sets (see Binning::detectISA()).
+ */
+class Projection
+{
+public:
+    Projection();
+
+    void reset(size_t pixels, bool withMax, bool withMean);
+
+    void accumulate(const uint16_t *frame);
+    void merge(const Projection &other);
+
+    size_t getPixels() const;
+    size_t getCount() const;
+    bool hasMax() const;
+    bool hasMean() const;
+
+    const uint16_t *max() const;
+    void mean(uint16_t *out) const;
+
+    // frames that can be summed without overflowing the 32 bit accumulators
+    static size_t maxMeanFrames();
+
+private:
+    size_t pixels = 0;
+    size_t count = 0;
+    bool withMax = false;
+    bool withMean = false;
+    std::vector<uint16_t> maxBuf;
+    std::vector<uint32_t> sumBuf;
+
+    void (*maxFn)(const uint16_t *src, uint16_t *acc, size_t n);
+    void (*sumFn)(const uint16_t *src, uint32_t *acc, size_t n);
+};
+
+#endif // PROJECTION_H
@@ -0,0 +1,286 @@
+#include "pyramidwriter.h"
+
+#include "stackwriter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+PyramidWriter::PyramidWriter()
+{
+    failed = false;
+    droppedFrames = 0;
+}
+
+PyramidWriter::~PyramidWriter()
+{
+    close();
+}
+
+void PyramidWriter::setLevelCount(int value)
+{
+    levelCount = std::max(0, std::min(value, 3));
+}
+
+int PyramidWriter::getLevelCount() const
+{
+    return levelCount;
+}
+
+void PyramidWriter::setZDecimation(bool enable)
+{
+    zDecimation = enable;
+}
+
+bool PyramidWriter::isZDecimationEnabled() const
+{
+    return zDecimation;
+}
+
+void PyramidWriter::setRingDepth(int value)
+{
+    ringDepth = value;
+}
+
+/**
+ * @brief Time available to reduce one frame (us), used to size the binning worker pool.
+ */
+void PyramidWriter::setTimeBudget(double us)
+{
+    timeBudget = us;
+}
+
+/**
+ * @brief Creates the level files for a stack of \a frameCount frames of \a width x \a height
+ * pixels and starts the background thread.
+ */
+bool PyramidWriter::open(const QString &baseName, size_t width, size_t height, size_t frameCount)
+{
+    close();
+
+    this->baseName = baseName;
+    this->width = width;
+    this->height = height;
+    this->frameCount = frameCount;
+    failed = false;
+    errString.clear();
+    droppedFrames = 0;
+
+    if (!pool) {
+        pool.reset(new WorkerPool(2));
+    }
+
+    try {
+        ring.allocate(static_cast<size_t>(ringDepth), 2 * width * height);
+    } catch (std::bad_alloc) {
+        setError(QString("cannot allocate pyramid ring of %1 frames").arg(ringDepth));
+        return false;
+    }
+
+    levels.resize(static_cast<size_t>(levelCount));
+    for (int l = 1; l <= levelCount; ++l) {
+        std::unique_ptr<Level> &level = levels[static_cast<size_t>(l - 1)];
+        if (!level) {
+            level.reset(new Level());
+        }
+        // each level is binned from the previous one
+        level->binner.setFactor(2);
+        level->binner.setFrameSize(levelWidth(l - 1), levelHeight(l - 1));
+        level->binner.setWorkerPool(pool.get());
+        level->binner.setMaxThreads(pool->threadCount() + 1);
+        level->binner.setTimeBudget(timeBudget / levelCount);
+        level->frame.resize(levelWidth(l) * levelHeight(l));
+        level->groups.clear();
+
+        if (!level->writer) {
+            level->writer.reset(StackWriter::create(StackWriter::BACKEND_BUFFERED));
+        }
+        if (!level->writer->open(levelFileName(l, "raw"),
+                                 2 * levelWidth(l) * levelHeight(l),
+                                 levelDepth(l))) {
+            setError(level->writer->errorString());
+            return false;
+        }
+    }
+
+    thread = std::thread(&PyramidWriter::threadLoop, this);
+    return true;
+}
+
+/**
+ * @brief Copies frame \a fileIndex (its position in the full resolution file) into the ring.
+ *
+ * Does not wait for the background thread: if the ring is full, or the pyramid already failed,
+ * the frame is dropped (see getDroppedFrames()) and false is returned.
+ */
+bool PyramidWriter::push(int32_t fileIndex, const uint16_t *data)
+{
+    FrameRing::Slot *slot = failed ? nullptr : ring.beginPush();
+    if (slot == nullptr) {
+        if (!failed) {
+            setError(QString("ring full at frame %1, pyramid disabled for this stack")
+                         .arg(fileIndex));
+        }
+        droppedFrames++;
+        return false;
+    }
+    memcpy(slot->data, data, 2 * width * height);
+    slot->frameIndex = fileIndex;
+    ring.endPush(slot);
+    return true;
+}
+
+/**
+ * @brief Waits for all pushed frames to be reduced, writes incomplete Z groups (aborted stack)
+ * and closes the level files.
+ */
+bool PyramidWriter::close()
+{
+    if (!thread.joinable()) {
+        return !failed;
+    }
+    ring.close();
+    thread.join();
+
+    for (size_t i = 0; i < levels.size(); ++i) {
+        Level &level = *levels[i];
+        while (!level.groups.empty() && !failed) {
+            auto it = level.groups.begin();
+            flushGroup(level, it->first, it->second);
+        }
+        level.groups.clear();
+        if (!level.writer->close()) {
+            setError(level.writer->errorString());
+        }
+    }
+    return !failed;
+}
+
+void PyramidWriter::threadLoop()
+{
+    while (true) {
+        FrameRing::Slot *slot = ring.beginPop();
+        if (slot == nullptr) {
+            if (ring.isClosed() && ring.isEmpty()) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            continue;
+        }
+        if (!failed) {
+            reduce(slot->frameIndex, slot->data);
+        }
+        ring.endPop(slot);
+    }
+}
+
+bool PyramidWriter::reduce(int32_t fileIndex, const uint16_t *data)
+{
+    const uint16_t *src = data;
+    for (size_t i = 0; i < levels.size(); ++i) {
+        Level &level = *levels[i];
+        int l = static_cast<int>(i) + 1;
+        level.binner.bin(src, level.frame.data());
+        src = level.frame.data();
+
+        if (zFactor(l) == 1) {
+            if (!level.writer->writeFrame(static_cast<size_t>(fileIndex), src)) {
+                setError(level.writer->errorString());
+                return false;
+            }
+            continue;
+        }
+
+        size_t group = static_cast<size_t>(fileIndex) / static_cast<size_t>(zFactor(l));
+        Group &g = level.groups[group];
+        size_t n = level.frame.size();
+        if (g.count == 0) {
+            g.sum.assign(src, src + n);
+        } else {
+            for (size_t j = 0; j < n; ++j) {
+                g.sum[j] += src[j];
+            }
+        }
+        g.count++;
+
+        size_t groupFrames = std::min(static_cast<size_t>(zFactor(l)),
+                                      frameCount - group * static_cast<size_t>(zFactor(l)));
+        if (static_cast<size_t>(g.count) == groupFrames && !flushGroup(level, group, g)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Writes the average of the frames accumulated in \a g and removes the group.
+ */
+bool PyramidWriter::flushGroup(Level &level, size_t group, Group &g)
+{
+    size_t n = g.sum.size();
+    packed.resize(n);
+    uint32_t count = static_cast<uint32_t>(g.count);
+    for (size_t j = 0; j < n; ++j) {
+        packed[j] = static_cast<uint16_t>((g.sum[j] + count / 2) / count);
+    }
+    bool ok = level.writer->writeFrame(group, packed.data());
+    if (!ok) {
+        setError(level.writer->errorString());
+    }
+    level.groups.erase(group);
+    return ok;
+}
+
+QString PyramidWriter::errorString() const
+{
+    std::lock_guard<std::mutex> lock(errorMutex);
+    return errString;
+}
+
+/**
+ * @brief Number of frames not pushed to the ring since open().
+ */
+int64_t PyramidWriter::getDroppedFrames() const
+{
+    return droppedFrames;
+}
+
+int PyramidWriter::xyFactor(int level) const
+{
+    return 1 << level;
+}
+
+int PyramidWriter::zFactor(int level) const
+{
+    return zDecimation ? 1 << level : 1;
+}
+
+size_t PyramidWriter::levelWidth(int level) const
+{
+    return width >> level;
+}
+
+size_t PyramidWriter::levelHeight(int level) const
+{
+    return height >> level;
+}
+
+size_t PyramidWriter::levelDepth(int level) const
+{
+    size_t z = static_cast<size_t>(zFactor(level));
+    return (frameCount + z - 1) / z;
+}
+
+QString PyramidWriter::levelFileName(int level, const QString &extension) const
+{
+    return QString("%1_pyr%2.%3").arg(baseName).arg(xyFactor(level)).arg(extension);
+}
+
+void PyramidWriter::setError(const QString &msg)
+{
+    std::lock_guard<std::mutex> lock(errorMutex);
+    if (!failed) {
+        errString = msg;
+        failed = true;
+    }
+}
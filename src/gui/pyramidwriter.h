@@ -0,0 +1,96 @@
+#ifndef PYRAMIDWRITER_H
+#define PYRAMIDWRITER_H
+
+#include "binning.h"
+#include "framering.h"
+#include "workerpool.h"
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <QString>
+
+class StackWriter;
+
+/**
+ * @brief Writes downsampled copies of a stack while it is being acquired.
+ *
+ * Level l (1..levelCount) is the stack binned by 2^l in XY and, if Z decimation is enabled,
+ * averaged over groups of 2^l consecutive frames. Frames are copied into a private frame ring by
+ * push() and reduced by a background thread (row bands are binned in a small worker pool, created
+ * by the first open()), so that the full resolution writers only pay for one memcpy per frame.
+ * Each level goes to its own .raw file.
+ *
+ * push() never waits: if the ring is full the frame is dropped and the pyramid fails for the rest
+ * of the stack, since the levels would be incomplete anyway.
+ */
+class PyramidWriter
+{
+public:
+    PyramidWriter();
+    ~PyramidWriter();
+
+    void setLevelCount(int value);
+    int getLevelCount() const;
+    void setZDecimation(bool enable);
+    bool isZDecimationEnabled() const;
+    void setRingDepth(int value);
+    void setTimeBudget(double us);
+
+    bool open(const QString &baseName, size_t width, size_t height, size_t frameCount);
+    bool push(int32_t fileIndex, const uint16_t *data);
+    bool close();
+
+    QString errorString() const;
+    int64_t getDroppedFrames() const;
+
+    int xyFactor(int level) const;
+    int zFactor(int level) const;
+    size_t levelWidth(int level) const;
+    size_t levelHeight(int level) const;
+    size_t levelDepth(int level) const;
+    QString levelFileName(int level, const QString &extension) const;
+
+private:
+    struct Group
+    {
+        std::vector<uint32_t> sum;
+        int count = 0;
+    };
+
+    struct Level
+    {
+        Binning binner;
+        std::vector<uint16_t> frame;
+        std::unique_ptr<StackWriter> writer;
+        std::map<size_t, Group> groups; // Z groups being accumulated
+    };
+
+    int levelCount = 0;
+    bool zDecimation = false;
+    int ringDepth = 16;
+    double timeBudget = 0;
+
+    QString baseName;
+    size_t width = 0, height = 0, frameCount = 0;
+    std::vector<std::unique_ptr<Level>> levels;
+    FrameRing ring;
+    std::unique_ptr<WorkerPool> pool;
+    std::thread thread;
+    std::atomic<bool> failed;
+    mutable std::mutex errorMutex;
+    QString errString;
+    std::atomic<int64_t> droppedFrames;
+    std::vector<uint16_t> packed;
+
+    void threadLoop();
+    bool reduce(int32_t fileIndex, const uint16_t *data);
+    bool flushGroup(Level &level, size_t group, Group &g);
+    void setError(const QString &msg);
+};
+
+#endif // PYRAMIDWRITER_H
@@ -0,0 +1,81 @@
+#include "rampwaveform.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+/**
+ * @brief Writes \a nSamples samples of the waveform to \a out, delayed by \a nDelay samples
+ * (a negative delay advances it).
+ *
+ * The ramp is written straight at its shifted position, without building and rotating a
+ * temporary copy.
+ */
+void RampWaveform::generate(double *out,
+                            size_t nSamples,
+                            double offset,
+                            double amplitude,
+                            double fraction,
+                            long nDelay)
+{
+    if (nSamples == 0) {
+        return;
+    }
+    long n = static_cast<long>(nSamples);
+    long nRamp = static_cast<long>(floor(n * fraction));
+    long nRamp2 = n - nRamp;
+    double halfAmplitude = 0.5 * amplitude;
+
+    // out[j] = ramp[(j - nDelay) mod n]: sample i of the ramp goes to (i + shift) mod n
+    long shift = nDelay % n;
+    if (shift < 0) {
+        shift += n;
+    }
+    auto fill = [=](double *dst, long from, long to) {
+        long i = from;
+        for (; i < std::min(to, nRamp); ++i) {
+            *dst++ = offset - halfAmplitude + amplitude * i / nRamp;
+        }
+        for (; i < to; ++i) {
+            *dst++ = offset + halfAmplitude - amplitude * (i - nRamp) / nRamp2;
+        }
+    };
+    fill(out + shift, 0, n - shift);
+    fill(out, n - shift, n);
+}
+
+/**
+ * @brief Straightforward implementation (ramp in a temporary buffer, then rotated), used as a
+ * baseline by the benchmarks.
+ */
+void RampWaveform::generateReference(double *out,
+                                     size_t nSamples,
+                                     double offset,
+                                     double amplitude,
+                                     double fraction,
+                                     long nDelay)
+{
+    if (nSamples == 0) {
+        return;
+    }
+    int sampsPerChan = static_cast<int>(nSamples);
+    int nRamp = static_cast<int>(floor(sampsPerChan * fraction));
+    double halfAmplitude = 0.5 * amplitude;
+    std::vector<double> temp(nSamples, 0);
+
+    int i = 0;
+    for (; i < nRamp; ++i)
+        temp[i] = offset - halfAmplitude + amplitude * i / nRamp;
+    int nRamp2 = sampsPerChan - nRamp;
+    for (; i < sampsPerChan; ++i)
+        temp[i] = offset + halfAmplitude - amplitude * (i - nRamp) / nRamp2;
+
+    long shift = nDelay % sampsPerChan;
+    if (shift < 0) {
+        shift += sampsPerChan;
+    }
+    size_t head = nSamples - static_cast<size_t>(shift);
+    memcpy(out, temp.data() + head, shift * sizeof(double));
+    memcpy(out + shift, temp.data(), head * sizeof(double));
+}
@@ -0,0 +1,30 @@
+#ifndef RAMPWAVEFORM_H
+#define RAMPWAVEFORM_H
+
+#include <cstddef>
+
+/**
+ * @brief Sawtooth waveform driving a galvo mirror: a rising ramp over a fraction of the period
+ * followed by the flyback, circularly shifted by a delay.
+ *
+ * Kept free of NI and Qt types so that it can be benchmarked on its own (see src/bench).
+ */
+class RampWaveform
+{
+public:
+    static void generate(double *out,
+                         size_t nSamples,
+                         double offset,
+                         double amplitude,
+                         double fraction,
+                         long nDelay);
+
+    static void generateReference(double *out,
+                                  size_t nSamples,
+                                  double offset,
+                                  double amplitude,
+                                  double fraction,
+                                  long nDelay);
+};
+
+#endif // RAMPWAVEFORM_H
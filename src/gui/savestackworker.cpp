@@ -1,52 +1,58 @@
 #include "savestackworker.h"
 
+#include "binning.h"
+#include "compressedstackwriter.h"
+#include "framepool.h"
+#include "simulator.h"
 #include "spim.h"
-
+#include "stackwriter.h"
+#include "stripedstackwriter.h"
+#include "telemetry.h"
+#include "threadplacement.h"
+#include "workerpool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <thread>
 #include <unistd.h>
+#include <vector>
 
 #include <qtlab/core/logger.h>
 #include <qtlab/hw/hamamatsu/orcaflash.h>
 
 #include <QDir>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QFileInfo>
 #include <QTextStream>
 #include <QVector>
 
+// time allowed between frames once the trigger has completed, before the stack is considered
+// incomplete (the cameras are stopped: missing frames will never arrive)
+static const int COMPLETION_GRACE = 1000; // ms
+
 static Logger *logger = getLogger("SaveStackWorker");
 
 using namespace DCAM;
 
-void performBinning(uint binning, uint16_t *buf, uint16_t *obuf)
-{
-    size_t width = 2048 / binning;
-    size_t height = 2048 / binning;
-    uint binningSq = binning * binning;
-
-    for (size_t oj = 0; oj < height; ++oj) {
-        for (size_t oi = 0; oi < width; ++oi) {
-            size_t jFrom = oj * binning;
-            size_t iFrom = oi * binning;
-            double temp = 0;
-            for (uint j = 0; j < binning; ++j) {
-                for (uint i = 0; i < binning; ++i) {
-                    temp += buf[(jFrom + j) * 2048 + iFrom + i];
-                }
-            }
-            *(obuf++) = temp / binningSq;
-        }
-    }
-}
-
 SaveStackWorker::SaveStackWorker(OrcaFlash *orca, QObject *parent)
     : QObject(parent)
     , orca(orca)
 {
     frameCount = readFrames = 0;
+    writeBusyTime = 0;
 }
+
+SaveStackWorker::~SaveStackWorker()
+{
+    delete writer;
+}
+
 void SaveStackWorker::layOutFileOnDisk()
 {
     int fd = open(rawFileName().toLatin1(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
@@ -59,38 +65,39 @@ void SaveStackWorker::layOutFileOnDisk()
     close(fd);
 }
 
-void SaveStackWorker::start()
+/**
+ * @brief Waits for \a frameCount frames from \a camera, validates their frame stamps and time
+ * stamps and copies them into the frame ring.
+ *
+ * In zero-copy mode frames are not copied: the ring slot points to the DCAM buffer, which is
+ * leased to the writers until the frame has been written (see FrameLeases). Frames are copied
+ * anyway when the camera gets close to overwriting the oldest frame still being written.
+ *
+ * Once the trigger has completed, frames still in the DCAM buffer are read without waiting; if
+ * none is read for COMPLETION_GRACE ms the stack ends incomplete.
+ *
+ * \a camera is either the OrcaFlash or, in DEMO_MODE, its SimulatedCamera counterpart.
+ */
+template<typename Camera>
+void SaveStackWorker::captureFrames(Camera *camera, size_t n)
 {
     void *buf;
-    size_t width = 2048;
-    size_t height = 2048;
-    int n = 2 * width * height;
-    int binned_n = n / binning / binning;
-
-    readFrames = 0;
-    triggerCompleted = false;
-    stopped = false;
-
-    logger->info(QString("Total number of frames to acquire: %1").arg(frameCount));
-
-#ifndef DEMO_MODE
-    const int32_t nFramesInBuffer = orca->nFramesInBuffer();
+    const int32_t nFramesInBuffer = camera->nFramesInBuffer();
     QVector<qint64> timeStamps(frameCount, 0);
-#else
-    buf = malloc(n);
-#endif
-
-    uint16_t *binnedBuf = nullptr;
-    if (binning > 1) {
-        binnedBuf = new uint16_t[binned_n];
-    }
+    const int32_t leaseLimit = FrameLeases::limit(nFramesInBuffer);
+    leases.reset(nFramesInBuffer);
 
-    int fd = open(rawFileName().toLatin1(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    Telemetry::Camera &telemetry = Telemetry::global().camera(orca->getCameraIndex());
+    telemetry.dcamFrames.store(nFramesInBuffer, std::memory_order_relaxed);
+    const double framePeriod = timeout / 2; // us
+    int64_t firstCaptureTime = 0;
+    QElapsedTimer completionTimer; // restarted at every frame once the trigger has completed
 
     while (!stopped && readFrames < frameCount) {
-#ifndef DEMO_MODE
         int32_t frame = readFrames % nFramesInBuffer;
         int32_t frameStamp = -1;
+        int64_t captureTime = 0;
+        int32_t backlog = 0; // frames the camera has taken since this one (estimate)
 
         DCAM_TIMESTAMP timeStamp;
 
@@ -99,10 +106,18 @@ void SaveStackWorker::start()
 
         if (!triggerCompleted) {
             try {
-                event = orca->wait(1000, mask);
+                event = camera->wait(1000, mask);
             } catch (std::runtime_error e) {
                 continue;
             }
+        } else if (!completionTimer.isValid()) {
+            completionTimer.start();
+        } else if (completionTimer.elapsed() > COMPLETION_GRACE) {
+            logger->warning(QString("Camera %1: frame #%2 missing %3 ms after trigger completion")
+                                .arg(orca->getCameraIndex())
+                                .arg(readFrames)
+                                .arg(COMPLETION_GRACE));
+            break;
         }
 
         if (stopped) {
@@ -112,14 +127,32 @@ void SaveStackWorker::start()
         switch (event) {
         case DCAMWAIT_CAPEVENT_FRAMEREADY:
             try {
-                orca->lockFrame(frame, &buf, &frameStamp, &timeStamp);
+                camera->lockFrame(frame, &buf, &frameStamp, &timeStamp);
             } catch (std::runtime_error) {
+                if (triggerCompleted) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
                 continue;
             }
+            captureTime = Telemetry::now();
 
             timeStamps[readFrames] = timeStamp.sec * 1e6 + timeStamp.microsec;
-            if (readFrames != 0) {
+            if (readFrames == 0) {
+                firstCaptureTime = captureTime;
+            } else {
                 double delta = double(timeStamps[readFrames]) - double(timeStamps[readFrames - 1]);
+                maxFrameInterval = std::max(maxFrameInterval, std::fabs(delta));
+                telemetry.jitter.add(std::fabs(std::fabs(delta) - framePeriod));
+
+                // DCAM does not report its write position: estimate how many frames the camera
+                // has taken since this one from how late it is read, relative to the first frame
+                double lag = (captureTime - firstCaptureTime) * 1e-3
+                             - double(timeStamps[readFrames] - timeStamps[0]);
+                if (framePeriod > 0) {
+                    backlog = std::min(static_cast<int32_t>(std::max(lag, 0.) / framePeriod),
+                                       nFramesInBuffer);
+                    telemetry.dcamBacklog.store(backlog, std::memory_order_relaxed);
+                }
                 if (abs(delta) > timeout) {
                     logger->warning(timeoutString(delta, readFrames));
                 }
@@ -143,64 +176,498 @@ void SaveStackWorker::start()
             logger->warning(QString("Camera %1 timeout").arg(orca->getCameraIndex()));
             continue;
         }
-#else
-        orca->copyLastFrame(buf, n);
-#endif
 
         if (stopped) {
             break;
         }
 
-        if (binning > 1) {
-            performBinning(binning, static_cast<uint16_t *>(buf), binnedBuf);
+        // zero-copy: the writers read the frame from the DCAM buffer, unless the camera is about
+        // to wrap around to the oldest frame they have not written yet. The camera is already
+        // backlog frames past the one just read, so that is where the span ends.
+        bool lease = false;
+        if (zeroCopy) {
+            int32_t span = leases.span(readFrames);
+            int32_t ahead = span + backlog;
+            if (span > 0 && ahead >= nFramesInBuffer) {
+                logger->critical(QString("Camera %1: frame #%2 overwritten in the DCAM buffer "
+                                         "while being written")
+                                     .arg(orca->getCameraIndex())
+                                     .arg(readFrames - span));
+                stop();
+                break;
+            }
+            lease = ahead < leaseLimit;
+            if (!lease) {
+                if (backpressureFrames == 0) {
+                    logger->warning(QString("Camera %1: DCAM buffer %2 frames away from frame "
+                                            "#%3, still being written: copying frames")
+                                        .arg(orca->getCameraIndex())
+                                        .arg(nFramesInBuffer - ahead)
+                                        .arg(readFrames - span));
+                }
+                backpressureFrames++;
+            }
         }
-        ssize_t written = write(fd, binning > 1 ? binnedBuf : buf, binned_n);
-        if (written != binned_n) {
-            logger->critical(QString("Camera %1: written %2/%3 bytes")
-                                 .arg(orca->getCameraIndex())
-                                 .arg(written)
-                                 .arg(binned_n));
+
+        // wait for a free slot: time spent here is time the DCAM buffer is filling up
+        FrameRing::Slot *slot = ring.beginPush();
+        if (slot == nullptr) {
+            QElapsedTimer stallTimer;
+            stallTimer.start();
+            while (!stopped && !writeError && (slot = ring.beginPush()) == nullptr) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+            stallTime += stallTimer.nsecsElapsed() * 1e-6;
+            if (slot == nullptr) {
+                break;
+            }
         }
+
+        if (lease) {
+            leases.acquire(readFrames);
+            slot->frame = static_cast<const uint16_t *>(buf);
+            leasedFrames++;
+        } else {
+            memcpy(slot->data, buf, n);
+            slot->frame = slot->data;
+        }
+        slot->leased = lease;
+        slot->frameIndex = readFrames;
+        slot->captureTime = captureTime;
+        ring.endPush(slot);
+
+        telemetry.framesCaptured.fetch_add(1, std::memory_order_relaxed);
+        telemetry.queueDepth.store(static_cast<int32_t>(ring.occupancy()),
+                                   std::memory_order_relaxed);
         readFrames++;
+        if (completionTimer.isValid()) {
+            completionTimer.restart();
+        }
+    }
+}
+
+void SaveStackWorker::start()
+{
+    // placed first, so that the frame ring is faulted in on the node of the capture CPU
+    ThreadPlacement::Scope placement(ThreadPlacement::ROLE_CAPTURE,
+                                     orca->getCameraIndex(),
+                                     "capture");
+    size_t width = static_cast<size_t>(orca->getImageWidth());
+    size_t height = static_cast<size_t>(orca->getImageHeight());
+    int n = 2 * width * height;
+
+    readFrames = 0;
+    triggerCompleted = false;
+    stopped = false;
+    writeError = false;
+    stallTime = 0;
+    maxFrameInterval = 0;
+    writeBusyTime = 0;
+    leasedFrames = 0;
+    backpressureFrames = 0;
+    threadUsage.clear();
+
+    logger->info(QString("Total number of frames to acquire: %1").arg(frameCount));
+
+    try {
+        ring.allocate(static_cast<size_t>(ringDepth), static_cast<size_t>(n));
+    } catch (std::bad_alloc) {
+        emit error(QString("Camera %1: cannot allocate frame ring of %2 frames")
+                       .arg(orca->getCameraIndex())
+                       .arg(ringDepth));
+        emit captureCompleted(false);
+        emit stackSaved(false);
+        return;
+    }
+
+    Telemetry::Camera &telemetry = Telemetry::global().camera(orca->getCameraIndex());
+    telemetry.queueCapacity.store(static_cast<int32_t>(ring.depth()), std::memory_order_relaxed);
+
+    bool striped = stripeWeights.size() > 1;
+    if (writer == nullptr || writer->backend() != ioBackend || writerStripes != stripeWeights) {
+        delete writer;
+        if (striped) {
+            QVector<StackWriter *> stripes;
+            for (int i = 0; i < stripeWeights.size(); ++i) {
+                stripes << StackWriter::create(ioBackend);
+            }
+            writer = new StripedStackWriter(stripes, stripeWeights);
+        } else {
+            writer = StackWriter::create(ioBackend);
+        }
+        writerStripes = stripeWeights;
+    }
+    QVector<StackWriter *> backends = {writer};
+    if (striped) {
+        StripedStackWriter *sw = static_cast<StripedStackWriter *>(writer);
+        sw->setDirectories(stripeDirs);
+        backends.clear();
+        for (int i = 0; i < sw->stripeCount(); ++i) {
+            backends << sw->stripe(i);
+        }
+    }
+    for (StackWriter *w : backends) {
+        w->setWritebackWindow(writebackWindow);
+#ifdef WITH_ZSTD
+        if (w->backend() == StackWriter::BACKEND_COMPRESSED) {
+            CompressedStackWriter *cw = static_cast<CompressedStackWriter *>(w);
+            cw->setLevel(compressionLevel);
+            cw->setThreadCount(compressionThreads);
+        }
+#endif
+    }
+    size_t binned_n = 2 * (width / binning) * (height / binning);
+    if (!writer->open(rawFileName(), binned_n, static_cast<size_t>(frameCount))) {
+        emit error(writer->errorString());
+        emit captureCompleted(false);
+        emit stackSaved(false);
+        return;
+    }
+
+    // reversed (serpentine) stacks are written back to front when the backend accepts frames in
+    // any order, otherwise the direction is recorded in the .mhd header
+    reorderFrames = reversed && writer->supportsConcurrentWrites();
+
+    bool withMean = meanEnabled;
+    if (withMean && static_cast<size_t>(frameCount) > Projection::maxMeanFrames()) {
+        logger->warning(QString("Camera %1: too many frames for the mean projection")
+                            .arg(orca->getCameraIndex()));
+        withMean = false;
+    }
+    projecting = mipEnabled || withMean;
+    if (projecting) {
+        projection.reset(binned_n / 2, mipEnabled, withMean);
+    }
+
+    pyramidOpen = false;
+    if (pyramidLevels > 0) {
+        pyramid.setLevelCount(pyramidLevels);
+        pyramid.setZDecimation(pyramidZDecimation);
+        pyramid.setTimeBudget(timeout / 2);
+        pyramidOpen = pyramid.open(QDir(outputPath).filePath(outputFileName),
+                                   width / binning,
+                                   height / binning,
+                                   static_cast<size_t>(frameCount));
+        if (!pyramidOpen) {
+            logger->warning(QString("Camera %1: pyramid disabled: %2")
+                                .arg(orca->getCameraIndex())
+                                .arg(pyramid.errorString()));
+        }
+    }
+
+    int nWriters = writer->supportsConcurrentWrites() ? std::max(writerThreads, 1) : 1;
+    std::vector<std::thread> writers;
+    for (int i = 0; i < nWriters; ++i) {
+        writers.emplace_back(&SaveStackWorker::writerLoop, this, i, width, height);
     }
 
 #ifndef DEMO_MODE
+    captureFrames(orca, static_cast<size_t>(n));
 #else
-    free(buf);
+    captureFrames(simulator().getCamera(orca->getCameraIndex()), static_cast<size_t>(n));
 #endif
-    close(fd);
+    ThreadPlacement::Usage captureUsage = placement.usage();
+
+    // all frames are in the ring: the stages can already move to the next tile while the
+    // writers drain the ring
+    emit captureCompleted(readFrames == frameCount && !writeError);
+
+    ring.close();
+    for (std::thread &t : writers) {
+        t.join();
+    }
+    threadUsage.prepend(captureUsage);
+    telemetry.dcamBacklog.store(0, std::memory_order_relaxed);
+    telemetry.queueDepth.store(0, std::memory_order_relaxed);
+    QElapsedTimer closeTimer;
+    closeTimer.start();
+    if (!writer->close()) {
+        logger->critical(QString("Camera %1: %2")
+                             .arg(orca->getCameraIndex())
+                             .arg(writer->errorString()));
+        writeError = true;
+    }
 
-    if (binnedBuf != nullptr) {
-        delete[] binnedBuf;
+    // time the writers would have needed had frames been available at any rate
+    double busy = writeBusyTime * 1e-9 / nWriters + closeTimer.nsecsElapsed() * 1e-9;
+    writeThroughput = 0;
+    if (busy > 0 && !writeError) {
+        writeThroughput = double(binned_n) * readFrames / busy;
+    }
+    if (projecting && projection.getCount() > 0) {
+        saveProjections(width / binning, height / binning);
+    }
+    if (pyramidOpen) {
+        // a broken pyramid does not invalidate the full resolution stack
+        if (!pyramid.close() && pyramid.getDroppedFrames() == 0) {
+            logger->warning(QString("Camera %1: pyramid: %2")
+                                .arg(orca->getCameraIndex())
+                                .arg(pyramid.errorString()));
+        }
+        if (pyramid.getDroppedFrames() > 0) {
+            logger->info(QString("Camera %1: pyramid dropped %2 frames")
+                             .arg(orca->getCameraIndex())
+                             .arg(pyramid.getDroppedFrames()));
+        }
     }
 
-    emit captureCompleted(readFrames == frameCount);
+    QString report = writer->report();
+    if (!report.isEmpty()) {
+        logger->info(QString("Camera %1: %2").arg(orca->getCameraIndex()).arg(report));
+    }
+    logger->info(
+        QString("Camera %1: %2").arg(orca->getCameraIndex()).arg(FramePool::global().report()));
+
+    bool ok = readFrames == frameCount && !writeError;
+
+    logger->info(QString("Camera %1: frame ring depth %2, high-water mark %3, stall time %4 ms")
+                     .arg(orca->getCameraIndex())
+                     .arg(ring.depth())
+                     .arg(ring.highWaterMark())
+                     .arg(stallTime));
+    if (zeroCopy) {
+        logger->info(QString("Camera %1: %2 frames written from the DCAM buffer, %3 copied under "
+                             "backpressure, up to %4 frames in flight")
+                         .arg(orca->getCameraIndex())
+                         .arg(leasedFrames)
+                         .arg(backpressureFrames)
+                         .arg(leases.highWaterMark()));
+    }
+    logger->info(QString("Camera %1: threads: %2")
+                     .arg(orca->getCameraIndex())
+                     .arg(ThreadPlacement::formatUsage(threadUsage)));
+
     QString msg = QString("Camera %1: Saved %2/%3 frames")
                       .arg(orca->getCameraIndex())
                       .arg(readFrames)
                       .arg(frameCount);
-    if (readFrames != frameCount) {
+    if (!ok) {
         logger->warning(msg);
     } else {
         logger->info(msg);
     }
 
-    QFile outFile(mhdFileName());
-    if (!outFile.open(QIODevice::WriteOnly)) {
-        emit error(QString("Cannot open output file %1").arg(outFile.fileName()));
+    if (!writeStackHeader(headerFileName(),
+                          rawFileName(),
+                          width / binning,
+                          height / binning,
+                          static_cast<size_t>(readFrames),
+                          1,
+                          1,
+                          dataFormat())) {
+        emit error(QString("Cannot open output file %1").arg(headerFileName()));
+        emit stackSaved(false);
         return;
-    };
-    QFileInfo fi = QFileInfo(rawFileName());
+    }
+
+    for (int l = 1; pyramidOpen && l <= pyramid.getLevelCount(); ++l) {
+        size_t z = static_cast<size_t>(pyramid.zFactor(l));
+        writeStackHeader(pyramid.levelFileName(l, "mhd"),
+                         pyramid.levelFileName(l, "raw"),
+                         pyramid.levelWidth(l),
+                         pyramid.levelHeight(l),
+                         (static_cast<size_t>(readFrames) + z - 1) / z,
+                         pyramid.xyFactor(l),
+                         pyramid.zFactor(l));
+    }
+
+    emit stackSaved(ok);
+}
+
+/**
+ * @brief Writes the MetaImage header of a stack (or of a pyramid level, with voxel spacing
+ * \a xyFactor, \a xyFactor, \a zFactor relative to the full resolution stack).
+ *
+ * If the data file is not raw pixels (\a format is not empty), \a headerName is a sidecar with
+ * the same keys but DataFormat and DataFile in place of ElementDataFile, so that MetaImage
+ * readers do not decode the file as pixels.
+ */
+bool SaveStackWorker::writeStackHeader(const QString &headerName,
+                                       const QString &dataName,
+                                       size_t width,
+                                       size_t height,
+                                       size_t depth,
+                                       int xyFactor,
+                                       int zFactor,
+                                       const QString &format)
+{
+    QFile outFile(headerName);
+    if (!outFile.open(QIODevice::WriteOnly)) {
+        return false;
+    }
 
     QTextStream out(&outFile);
     out << "ObjectType = Image" << endl;
     out << "NDims = 3" << endl;
     out << "BinaryData = True" << endl;
     out << "BinaryDataByteOrderMSB = False" << endl;
-    out << "DimSize = " << width / binning << " " << height / binning << " " << readFrames << endl;
+    out << "DimSize = " << width << " " << height << " " << depth << endl;
+    if (xyFactor != 1 || zFactor != 1) {
+        out << "ElementSpacing = " << xyFactor << " " << xyFactor << " " << zFactor << endl;
+    }
+    if (reversed && !reorderFrames) {
+        out << "TransformMatrix = 1 0 0 0 1 0 0 0 -1" << endl;
+        out << "Offset = 0 0 " << (depth > 0 ? depth - 1 : 0) * zFactor << endl;
+    }
+    out << "ElementType = MET_USHORT" << endl;
+    if (format.isEmpty()) {
+        out << "ElementDataFile = " << QFileInfo(dataName).fileName() << endl;
+    } else {
+        out << "DataFormat = " << format << endl;
+        out << "DataFile = " << QFileInfo(dataName).fileName() << endl;
+    }
+    outFile.close();
+    return true;
+}
+
+/**
+ * @brief Drains the frame ring: bins each frame (if needed) and writes it at its position in the
+ * output file (several writer threads can run concurrently if the backend allows it).
+ */
+void SaveStackWorker::writerLoop(int index, size_t width, size_t height)
+{
+    ThreadPlacement::Scope placement(ThreadPlacement::ROLE_WRITER,
+                                     orca->getCameraIndex(),
+                                     QString("writer %1").arg(index));
+
+    Binning binner(binning, width, height);
+    binner.setWorkerPool(&WorkerPool::global());
+    binner.setMaxThreads(WorkerPool::global().threadCount() + 1);
+    binner.setTimeBudget(timeout / 2); // nominal frame period (us)
+
+    // recycled across stacks, on the node of this writer thread
+    FramePool::Buffer binnedBuf;
+    if (binning > 1) {
+        try {
+            binnedBuf = FramePool::global().acquire(2 * binner.getOutputPixels());
+        } catch (std::bad_alloc) {
+            logger->critical(QString("Camera %1: cannot allocate binning buffer")
+                                 .arg(orca->getCameraIndex()));
+            writeError = true;
+            return;
+        }
+    }
+
+    Projection partial;
+    if (projecting) {
+        partial.reset(binner.getOutputPixels(), projection.hasMax(), projection.hasMean());
+    }
+
+    Telemetry::Camera &telemetry = Telemetry::global().camera(orca->getCameraIndex());
+    const int64_t frameBytes = 2 * static_cast<int64_t>(binner.getOutputPixels());
+
+    while (true) {
+        FrameRing::Slot *slot = ring.beginPop();
+        if (slot == nullptr) {
+            if (ring.isClosed() && ring.isEmpty()) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            continue;
+        }
+
+        QElapsedTimer busyTimer;
+        busyTimer.start();
+
+        const void *data = slot->frame;
+        if (binning > 1) {
+            binner.bin(slot->frame, binnedBuf.as<uint16_t>());
+            data = binnedBuf.data();
+        }
+        if (projecting) {
+            // the frame is still in cache: reduce it right before writing it
+            partial.accumulate(static_cast<const uint16_t *>(data));
+        }
+        int32_t index = reorderFrames ? frameCount - 1 - slot->frameIndex : slot->frameIndex;
+        bool ok = true;
+        if (!writeError) {
+            ok = writer->writeFrame(static_cast<size_t>(index), data);
+        }
+        if (pyramidOpen && !pyramid.push(index, static_cast<const uint16_t *>(data))
+            && pyramid.getDroppedFrames() == 1) {
+            logger->warning(QString("Camera %1: pyramid: %2")
+                                .arg(orca->getCameraIndex())
+                                .arg(pyramid.errorString()));
+        }
+        if (slot->leased) {
+            leases.release(slot->frameIndex);
+        }
+        int64_t captureTime = slot->captureTime;
+        ring.endPop(slot);
+        writeBusyTime += busyTimer.nsecsElapsed();
+
+        telemetry.writeLatency.add((Telemetry::now() - captureTime) * 1e-3);
+        telemetry.queueDepth.store(static_cast<int32_t>(ring.occupancy()),
+                                   std::memory_order_relaxed);
+        if (ok && !writeError) {
+            telemetry.framesWritten.fetch_add(1, std::memory_order_relaxed);
+            telemetry.bytesWritten.fetch_add(frameBytes, std::memory_order_relaxed);
+        }
+
+        if (!ok) {
+            logger->critical(QString("Camera %1: %2")
+                                 .arg(orca->getCameraIndex())
+                                 .arg(writer->errorString()));
+            writeError = true;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(usageMutex);
+        threadUsage << placement.usage();
+    }
+
+    if (projecting) {
+        std::lock_guard<std::mutex> lock(projectionMutex);
+        projection.merge(partial);
+    }
+}
+
+/**
+ * @brief Writes the maximum and/or mean intensity projections of the stack as 2D MetaImages next
+ * to the stack, e.g. name_mip.mhd and name_mip.raw.
+ */
+void SaveStackWorker::saveProjections(size_t width, size_t height)
+{
+    if (projection.hasMax()) {
+        saveImage("mip", projection.max(), width, height);
+    }
+    if (projection.hasMean()) {
+        std::vector<uint16_t> mean(projection.getPixels());
+        projection.mean(mean.data());
+        saveImage("mean", mean.data(), width, height);
+    }
+}
+
+bool SaveStackWorker::saveImage(const QString &kind,
+                                const uint16_t *data,
+                                size_t width,
+                                size_t height)
+{
+    QFile rawFile(projectionFileName(kind, "raw"));
+    qint64 bytes = static_cast<qint64>(2 * width * height);
+    if (!rawFile.open(QIODevice::WriteOnly)
+        || rawFile.write(reinterpret_cast<const char *>(data), bytes) != bytes) {
+        logger->warning(QString("Cannot write %1").arg(rawFile.fileName()));
+        return false;
+    }
+    rawFile.close();
+
+    QFile outFile(projectionFileName(kind, "mhd"));
+    if (!outFile.open(QIODevice::WriteOnly)) {
+        logger->warning(QString("Cannot write %1").arg(outFile.fileName()));
+        return false;
+    }
+    QTextStream out(&outFile);
+    out << "ObjectType = Image" << endl;
+    out << "NDims = 2" << endl;
+    out << "BinaryData = True" << endl;
+    out << "BinaryDataByteOrderMSB = False" << endl;
+    out << "DimSize = " << width << " " << height << endl;
     out << "ElementType = MET_USHORT" << endl;
-    out << "ElementDataFile = " << fi.fileName() << endl;
+    out << "ElementDataFile = " << QFileInfo(rawFile).fileName() << endl;
     outFile.close();
+    return true;
 }
 
 void SaveStackWorker::stop()
@@ -237,6 +704,101 @@ void SaveStackWorker::setBinning(const uint &value)
     binning = value;
 }
 
+void SaveStackWorker::setRingDepth(int value)
+{
+    ringDepth = value;
+}
+
+void SaveStackWorker::setIOBackend(StackWriter::Backend value)
+{
+    ioBackend = value;
+}
+
+void SaveStackWorker::setCompression(int level, int nThreads)
+{
+    compressionLevel = level;
+    compressionThreads = nThreads;
+}
+
+void SaveStackWorker::setWritebackWindow(size_t bytes)
+{
+    writebackWindow = bytes;
+}
+
+/**
+ * @brief Stripes stacks over \a dirs (the first one being the output path) with the given
+ * \a weights; a single directory disables striping.
+ */
+void SaveStackWorker::setStripes(const QStringList &dirs, const QVector<int> &weights)
+{
+    stripeDirs = dirs;
+    stripeWeights = dirs.size() > 1 ? weights : QVector<int>();
+}
+
+void SaveStackWorker::setProjections(bool mip, bool mean)
+{
+    mipEnabled = mip;
+    meanEnabled = mean;
+}
+
+void SaveStackWorker::setPyramid(int levels, bool zDecimation)
+{
+    pyramidLevels = levels;
+    pyramidZDecimation = zDecimation;
+}
+
+void SaveStackWorker::setReversed(bool value)
+{
+    reversed = value;
+}
+
+void SaveStackWorker::setWriterThreads(int value)
+{
+    writerThreads = value;
+}
+
+/**
+ * @brief Writes frames straight from the DCAM buffer instead of copying them into the frame ring.
+ */
+void SaveStackWorker::setZeroCopy(bool enable)
+{
+    zeroCopy = enable;
+}
+
+size_t SaveStackWorker::getRingHighWaterMark() const
+{
+    return ring.highWaterMark();
+}
+
+/**
+ * @brief Largest number of frames of the DCAM buffer, from the oldest frame not written yet, that
+ * were in flight during the last zero-copy stack.
+ */
+int32_t SaveStackWorker::getLeaseHighWaterMark() const
+{
+    return leases.highWaterMark();
+}
+
+/**
+ * @brief Rate at which the writers processed (binned and wrote) the frames of the last stack,
+ * not counting the time they waited for frames, in bytes of binned frames per second; 0 if
+ * unknown.
+ */
+double SaveStackWorker::getWriteThroughput() const
+{
+    return writeThroughput;
+}
+
+double SaveStackWorker::getMaxFrameInterval() const
+{
+    return maxFrameInterval;
+}
+
+double SaveStackWorker::getStallTime() const
+{
+    return stallTime;
+}
+
 void SaveStackWorker::setFrameCount(int32_t count)
 {
     frameCount = count;
@@ -247,14 +809,50 @@ void SaveStackWorker::setOutputFileName(const QString &fname)
     outputFileName = fname;
 }
 
+/**
+ * @brief The stack file, or its manifest for striped stacks (see StripedStackWriter).
+ */
 QString SaveStackWorker::rawFileName()
 {
-    return QString("%1.raw").arg(QDir(outputPath).filePath(outputFileName));
+    QString extension = stripeWeights.size() > 1 ? StripedStackWriter::fileExtension()
+                                                 : StackWriter::fileExtension(ioBackend);
+    return QString("%1.%2").arg(QDir(outputPath).filePath(outputFileName)).arg(extension);
+}
+
+/**
+ * @brief The .mhd header of the stack, or a .txt sidecar if the data file is not raw pixels.
+ */
+QString SaveStackWorker::headerFileName()
+{
+    return QString("%1.%2")
+        .arg(QDir(outputPath).filePath(outputFileName))
+        .arg(dataFormat().isEmpty() ? "mhd" : "txt");
+}
+
+/**
+ * @brief Encoding of the stack data file, empty for raw pixels.
+ *
+ * Layers are separated by spaces, outermost first: a striped stack of compressed stripes is
+ * "Stripes SPIMZST1".
+ */
+QString SaveStackWorker::dataFormat() const
+{
+    QStringList layers;
+    if (stripeWeights.size() > 1) {
+        layers << "Stripes"; // manifest, see StripedStackWriter::readFrame()
+    }
+#ifdef WITH_ZSTD
+    if (ioBackend == StackWriter::BACKEND_COMPRESSED) {
+        layers << "SPIMZST1"; // see CompressedStackWriter::readFrame()
+    }
+#endif
+    return layers.join(' ');
 }
 
-QString SaveStackWorker::mhdFileName()
+QString SaveStackWorker::projectionFileName(const QString &kind, const QString &extension)
 {
-    return QString("%1.mhd").arg(QDir(outputPath).filePath(outputFileName));
+    return QString("%1_%2.%3").arg(QDir(outputPath).filePath(outputFileName)).arg(kind).arg(
+        extension);
 }
 
 void SaveStackWorker::signalTriggerCompletion()
@@ -1,8 +1,20 @@
 #ifndef SAVESTACKWORKER_H
 #define SAVESTACKWORKER_H
 
+#include "framelease.h"
+#include "framering.h"
+#include "projection.h"
+#include "pyramidwriter.h"
+#include "stackwriter.h"
+#include "threadplacement.h"
+
+#include <atomic>
+#include <mutex>
+
 #include <QObject>
 #include <QString>
+#include <QStringList>
+#include <QVector>
 
 class OrcaFlash;
 
@@ -11,6 +23,7 @@ class SaveStackWorker : public QObject
     Q_OBJECT
 public:
     explicit SaveStackWorker(OrcaFlash *orca, QObject *parent = nullptr);
+    virtual ~SaveStackWorker();
 
     void layOutFileOnDisk();
     double getTimeout() const;     // ms
@@ -25,27 +38,97 @@ public:
     size_t getReadFrames() const;
 
     QString rawFileName();
-    QString mhdFileName();
+    QString headerFileName();
+    QString projectionFileName(const QString &kind, const QString &extension);
 
     void start();
     void stop();
 
     void setBinning(const uint &value);
 
+    void setRingDepth(int value);
+    void setWriterThreads(int value);
+    void setZeroCopy(bool enable);
+    void setIOBackend(StackWriter::Backend value);
+    void setCompression(int level, int nThreads);
+    void setWritebackWindow(size_t bytes);
+    void setStripes(const QStringList &dirs, const QVector<int> &weights);
+    void setReversed(bool value);
+    void setProjections(bool mip, bool mean);
+    void setPyramid(int levels, bool zDecimation);
+
+    size_t getRingHighWaterMark() const;
+    int32_t getLeaseHighWaterMark() const;
+    double getStallTime() const;       // ms
+    double getMaxFrameInterval() const; // us
+    double getWriteThroughput() const;  // bytes/s
+
 signals:
     void error(QString msg = "");
     void captureCompleted(bool ok);
+    void stackSaved(bool ok);
 
 private:
     QString timeoutString(double delta, int i);
+    void writerLoop(int index, size_t width, size_t height);
+    void saveProjections(size_t width, size_t height);
+    bool saveImage(const QString &kind, const uint16_t *data, size_t width, size_t height);
+    bool writeStackHeader(const QString &headerName,
+                          const QString &dataName,
+                          size_t width,
+                          size_t height,
+                          size_t depth,
+                          int xyFactor = 1,
+                          int zFactor = 1,
+                          const QString &format = QString());
+    QString dataFormat() const;
+
+    template<typename Camera>
+    void captureFrames(Camera *camera, size_t n);
 
-    bool stopped, triggerCompleted;
+    std::atomic<bool> stopped, writeError, triggerCompleted;
     double timeout;
     QString outputFileName;
     QString outputPath;
     int32_t frameCount, readFrames;
     OrcaFlash *orca;
     uint binning;
+
+    FrameRing ring;
+    int ringDepth = 32;
+    int writerThreads = 1;
+    bool zeroCopy = false;
+    FrameLeases leases;
+    int32_t leasedFrames = 0;       // frames written straight from the DCAM buffer
+    int32_t backpressureFrames = 0; // frames copied because the DCAM buffer was about to wrap
+    StackWriter::Backend ioBackend = StackWriter::BACKEND_BUFFERED;
+    StackWriter *writer = nullptr;
+    int compressionLevel = 1;
+    int compressionThreads = 4;
+    size_t writebackWindow = Writeback::DEFAULT_WINDOW_BYTES;
+    QStringList stripeDirs;
+    QVector<int> stripeWeights; // empty if not striped
+    QVector<int> writerStripes; // stripe weights of the current writer
+    double stallTime = 0;
+    double maxFrameInterval = 0; // largest time stamp delta of the last stack, us
+    std::atomic<int64_t> writeBusyTime; // ns spent processing frames, summed over writers
+    double writeThroughput = 0;         // bytes/s the writers sustained in the last stack
+    bool reversed = false;      // stack acquired from "to" to "from"
+    bool reorderFrames = false; // reversed stack written back to front
+
+    QVector<ThreadPlacement::Usage> threadUsage; // capture thread first, then writers
+    std::mutex usageMutex;
+
+    bool mipEnabled = false;
+    bool meanEnabled = false;
+    bool projecting = false; // projections of the current stack (either enabled, mean permitting)
+    Projection projection;   // partial projections of the writer threads are merged here
+    std::mutex projectionMutex;
+
+    int pyramidLevels = 0;
+    bool pyramidZDecimation = false;
+    PyramidWriter pyramid;
+    bool pyramidOpen = false;
 };
 
 #endif // SAVESTACKWORKER_H
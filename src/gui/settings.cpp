@@ -2,8 +2,12 @@
 
 #include "cameratrigger.h"
 #include "galvoramp.h"
+#include "simulator.h"
 #include "spim.h"
+#include "stackwriter.h"
 #include "tasks.h"
+#include "telemetry.h"
+#include "threadplacement.h"
 
 #include <memory>
 
@@ -24,11 +28,24 @@
 #define SETTINGSGROUP_AOTF(n) QString("AOTF_%1").arg(n)
 #define SETTINGSGROUP_CAMTRIG "CameraTrigger"
 #define SETTINGSGROUP_GRAMP "GalvoRamp"
+#define SETTINGSGROUP_SIMULATION "Simulation"
 
 #define SETTING_PULSE_TERMS "pulseTerms"
 #define SETTING_BLANKING_TERMS "blankingTerms"
 
 #define SETTING_SCANVELOCITY "scanVelocity"
+#define SETTING_FRAME_RING_DEPTH "frameRingDepth"
+#define SETTING_WRITER_THREADS "writerThreads"
+#define SETTING_ZERO_COPY "zeroCopy"
+#define SETTING_IO_BACKEND "ioBackend"
+#define SETTING_COMPRESSION_LEVEL "compressionLevel"
+#define SETTING_COMPRESSION_THREADS "compressionThreads"
+#define SETTING_WRITEBACK_WINDOW "writebackWindow"
+#define SETTING_WRITE_THROUGHPUT "writeThroughput"
+#define SETTING_THREAD_PLACEMENT "threadPlacement"
+#define SETTING_DRAIN_POLICY "drainPolicy"
+#define SETTING_DRAIN_PRIORITY "drainPriority"
+#define SETTING_TELEMETRY_PATH "telemetryPath"
 
 #define SETTING_FROM "from"
 #define SETTING_TO "to"
@@ -44,10 +61,21 @@
 #define SETTING_WFPARAMS "waveformParams"
 
 #define SETTING_TRIGGER_TERM "triggerTerm"
+#define SETTING_TRIGGER_CALIBRATION "triggerCalibration"
 
 #define SETTING_EXPTIME "exposureTime"
 #define SETTING_RUN_NAME "runName"
 #define SETTING_BINNING "binning"
+#define SETTING_SERPENTINE "serpentine"
+#define SETTING_MIP_ENABLED "mipEnabled"
+#define SETTING_MEAN_PROJECTION_ENABLED "meanProjectionEnabled"
+#define SETTING_PYRAMID_LEVELS "pyramidLevels"
+#define SETTING_POSITION_TRIGGER "positionTrigger"
+#define SETTING_PYRAMID_Z_DECIMATION "pyramidZDecimation"
+
+#define SETTING_FRAME_PATTERN "framePattern"
+#define SETTING_STAGE_ACCELERATION "stageAcceleration"
+#define SETTING_STAGE_SETTLE_TIME "stageSettleTime"
 
 Settings::Settings()
 {
@@ -87,10 +115,28 @@ void Settings::loadSettings()
 
     SET_VALUE(groupName, SETTING_LUTPATH, "/opt/Fiji.app/luts/");
     SET_VALUE(groupName, SETTING_SCANVELOCITY, 2.0);
+    SET_VALUE(groupName, SETTING_FRAME_RING_DEPTH, 32);
+    SET_VALUE(groupName, SETTING_WRITER_THREADS, 1);
+    SET_VALUE(groupName, SETTING_ZERO_COPY, false);
+    SET_VALUE(groupName,
+              SETTING_IO_BACKEND,
+              StackWriter::backendName(StackWriter::BACKEND_BUFFERED));
+    SET_VALUE(groupName, SETTING_COMPRESSION_LEVEL, 1);
+    SET_VALUE(groupName, SETTING_COMPRESSION_THREADS, 4);
+    SET_VALUE(groupName, SETTING_WRITEBACK_WINDOW, 32);
+    SET_VALUE(groupName, SETTING_WRITE_THROUGHPUT, 0.);
     QStringList camOutputPath;
     camOutputPath << "/mnt/dualspim"
                   << "/mnt/dualspim";
     SET_VALUE(groupName, SETTING_CAM_OUTPUT_PATH_LIST, camOutputPath);
+    SET_VALUE(groupName, SETTING_CAM_STRIPE_PATH_LIST, QStringList({"", ""}));
+    SET_VALUE(groupName, SETTING_THREAD_PLACEMENT, false);
+    SET_VALUE(groupName, SETTING_CAM_CPU_LIST, QStringList({"", ""}));
+    SET_VALUE(groupName,
+              SETTING_DRAIN_POLICY,
+              ThreadPlacement::policyName(ThreadPlacement::POLICY_OTHER));
+    SET_VALUE(groupName, SETTING_DRAIN_PRIORITY, 10);
+    SET_VALUE(groupName, SETTING_TELEMETRY_PATH, "/dev/shm/spimlab-telemetry.prom");
 
     settings.endGroup();
 
@@ -132,6 +178,7 @@ void Settings::loadSettings()
     SET_VALUE(groupName, SETTING_PULSE_TERMS, QStringList({"/Dev1/PFI0", "/Dev1/PFI1"}));
     SET_VALUE(groupName, SETTING_BLANKING_TERMS, QStringList({"/Dev1/PFI2", "/Dev1/PFI3"}));
     SET_VALUE(groupName, SETTING_TRIGGER_TERM, "/Dev1/PFI4");
+    SET_VALUE(groupName, SETTING_TRIGGER_CALIBRATION, QVariantMap());
 
     settings.endGroup();
 
@@ -141,6 +188,12 @@ void Settings::loadSettings()
     SET_VALUE(groupName, SETTING_EXPTIME, 0.15);
     SET_VALUE(groupName, SETTING_RUN_NAME, QString());
     SET_VALUE(groupName, SETTING_BINNING, 1);
+    SET_VALUE(groupName, SETTING_SERPENTINE, false);
+    SET_VALUE(groupName, SETTING_MIP_ENABLED, false);
+    SET_VALUE(groupName, SETTING_MEAN_PROJECTION_ENABLED, false);
+    SET_VALUE(groupName, SETTING_PYRAMID_LEVELS, 0);
+    SET_VALUE(groupName, SETTING_POSITION_TRIGGER, false);
+    SET_VALUE(groupName, SETTING_PYRAMID_Z_DECIMATION, false);
 
     settings.endGroup();
 
@@ -185,6 +238,17 @@ void Settings::loadSettings()
         settings.endGroup();
     }
 
+#ifdef DEMO_MODE
+    groupName = SETTINGSGROUP_SIMULATION;
+    settings.beginGroup(groupName);
+
+    SET_VALUE(groupName, SETTING_FRAME_PATTERN, "beads");
+    SET_VALUE(groupName, SETTING_STAGE_ACCELERATION, 10.);
+    SET_VALUE(groupName, SETTING_STAGE_SETTLE_TIME, 0.02);
+
+    settings.endGroup();
+#endif
+
     //////////////////////////////////////
 
     QString group;
@@ -248,15 +312,47 @@ void Settings::loadSettings()
     ct->setPulseTerms(value(group, SETTING_PULSE_TERMS).toStringList());
     ct->setBlankingPulseTerms(value(group, SETTING_BLANKING_TERMS).toStringList());
     ct->setStartTriggerTerm(value(group, SETTING_TRIGGER_TERM).toString());
+    spim().getTriggerCalibration()->setTable(value(group, SETTING_TRIGGER_CALIBRATION).toMap());
 
     group = SETTINGSGROUP_ACQUISITION;
     spim().setExposureTime(value(group, SETTING_EXPTIME).toDouble());
     spim().setRunName(value(group, SETTING_RUN_NAME).toString());
     spim().setBinning(value(group, SETTING_BINNING).toUInt());
+    spim().setSerpentineEnabled(value(group, SETTING_SERPENTINE).toBool());
+    spim().setMIPEnabled(value(group, SETTING_MIP_ENABLED).toBool());
+    spim().setMeanProjectionEnabled(value(group, SETTING_MEAN_PROJECTION_ENABLED).toBool());
+    spim().setPyramidLevels(value(group, SETTING_PYRAMID_LEVELS).toInt());
+    spim().setPositionTriggerEnabled(value(group, SETTING_POSITION_TRIGGER).toBool());
+    spim().setPyramidZDecimationEnabled(value(group, SETTING_PYRAMID_Z_DECIMATION).toBool());
 
     group = SETTINGSGROUP_OTHERSETTINGS;
     spim().setScanVelocity(value(group, SETTING_SCANVELOCITY).toDouble());
+    spim().setFrameRingDepth(value(group, SETTING_FRAME_RING_DEPTH).toInt());
+    spim().setWriterThreads(value(group, SETTING_WRITER_THREADS).toInt());
+    spim().setZeroCopyEnabled(value(group, SETTING_ZERO_COPY).toBool());
+    spim().setIOBackend(StackWriter::backendFromName(value(group, SETTING_IO_BACKEND).toString()));
+    spim().setCompressionLevel(value(group, SETTING_COMPRESSION_LEVEL).toInt());
+    spim().setCompressionThreads(value(group, SETTING_COMPRESSION_THREADS).toInt());
+    spim().setWritebackWindow(value(group, SETTING_WRITEBACK_WINDOW).toInt());
+    spim().setWriteThroughput(value(group, SETTING_WRITE_THROUGHPUT).toDouble());
     spim().setOutputPathList(value(group, SETTING_CAM_OUTPUT_PATH_LIST).toStringList());
+    spim().setStripePathList(value(group, SETTING_CAM_STRIPE_PATH_LIST).toStringList());
+
+    ThreadPlacement &placement = ThreadPlacement::global();
+    placement.setEnabled(value(group, SETTING_THREAD_PLACEMENT).toBool());
+    placement.setCameraCpus(value(group, SETTING_CAM_CPU_LIST).toStringList());
+    placement.setDrainPolicy(
+        ThreadPlacement::policyFromName(value(group, SETTING_DRAIN_POLICY).toString()));
+    placement.setDrainPriority(value(group, SETTING_DRAIN_PRIORITY).toInt());
+
+    Telemetry::global().setPublishPath(value(group, SETTING_TELEMETRY_PATH).toString());
+
+#ifdef DEMO_MODE
+    group = SETTINGSGROUP_SIMULATION;
+    simulator().setFramePattern(value(group, SETTING_FRAME_PATTERN).toString());
+    simulator().setStageAcceleration(value(group, SETTING_STAGE_ACCELERATION).toDouble());
+    simulator().setStageSettleTime(value(group, SETTING_STAGE_SETTLE_TIME).toDouble());
+#endif
 }
 
 void Settings::saveSettings()
@@ -317,15 +413,37 @@ void Settings::saveSettings()
     setValue(group, SETTING_PULSE_TERMS, ct->getPulseTerms());
     setValue(group, SETTING_BLANKING_TERMS, ct->getBlankingPulseTerms());
     setValue(group, SETTING_TRIGGER_TERM, ct->getStartTriggerTerm());
+    setValue(group, SETTING_TRIGGER_CALIBRATION, spim().getTriggerCalibration()->getTable());
 
     group = SETTINGSGROUP_ACQUISITION;
     setValue(group, SETTING_EXPTIME, spim().getExposureTime());
     setValue(group, SETTING_RUN_NAME, spim().getRunName());
     setValue(group, SETTING_BINNING, spim().getBinning());
+    setValue(group, SETTING_SERPENTINE, spim().isSerpentineEnabled());
+    setValue(group, SETTING_MIP_ENABLED, spim().isMIPEnabled());
+    setValue(group, SETTING_MEAN_PROJECTION_ENABLED, spim().isMeanProjectionEnabled());
+    setValue(group, SETTING_PYRAMID_LEVELS, spim().getPyramidLevels());
+    setValue(group, SETTING_POSITION_TRIGGER, spim().isPositionTriggerEnabled());
+    setValue(group, SETTING_PYRAMID_Z_DECIMATION, spim().isPyramidZDecimationEnabled());
 
     group = SETTINGSGROUP_OTHERSETTINGS;
     setValue(group, SETTING_SCANVELOCITY, spim().getScanVelocity());
+    setValue(group, SETTING_FRAME_RING_DEPTH, spim().getFrameRingDepth());
+    setValue(group, SETTING_WRITER_THREADS, spim().getWriterThreads());
+    setValue(group, SETTING_ZERO_COPY, spim().isZeroCopyEnabled());
+    setValue(group, SETTING_IO_BACKEND, StackWriter::backendName(spim().getIOBackend()));
+    setValue(group, SETTING_COMPRESSION_LEVEL, spim().getCompressionLevel());
+    setValue(group, SETTING_COMPRESSION_THREADS, spim().getCompressionThreads());
+    setValue(group, SETTING_WRITEBACK_WINDOW, spim().getWritebackWindow());
+    setValue(group, SETTING_WRITE_THROUGHPUT, spim().getWriteThroughput());
     setValue(group, SETTING_CAM_OUTPUT_PATH_LIST, spim().getOutputPathList());
+    setValue(group, SETTING_CAM_STRIPE_PATH_LIST, spim().getStripePathList());
+    const ThreadPlacement &placement = ThreadPlacement::global();
+    setValue(group, SETTING_THREAD_PLACEMENT, placement.isEnabled());
+    setValue(group, SETTING_CAM_CPU_LIST, placement.getCameraCpus());
+    setValue(group, SETTING_DRAIN_POLICY, ThreadPlacement::policyName(placement.getDrainPolicy()));
+    setValue(group, SETTING_DRAIN_PRIORITY, placement.getDrainPriority());
+    setValue(group, SETTING_TELEMETRY_PATH, Telemetry::global().getPublishPath());
 
     QSettings settings;
 
@@ -11,6 +11,8 @@
 
 #define SETTING_LUTPATH "LUTPath"
 #define SETTING_CAM_OUTPUT_PATH_LIST "camOutputPathList"
+#define SETTING_CAM_STRIPE_PATH_LIST "camStripePathList"
+#define SETTING_CAM_CPU_LIST "camCpuList"
 
 #define SETTING_POS "pos"
 #define SETTING_VELOCITY "velocity"
@@ -3,8 +3,12 @@
 #include "nisettingswidget.h"
 #include "settings.h"
 #include "spim.h"
+#include "stackwriter.h"
+#include "threadplacement.h"
 #include "version.h"
 
+#include <QCheckBox>
+#include <QComboBox>
 #include <QDoubleSpinBox>
 #include <QFileDialog>
 #include <QGroupBox>
@@ -13,6 +17,7 @@
 #include <QLineEdit>
 #include <QMessageBox>
 #include <QPushButton>
+#include <QSpinBox>
 
 SettingsWidget::SettingsWidget(QWidget *parent)
     : QWidget(parent)
@@ -35,6 +40,20 @@ void SettingsWidget::setupUI()
 
     QPushButton *chooseLUTPathPushButton = new QPushButton("...");
 
+    QComboBox *ioBackendComboBox = new QComboBox();
+    ioBackendComboBox->addItems(StackWriter::backendNames());
+    ioBackendComboBox->setCurrentIndex(spim().getIOBackend());
+
+    QCheckBox *zeroCopyCheckBox = new QCheckBox("Zero-copy capture");
+    zeroCopyCheckBox->setToolTip("Write frames straight from the camera buffer");
+    zeroCopyCheckBox->setChecked(spim().isZeroCopyEnabled());
+
+    QSpinBox *writebackWindowSpinBox = new QSpinBox();
+    writebackWindowSpinBox->setRange(0, 1024);
+    writebackWindowSpinBox->setSuffix(" MB");
+    writebackWindowSpinBox->setSpecialValueText("kernel");
+    writebackWindowSpinBox->setValue(spim().getWritebackWindow());
+
     QStringList outputPath = spim().getOutputPathList();
 
     QLineEdit *leftCamPathLineEdit = new QLineEdit(outputPath.at(0));
@@ -44,6 +63,63 @@ void SettingsWidget::setupUI()
     QPushButton *chooseLeftCampPathPushButton = new QPushButton("...");
     QPushButton *chooseRightCamPathPushButton = new QPushButton("...");
 
+    // additional disks each camera's stacks are striped over
+    QStringList stripePath = spim().getStripePathList();
+    QList<QLineEdit *> stripePathLineEdits;
+    for (int i = 0; i < 2; ++i) {
+        QLineEdit *le = new QLineEdit(stripePath.value(i));
+        le->setPlaceholderText("/mnt/disk2;/mnt/disk3*2");
+        le->setToolTip("Directories the stacks are striped over, besides the camera path, "
+                       "separated by \";\", with an optional \"*weight\"");
+        connect(le, &QLineEdit::editingFinished, this, [=]() {
+            QStringList sl = spim().getStripePathList();
+            while (sl.size() <= i) {
+                sl << QString();
+            }
+            sl[i] = le->text().trimmed();
+            spim().setStripePathList(sl);
+            settings().setValue(SETTINGSGROUP_OTHERSETTINGS, SETTING_CAM_STRIPE_PATH_LIST, sl);
+        });
+        stripePathLineEdits << le;
+    }
+
+    ThreadPlacement &placement = ThreadPlacement::global();
+
+    QCheckBox *threadPlacementCheckBox = new QCheckBox("Pin acquisition threads");
+    threadPlacementCheckBox->setToolTip("Run the capture and writer threads of each camera on "
+                                        "dedicated CPUs, all other threads on the remaining ones");
+    threadPlacementCheckBox->setChecked(placement.isEnabled());
+
+    // CPUs of each camera's capture and writer threads
+    QStringList cpuList = placement.getCameraCpus();
+    QList<QLineEdit *> cpuListLineEdits;
+    for (int i = 0; i < 2; ++i) {
+        QLineEdit *le = new QLineEdit(cpuList.value(i));
+        le->setPlaceholderText("node0 or 4-7,12");
+        le->setToolTip("CPU list, \"node<n>\" for the isolated CPUs of the frame grabber's NUMA "
+                       "node, or empty for any isolated CPUs; the first one runs the capture "
+                       "thread");
+        connect(le, &QLineEdit::editingFinished, this, [=]() {
+            QStringList sl = ThreadPlacement::global().getCameraCpus();
+            while (sl.size() <= i) {
+                sl << QString();
+            }
+            sl[i] = le->text().trimmed();
+            ThreadPlacement::global().setCameraCpus(sl);
+            settings().setValue(SETTINGSGROUP_OTHERSETTINGS, SETTING_CAM_CPU_LIST, sl);
+        });
+        cpuListLineEdits << le;
+    }
+
+    QComboBox *drainPolicyComboBox = new QComboBox();
+    drainPolicyComboBox->addItems(ThreadPlacement::policyNames());
+    drainPolicyComboBox->setCurrentIndex(placement.getDrainPolicy());
+    drainPolicyComboBox->setToolTip("Scheduling policy of the capture and writer threads");
+
+    QSpinBox *drainPrioritySpinBox = new QSpinBox();
+    drainPrioritySpinBox->setRange(1, 99);
+    drainPrioritySpinBox->setValue(placement.getDrainPriority());
+
     connect(chooseLeftCampPathPushButton, &QPushButton::clicked, this, [=]() {
         QFileDialog dialog;
         dialog.setDirectory(leftCamPathLineEdit->text());
@@ -93,16 +169,54 @@ void SettingsWidget::setupUI()
         grid->addWidget(new QLabel("Scan velocity"), row, col++);
         grid->addWidget(scanVelocitySpinBox, row++, col++);
 
+        col = 0;
+        grid->addWidget(new QLabel("I/O backend"), row, col++);
+        grid->addWidget(ioBackendComboBox, row++, col++);
+
+        col = 0;
+        grid->addWidget(zeroCopyCheckBox, row++, 1);
+
+        col = 0;
+        grid->addWidget(new QLabel("Writeback window"), row, col++);
+        grid->addWidget(writebackWindowSpinBox, row++, col++);
+
         col = 0;
         grid->addWidget(new QLabel("Left camera path"), row, col++);
         grid->addWidget(leftCamPathLineEdit, row, col++);
         grid->addWidget(chooseLeftCampPathPushButton, row++, col++);
 
+        col = 0;
+        grid->addWidget(new QLabel("Left camera stripes"), row, col++);
+        grid->addWidget(stripePathLineEdits.at(0), row++, col++);
+
         col = 0;
         grid->addWidget(new QLabel("Right camera path"), row, col++);
         grid->addWidget(rightCamPathLineEdit, row, col++);
         grid->addWidget(chooseRightCamPathPushButton, row++, col++);
 
+        col = 0;
+        grid->addWidget(new QLabel("Right camera stripes"), row, col++);
+        grid->addWidget(stripePathLineEdits.at(1), row++, col++);
+
+        col = 0;
+        grid->addWidget(threadPlacementCheckBox, row++, 1);
+
+        col = 0;
+        grid->addWidget(new QLabel("Left camera CPUs"), row, col++);
+        grid->addWidget(cpuListLineEdits.at(0), row++, col++);
+
+        col = 0;
+        grid->addWidget(new QLabel("Right camera CPUs"), row, col++);
+        grid->addWidget(cpuListLineEdits.at(1), row++, col++);
+
+        col = 0;
+        grid->addWidget(new QLabel("Drain policy"), row, col++);
+        grid->addWidget(drainPolicyComboBox, row++, col++);
+
+        col = 0;
+        grid->addWidget(new QLabel("Drain priority"), row, col++);
+        grid->addWidget(drainPrioritySpinBox, row++, col++);
+
         QVBoxLayout *vLayout = new QVBoxLayout();
         vLayout->addLayout(grid);
         vLayout->addStretch();
@@ -129,6 +243,26 @@ void SettingsWidget::setupUI()
     void (QDoubleSpinBox::*mySignal)(double) = &QDoubleSpinBox::valueChanged;
     connect(scanVelocitySpinBox, mySignal, &spim(), &SPIM::setScanVelocity);
 
+    void (QComboBox::*indexChanged)(int) = &QComboBox::currentIndexChanged;
+    connect(ioBackendComboBox, indexChanged, &spim(), [=](int index) {
+        spim().setIOBackend(static_cast<StackWriter::Backend>(index));
+    });
+
+    connect(zeroCopyCheckBox, &QCheckBox::toggled, &spim(), &SPIM::setZeroCopyEnabled);
+
+    void (QSpinBox::*intValueChanged)(int) = &QSpinBox::valueChanged;
+    connect(writebackWindowSpinBox, intValueChanged, &spim(), &SPIM::setWritebackWindow);
+
+    connect(threadPlacementCheckBox, &QCheckBox::toggled, this, [=](bool checked) {
+        ThreadPlacement::global().setEnabled(checked);
+    });
+    connect(drainPolicyComboBox, indexChanged, this, [=](int index) {
+        ThreadPlacement::global().setDrainPolicy(static_cast<ThreadPlacement::Policy>(index));
+    });
+    connect(drainPrioritySpinBox, intValueChanged, this, [=](int value) {
+        ThreadPlacement::global().setDrainPriority(value);
+    });
+
     QHBoxLayout *hLayout = new QHBoxLayout();
     hLayout->addWidget(nisw);
     hLayout->addWidget(otherSettingsGB);
@@ -0,0 +1,413 @@
+#include "simulator.h"
+
+#include "spim.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <stdexcept>
+
+#include <qtlab/hw/hamamatsu/orcaflash.h>
+
+#include <QStringList>
+
+using namespace DCAM;
+
+#define SIMULATOR_BANK_SIZE 8
+
+static int64_t nowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+/* SimulatedCamera */
+
+SimulatedCamera::SimulatedCamera(int index)
+    : index(index)
+    , produced(0)
+    , capturing(false)
+    , triggering(false)
+{}
+
+SimulatedCamera::~SimulatedCamera()
+{
+    stopTrigger();
+}
+
+void SimulatedCamera::setFrameSize(int width, int height)
+{
+    if (width == this->width && height == this->height) {
+        return;
+    }
+    this->width = width;
+    this->height = height;
+    bank.clear();
+}
+
+int SimulatedCamera::getImageWidth() const
+{
+    return width;
+}
+
+int SimulatedCamera::getImageHeight() const
+{
+    return height;
+}
+
+void SimulatedCamera::setPattern(PATTERN value)
+{
+    if (value != pattern) {
+        pattern = value;
+        bank.clear();
+    }
+}
+
+void SimulatedCamera::setBufferFrames(int value)
+{
+    bufferFrames = value;
+}
+
+int32_t SimulatedCamera::nFramesInBuffer() const
+{
+    return bufferFrames;
+}
+
+int SimulatedCamera::getCameraIndex() const
+{
+    return index;
+}
+
+void SimulatedCamera::cap_start()
+{
+    stopTrigger();
+    if (bank.empty()) {
+        buildBank();
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    frameStamps.assign(static_cast<size_t>(bufferFrames), -1);
+    timeStamps.assign(static_cast<size_t>(bufferFrames), 0);
+    produced = 0;
+    waited = 0;
+    capturing = true;
+}
+
+void SimulatedCamera::cap_stop()
+{
+    stopTrigger();
+    capturing = false;
+    cv.notify_all();
+}
+
+/**
+ * @brief Starts producing \a nPulses frames (-1: until stopped) at \a rate Hz.
+ */
+void SimulatedCamera::trigger(double rate, int nPulses, const std::function<void()> &onDone)
+{
+    stopTrigger();
+    triggering = true;
+    triggerThread = std::thread(&SimulatedCamera::triggerLoop, this, rate, nPulses, onDone);
+}
+
+void SimulatedCamera::stopTrigger()
+{
+    triggering = false;
+    if (triggerThread.joinable()) {
+        triggerThread.join();
+    }
+}
+
+uint32_t SimulatedCamera::wait(int timeout, uint32_t mask)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    bool ok = cv.wait_for(lock, std::chrono::milliseconds(timeout), [&]() {
+        return !capturing || produced > waited;
+    });
+    if (!capturing && (mask & DCAMWAIT_CAPEVENT_STOPPED)) {
+        return DCAMWAIT_CAPEVENT_STOPPED;
+    }
+    if (!ok) {
+        throw std::runtime_error("Simulated camera: timeout");
+    }
+    waited++;
+    return DCAMWAIT_CAPEVENT_FRAMEREADY;
+}
+
+void SimulatedCamera::lockFrame(int32_t frame, void **buf, int32_t *frameStamp, int64_t *timeStamp)
+{
+    if (frame >= bufferFrames || produced == 0) {
+        throw std::runtime_error("Simulated camera: invalid frame");
+    }
+    if (frame < 0) {
+        frame = (produced - 1) % bufferFrames;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    int32_t stamp = frameStamps[static_cast<size_t>(frame)];
+    if (stamp < 0) {
+        throw std::runtime_error("Simulated camera: frame not ready");
+    }
+    *buf = bank[static_cast<size_t>(stamp) % bank.size()].data();
+    if (frameStamp != nullptr) {
+        *frameStamp = stamp;
+    }
+    if (timeStamp != nullptr) {
+        *timeStamp = timeStamps[static_cast<size_t>(frame)];
+    }
+}
+
+void SimulatedCamera::buildBank()
+{
+    std::mt19937 gen(static_cast<unsigned>(index + 1));
+    std::normal_distribution<double> noise(0, 1);
+    std::uniform_real_distribution<double> uniform(0, 1);
+
+    const size_t n = static_cast<size_t>(width) * height;
+    bank.assign(SIMULATOR_BANK_SIZE, std::vector<uint16_t>(n));
+
+    // bead positions are shared by all frames, their intensity depends on the z plane
+    const int nBeads = 200;
+    std::vector<double> bx(nBeads), by(nBeads), bz(nBeads);
+    for (int i = 0; i < nBeads; ++i) {
+        bx[i] = uniform(gen) * width;
+        by[i] = uniform(gen) * height;
+        bz[i] = uniform(gen) * SIMULATOR_BANK_SIZE;
+    }
+
+    for (size_t f = 0; f < bank.size(); ++f) {
+        std::vector<uint16_t> &frame = bank[f];
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                double v = 100 + 5 * noise(gen);
+                if (pattern == PATTERN_NOISE) {
+                    v = 100 + 500 * uniform(gen);
+                } else if (pattern == PATTERN_GRADIENT) {
+                    v += 1000. * (x + y + 64 * f) / (width + height);
+                }
+                frame[static_cast<size_t>(y) * width + x] = static_cast<uint16_t>(std::max(v, 0.));
+            }
+        }
+        if (pattern != PATTERN_BEADS) {
+            continue;
+        }
+        for (int i = 0; i < nBeads; ++i) {
+            double dz = bz[i] - f;
+            double peak = 4000 * exp(-dz * dz / 2);
+            for (int y = std::max(0, int(by[i]) - 6); y < std::min(height, int(by[i]) + 7); ++y) {
+                int x0 = std::max(0, int(bx[i]) - 6);
+                for (int x = x0; x < std::min(width, int(bx[i]) + 7); ++x) {
+                    double r2 = (x - bx[i]) * (x - bx[i]) + (y - by[i]) * (y - by[i]);
+                    uint16_t &p = frame[static_cast<size_t>(y) * width + x];
+                    p = static_cast<uint16_t>(std::min(65535., p + peak * exp(-r2 / 8)));
+                }
+            }
+        }
+    }
+}
+
+void SimulatedCamera::triggerLoop(double rate, int nPulses, std::function<void()> onDone)
+{
+    const auto period = std::chrono::duration<double>(1. / rate);
+    const auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; triggering && (nPulses < 0 || i < nPulses); ++i) {
+        std::this_thread::sleep_until(
+            start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(period * i));
+        if (!triggering) {
+            break;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!capturing) {
+                continue;
+            }
+            int32_t stamp = produced;
+            size_t slot = static_cast<size_t>(stamp % bufferFrames);
+            frameStamps[slot] = stamp;
+            timeStamps[slot] = nowUs();
+            produced = stamp + 1;
+        }
+        cv.notify_all();
+    }
+
+    if (triggering && onDone) {
+        onDone();
+    }
+}
+
+/* SimulatedStage */
+
+SimulatedStage::SimulatedStage()
+    : t0(std::chrono::steady_clock::now())
+{}
+
+void SimulatedStage::setVelocity(double value)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    velocity = value;
+}
+
+double SimulatedStage::getVelocity() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return velocity;
+}
+
+void SimulatedStage::setAcceleration(double value)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    acceleration = value;
+}
+
+void SimulatedStage::setSettleTime(double value)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    settleTime = value;
+}
+
+void SimulatedStage::move(double target)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    from = positionAt(t);
+    to = target;
+    t0 = std::chrono::steady_clock::now();
+
+    // trapezoidal profile, or triangular if the maximum velocity is never reached
+    double d = fabs(to - from);
+    if (d < velocity * velocity / acceleration) {
+        duration = 2 * sqrt(d / acceleration);
+    } else {
+        duration = d / velocity + velocity / acceleration;
+    }
+}
+
+void SimulatedStage::halt()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    from = to = positionAt(t);
+    duration = 0;
+    t0 = std::chrono::steady_clock::now();
+}
+
+double SimulatedStage::getPosition() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return positionAt(std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+}
+
+bool SimulatedStage::isOnTarget() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    return t >= duration + settleTime;
+}
+
+double SimulatedStage::positionAt(double t) const
+{
+    if (t >= duration || duration <= 0) {
+        return to;
+    }
+    double d = fabs(to - from);
+    double sign = to > from ? 1 : -1;
+    double tAcc = std::min(velocity / acceleration, duration / 2);
+    double vMax = acceleration * tAcc;
+    double s;
+    if (t < tAcc) {
+        s = 0.5 * acceleration * t * t;
+    } else if (t < duration - tAcc) {
+        s = 0.5 * acceleration * tAcc * tAcc + vMax * (t - tAcc);
+    } else {
+        double tr = duration - t;
+        s = d - 0.5 * acceleration * tr * tr;
+    }
+    return from + sign * s;
+}
+
+/* Simulator */
+
+Simulator::Simulator(QObject *parent)
+    : QObject(parent)
+{
+    for (int i = 0; i < SPIM_NCAMS; ++i) {
+        cameras.push_back(new SimulatedCamera(i));
+    }
+    for (int i = 0; i < SPIM_NPIDEVICES; ++i) {
+        stages.push_back(new SimulatedStage());
+    }
+}
+
+Simulator::~Simulator()
+{
+    for (SimulatedCamera *cam : cameras) {
+        delete cam;
+    }
+    for (SimulatedStage *stage : stages) {
+        delete stage;
+    }
+}
+
+SimulatedCamera *Simulator::getCamera(int n) const
+{
+    return cameras.at(static_cast<size_t>(n));
+}
+
+SimulatedStage *Simulator::getStage(int n) const
+{
+    return stages.at(static_cast<size_t>(n));
+}
+
+void Simulator::setFramePattern(const QString &name)
+{
+    int idx = QStringList({"noise", "gradient", "beads"}).indexOf(name);
+    if (idx < 0) {
+        return;
+    }
+    for (SimulatedCamera *cam : cameras) {
+        cam->setPattern(static_cast<SimulatedCamera::PATTERN>(idx));
+    }
+}
+
+void Simulator::setStageAcceleration(double value)
+{
+    for (SimulatedStage *stage : stages) {
+        stage->setAcceleration(value);
+    }
+}
+
+void Simulator::setStageSettleTime(double value)
+{
+    for (SimulatedStage *stage : stages) {
+        stage->setSettleTime(value);
+    }
+}
+
+/**
+ * @brief Simulated CameraTrigger: all cameras are triggered at \a rate Hz for \a nPulses pulses
+ * (-1: free run) and triggerDone() is emitted after the last pulse.
+ */
+void Simulator::startTrigger(double rate, int nPulses)
+{
+    for (size_t i = 0; i < cameras.size(); ++i) {
+        std::function<void()> onDone;
+        if (i == 0 && nPulses >= 0) {
+            onDone = [this]() { emit triggerDone(); };
+        }
+        cameras[i]->trigger(rate, nPulses, onDone);
+    }
+}
+
+void Simulator::stopTrigger()
+{
+    for (SimulatedCamera *cam : cameras) {
+        cam->stopTrigger();
+    }
+}
+
+Simulator &simulator()
+{
+    static auto instance = std::make_unique<Simulator>();
+    return *instance;
+}
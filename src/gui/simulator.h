@@ -0,0 +1,146 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <QObject>
+#include <QString>
+
+/**
+ * @brief Hardware-free replacement for the frame source of an OrcaFlash.
+ *
+ * Frames are produced by an internal thread at the rate of the simulated camera trigger and are
+ * stored in a ring of nFramesInBuffer() frames, with frame stamps and time stamps, so that
+ * SaveStackWorker can run the same wait/lock/validate sequence used with the real camera. Frame
+ * content is taken from a small bank of precomputed frames.
+ */
+class SimulatedCamera
+{
+public:
+    enum PATTERN : int {
+        PATTERN_NOISE,
+        PATTERN_GRADIENT,
+        PATTERN_BEADS,
+    };
+
+    explicit SimulatedCamera(int index);
+    ~SimulatedCamera();
+
+    void setFrameSize(int width, int height);
+    int getImageWidth() const;
+    int getImageHeight() const;
+
+    void setPattern(PATTERN value);
+    void setBufferFrames(int value);
+    int32_t nFramesInBuffer() const;
+    int getCameraIndex() const;
+
+    void cap_start();
+    void cap_stop();
+
+    void trigger(double rate, int nPulses, const std::function<void()> &onDone = nullptr);
+    void stopTrigger();
+
+    uint32_t wait(int timeout, uint32_t mask);
+    void lockFrame(int32_t frame, void **buf, int32_t *frameStamp, int64_t *timeStamp);
+
+    template<typename TimeStamp>
+    void lockFrame(int32_t frame, void **buf, int32_t *frameStamp, TimeStamp *timeStamp)
+    {
+        int64_t us;
+        lockFrame(frame, buf, frameStamp, &us);
+        timeStamp->sec = static_cast<decltype(timeStamp->sec)>(us / 1000000);
+        timeStamp->microsec = static_cast<decltype(timeStamp->microsec)>(us % 1000000);
+    }
+
+private:
+    int index;
+    int width = 2048;
+    int height = 2048;
+    PATTERN pattern = PATTERN_BEADS;
+    int bufferFrames = 4000;
+
+    std::vector<std::vector<uint16_t>> bank;
+    std::vector<int32_t> frameStamps;
+    std::vector<int64_t> timeStamps; // us
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::atomic<int32_t> produced;
+    int32_t waited = 0;
+    std::atomic<bool> capturing;
+    std::atomic<bool> triggering;
+    std::thread triggerThread;
+
+    void buildBank();
+    void triggerLoop(double rate, int nPulses, std::function<void()> onDone);
+};
+
+/**
+ * @brief Motion model of a PI stage: trapezoidal velocity profile plus settling time.
+ */
+class SimulatedStage
+{
+public:
+    SimulatedStage();
+
+    void setVelocity(double value);
+    double getVelocity() const;
+    void setAcceleration(double value);
+    void setSettleTime(double value); // s
+
+    void move(double target);
+    void halt();
+    double getPosition() const;
+    bool isOnTarget() const;
+
+private:
+    mutable std::mutex mutex;
+    double velocity = 1;
+    double acceleration = 10;
+    double settleTime = 0.02;
+    double from = 0;
+    double to = 0;
+    double duration = 0;
+    std::chrono::steady_clock::time_point t0;
+
+    double positionAt(double t) const;
+};
+
+/**
+ * @brief Owner of all simulated devices, used by DEMO_MODE builds.
+ */
+class Simulator : public QObject
+{
+    Q_OBJECT
+public:
+    explicit Simulator(QObject *parent = nullptr);
+    virtual ~Simulator();
+
+    SimulatedCamera *getCamera(int n) const;
+    SimulatedStage *getStage(int n) const;
+
+    void setFramePattern(const QString &name);
+    void setStageAcceleration(double value);
+    void setStageSettleTime(double value);
+
+    void startTrigger(double rate, int nPulses);
+    void stopTrigger();
+
+signals:
+    void triggerDone() const;
+
+private:
+    std::vector<SimulatedCamera *> cameras;
+    std::vector<SimulatedStage *> stages;
+};
+
+Simulator &simulator();
+
+#endif // SIMULATOR_H
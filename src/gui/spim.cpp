@@ -1,10 +1,18 @@
 #include "spim.h"
 
+#include "acquisitionplanner.h"
+#include "bufferplanner.h"
 #include "cameratrigger.h"
 #include "galvoramp.h"
+#include "initgraph.h"
+#include "motionmonitor.h"
 #include "savestackworker.h"
+#include "simulator.h"
 #include "tasks.h"
+#include "telemetry.h"
+#include "threadplacement.h"
 
+#include <algorithm>
 #include <cmath>
 #include <memory>
 
@@ -39,6 +47,7 @@ SPIM::SPIM(QObject *parent)
 
         connect(ssWorker, &SaveStackWorker::error, this, &SPIM::onError);
         connect(ssWorker, &SaveStackWorker::captureCompleted, this, &SPIM::incrementCompleted);
+        connect(ssWorker, &SaveStackWorker::stackSaved, this, &SPIM::onStackSaved);
 
         camList.insert(i, orca);
         ssWorkerList.insert(i, ssWorker);
@@ -50,16 +59,19 @@ SPIM::SPIM(QObject *parent)
     auto sender = tasks->getCameraTrigger();
     auto mySignal = &CameraTrigger::done;
 #else
-    auto sender = ssWorkerList.at(0);
-    auto mySignal = &SaveStackWorker::captureCompleted;
+    auto sender = &simulator();
+    auto mySignal = &Simulator::triggerDone;
 #endif
 
     connect(sender, mySignal, this, [=]() {
         for (SaveStackWorker *ssWorker : ssWorkerList) {
             ssWorker->signalTriggerCompletion();
         }
-        for (OrcaFlash *orca : camList) {
-            orca->cap_stop();
+        stopCameras();
+
+        // last pulse fired: head for the next tile while the current stack is being saved
+        if (!freeRun && capturing && stateMap[STATE_CAPTURE]->active()) {
+            advanceToNextTile();
         }
     });
 
@@ -105,66 +117,218 @@ SPIM::SPIM(QObject *parent)
 
 SPIM::~SPIM() {}
 
+/**
+ * @brief Opens and configures all devices.
+ *
+ * Devices are initialized concurrently as a job graph (see InitGraph): one job per camera, after
+ * the DCAM library has been initialized, one job per PI daisy chain (i.e. per serial port), and
+ * one job per laser and filter wheel. PI devices are retried up to five times. A per-device
+ * timing breakdown is logged at the end.
+ *
+ * Serial ports must be driven from the thread their device lives in: lasers are connected in
+ * their own threads, while the devices of each PI daisy chain and each filter wheel are moved to
+ * a temporary thread for the duration of the initialization.
+ */
 void SPIM::initialize()
 {
-    try {
-        logger->info("Initializing microscope");
+    logger->info("Initializing microscope");
+
+    InitGraph graph;
+
+    QList<int> requiredJobs; // failures of other devices are only reported
+    int dcamJob = graph.addJob("DCAM", [=]() {
         int nOfCameras = DCAM::init_dcam();
         if (nOfCameras < SPIM_NCAMS) {
             throw std::runtime_error(
                 QString("Found %1 of %2 cameras").arg(nOfCameras).arg(SPIM_NCAMS).toStdString());
         }
+    });
+    requiredJobs << dcamJob;
+
+    for (int i = 0; i < SPIM_NCAMS; ++i) {
+        OrcaFlash *orca = camList.at(i);
+        if (orca->isOpen()) {
+            continue;
+        }
+        requiredJobs << graph.addJob(
+            QString("Camera %1").arg(i),
+            [=]() {
+                orca->open(i);
+                orca->setSensorMode(OrcaFlash::SENSOR_MODE_PROGRESSIVE);
+                orca->setTriggerSource(OrcaFlash::TRIGGERSOURCE_EXTERNAL);
+                orca->setTriggerPolarity(OrcaFlash::POL_POSITIVE);
+                orca->setOutputTrigger(OrcaFlash::OUTPUT_TRIGGER_KIND_PROGRAMMABLE,
+                                       OrcaFlash::OUTPUT_TRIGGER_SOURCE_HSYNC,
+                                       OrcaFlash::POL_POSITIVE,
+                                       2e-6);
+                orca->setPropertyValue(DCAM::DCAM_IDPROP_READOUT_DIRECTION,
+                                       DCAM::DCAMPROP_READOUT_DIRECTION__FORWARD);
+                orca->setPropertyValue(DCAM::DCAM_IDPROP_OUTPUTTRIGGER_PREHSYNCCOUNT, 0);
+                // resized for each acquisition, see planBuffers()
+                orca->buf_alloc(BufferPlanner::DEFAULT_FRAMES);
+                orca->logInfo();
+#ifdef DEMO_MODE
+                SimulatedCamera *simCam = simulator().getCamera(i);
+                simCam->setFrameSize(orca->getImageWidth(), orca->getImageHeight());
+                simCam->setBufferFrames(BufferPlanner::DEFAULT_FRAMES);
+#endif
+            },
+            {dcamJob});
+    }
 
-        for (int i = 0; i < SPIM_NCAMS; ++i) {
-            OrcaFlash *orca = camList.at(i);
-            if (orca->isOpen()) {
-                continue;
+#ifndef DEMO_MODE
+    // devices on the same daisy chain are opened in order of device number
+    QMap<QString, QList<PIDevice *>> chains;
+
+    // devices without a thread of their own are moved to a temporary one for the initialization
+    // and handed back to their thread afterwards
+    QMap<QThread *, QList<QObject *>> initThreads;
+    QMap<QObject *, QThread *> homeThreads;
+    auto moveToInitThread = [&](const QString &name, const QList<QObject *> &objects) {
+        QThread *initThread = new QThread();
+        initThread->setObjectName(name);
+        for (QObject *obj : objects) {
+            homeThreads[obj] = obj->thread();
+            if (obj->thread() == QThread::currentThread()) {
+                obj->moveToThread(initThread);
+            } else {
+                // only the current thread of an object can push it to another one
+                runInThread(obj, [=]() { obj->moveToThread(initThread); });
             }
-            orca->open(i);
-            orca->setSensorMode(OrcaFlash::SENSOR_MODE_PROGRESSIVE);
-            orca->setTriggerSource(OrcaFlash::TRIGGERSOURCE_EXTERNAL);
-            orca->setTriggerPolarity(OrcaFlash::POL_POSITIVE);
-            orca->setOutputTrigger(OrcaFlash::OUTPUT_TRIGGER_KIND_PROGRAMMABLE,
-                                   OrcaFlash::OUTPUT_TRIGGER_SOURCE_HSYNC,
-                                   OrcaFlash::POL_POSITIVE,
-                                   2e-6);
-            orca->setPropertyValue(DCAM::DCAM_IDPROP_READOUT_DIRECTION,
-                                   DCAM::DCAMPROP_READOUT_DIRECTION__FORWARD);
-            orca->setPropertyValue(DCAM::DCAM_IDPROP_OUTPUTTRIGGER_PREHSYNCCOUNT, 0);
-            orca->buf_alloc(4000);
-            orca->logInfo();
-        }
-
-        for (int devnumber = 1; devnumber <= 16; ++devnumber) {
-            for (PIDevice *dev : piDevList) {
-                if (dev->getDeviceNumber() > devnumber) {
-                    continue;
-                }
-                if (dev->isConnected()) {
-                    continue;
-                }
-                if (dev->getPortName().isEmpty()) {
-                    continue;
-                }
-                for (int i = 0; i < 5; ++i) {
-                    try {
-                        dev->connectDevice();
-                        break;
-                    } catch (std::runtime_error) {
-                        QString msg = "Cannot open device. Attempt %1 of 5";
-                        msg = msg.arg(i + 1);
-                        logger->warning(msg);
-                        continue;
-                    }
+        }
+        initThread->start();
+        initThreads[initThread] = objects;
+    };
+    for (PIDevice *dev : piDevList) {
+        if (dev->isConnected() || dev->getPortName().isEmpty()) {
+            continue;
+        }
+        chains[dev->getPortName()] << dev;
+    }
+    for (auto it = chains.begin(); it != chains.end(); ++it) {
+        QList<PIDevice *> chain = it.value();
+        std::sort(chain.begin(), chain.end(), [](PIDevice *a, PIDevice *b) {
+            return a->getDeviceNumber() < b->getDeviceNumber();
+        });
+
+        // children cannot change thread: the devices are reparented to SPIM afterwards
+        QList<QObject *> objects;
+        for (PIDevice *dev : chain) {
+            dev->setParent(nullptr);
+            objects << dev;
+        }
+        moveToInitThread(QString("PI_thread_%1").arg(it.key()), objects);
+
+        graph.addJob(QString("PI daisy chain %1").arg(it.key()), [=]() {
+            runInThread(chain.first(), [=]() {
+                for (PIDevice *dev : chain) {
+                    connectPIDevice(dev);
                 }
+            });
+        });
+    }
+
+    for (Cobolt *cobolt : laserList) {
+        SerialPort *sp = cobolt->serialPort();
+        if (sp->isOpen() || sp->portName().isEmpty()) {
+            continue;
+        }
+        // serial ports are driven from the thread the laser lives in
+        graph.addJob(QString("Laser %1").arg(sp->portName()), [=]() {
+            runInThread(cobolt, [=]() { cobolt->connect(); });
+        });
+    }
+
+    for (FilterWheel *fw : filterWheelList) {
+        SerialPort *sp = fw->serialPort();
+        if (sp->isOpen() || sp->portName().isEmpty()) {
+            continue;
+        }
+        moveToInitThread(QString("FilterWheel_thread_%1").arg(sp->portName()), {fw});
+        graph.addJob(QString("Filter wheel %1").arg(sp->portName()), [=]() {
+            runInThread(fw, [=]() { fw->connect(); });
+        });
+    }
+#endif
+
+    bool ok = graph.run();
+#ifndef DEMO_MODE
+    // hand the devices back, whether their job ran or not, from the temporary thread
+    for (auto it = initThreads.constBegin(); it != initThreads.constEnd(); ++it) {
+        QList<QObject *> objects = it.value();
+        runInThread(objects.first(), [=]() {
+            for (QObject *obj : objects) {
+                obj->moveToThread(homeThreads.value(obj));
+            }
+        });
+        it.key()->quit();
+        it.key()->wait();
+        delete it.key();
+    }
+    for (PIDevice *dev : piDevList) {
+        dev->setParent(this);
+    }
+#endif
+    logger->info("Initialization timing:\n" + graph.report());
+
+    if (!ok) {
+        for (int job : requiredJobs) {
+            if (!graph.isDone(job)) {
+                onError(graph.errorString());
+                return;
             }
         }
+        logger->warning(graph.errorString());
+    }
 
-        emit initialized();
-        logger->info("Initialization completed");
-    } catch (std::runtime_error e) {
-        onError(e.what());
-        return;
+    emit initialized();
+    logger->info("Initialization completed");
+}
+
+/**
+ * @brief Connects \a dev, retrying up to five times, and throws if the last attempt fails.
+ *
+ * Called in the thread \a dev lives in.
+ */
+void SPIM::connectPIDevice(PIDevice *dev)
+{
+    for (int i = 1;; ++i) {
+        try {
+            dev->connectDevice();
+            return;
+        } catch (std::runtime_error e) {
+            QString msg = "Cannot open device %1. Attempt %2 of 5";
+            msg = msg.arg(dev->getVerboseName()).arg(i);
+            logger->warning(msg);
+            if (i == 5) {
+                throw std::runtime_error(QString("Cannot open device %1: %2")
+                                             .arg(dev->getVerboseName())
+                                             .arg(e.what())
+                                             .toStdString());
+            }
+        }
+    }
+}
+
+/**
+ * @brief Runs \a f in the thread of \a obj and rethrows its exception, if any, in the calling
+ * thread, which must be a different one.
+ */
+void SPIM::runInThread(QObject *obj, const std::function<void()> &f)
+{
+    QString error;
+    QMetaObject::invokeMethod(
+        obj,
+        [&]() {
+            try {
+                f();
+            } catch (std::runtime_error e) {
+                error = e.what();
+            }
+        },
+        Qt::BlockingQueuedConnection);
+    if (!error.isEmpty()) {
+        throw std::runtime_error(error.toStdString());
     }
 }
 
@@ -197,6 +361,157 @@ void SPIM::setBinning(uint value)
     binning = value;
 }
 
+int SPIM::getFrameRingDepth() const
+{
+    return frameRingDepth;
+}
+
+void SPIM::setFrameRingDepth(int value)
+{
+    frameRingDepth = value;
+}
+
+int SPIM::getWriterThreads() const
+{
+    return writerThreads;
+}
+
+void SPIM::setWriterThreads(int value)
+{
+    writerThreads = value;
+}
+
+bool SPIM::isZeroCopyEnabled() const
+{
+    return zeroCopy;
+}
+
+/**
+ * @brief Writes frames from the DCAM buffer without copying them first (see FrameLeases).
+ */
+void SPIM::setZeroCopyEnabled(bool enable)
+{
+    zeroCopy = enable;
+}
+
+StackWriter::Backend SPIM::getIOBackend() const
+{
+    return ioBackend;
+}
+
+/**
+ * @brief Sets the backend of the stack writers; a backend that is not compiled in is replaced by
+ * its fallback here, once, rather than by each writer (see StackWriter::available()).
+ */
+void SPIM::setIOBackend(StackWriter::Backend value)
+{
+    ioBackend = StackWriter::available(value);
+    if (ioBackend != value) {
+        logger->warning(QString("%1 backend not available in this build, using %2")
+                            .arg(StackWriter::backendName(value))
+                            .arg(StackWriter::backendName(ioBackend)));
+    }
+}
+
+int SPIM::getCompressionLevel() const
+{
+    return compressionLevel;
+}
+
+void SPIM::setCompressionLevel(int value)
+{
+    compressionLevel = value;
+}
+
+int SPIM::getCompressionThreads() const
+{
+    return compressionThreads;
+}
+
+void SPIM::setCompressionThreads(int value)
+{
+    compressionThreads = value;
+}
+
+int SPIM::getWritebackWindow() const
+{
+    return writebackWindow;
+}
+
+/**
+ * @brief Size in MB of the windows in which stacks are flushed to disk and dropped from the page
+ * cache while they are written, 0 to leave writeback to the kernel.
+ */
+void SPIM::setWritebackWindow(int value)
+{
+    writebackWindow = value;
+}
+
+bool SPIM::isSerpentineEnabled() const
+{
+    return serpentine;
+}
+
+void SPIM::setSerpentineEnabled(bool enable)
+{
+    serpentine = enable;
+}
+
+bool SPIM::isMIPEnabled() const
+{
+    return mipEnabled;
+}
+
+void SPIM::setMIPEnabled(bool enable)
+{
+    mipEnabled = enable;
+}
+
+bool SPIM::isMeanProjectionEnabled() const
+{
+    return meanProjectionEnabled;
+}
+
+void SPIM::setMeanProjectionEnabled(bool enable)
+{
+    meanProjectionEnabled = enable;
+}
+
+bool SPIM::isPositionTriggerEnabled() const
+{
+    return positionTrigger;
+}
+
+void SPIM::setPositionTriggerEnabled(bool enable)
+{
+    positionTrigger = enable;
+}
+
+TriggerCalibration *SPIM::getTriggerCalibration()
+{
+    return &triggerCalibration;
+}
+
+int SPIM::getPyramidLevels() const
+{
+    return pyramidLevels;
+}
+
+void SPIM::setPyramidLevels(int value)
+{
+    pyramidLevels = value;
+}
+
+bool SPIM::isPyramidZDecimationEnabled() const
+{
+    return pyramidZDecimation;
+}
+
+void SPIM::setPyramidZDecimationEnabled(bool enable)
+{
+    pyramidZDecimation = enable;
+}
+
 bool SPIM::isMosaicStageEnabled(SPIM_PI_DEVICES dev) const
 {
     return enabledMosaicStageMap[dev];
@@ -239,6 +554,12 @@ AA_MPDSnCxx *SPIM::getAOTF(int dev)
 
 void SPIM::haltStages()
 {
+#ifdef DEMO_MODE
+    for (int i = 0; i < SPIM_NPIDEVICES; ++i) {
+        simulator().getStage(i)->halt();
+    }
+    return;
+#endif
     for (PIDevice *dev : piDevList) {
         if (dev->isConnected()) {
             dev->halt();
@@ -246,6 +567,58 @@ void SPIM::haltStages()
     }
 }
 
+void SPIM::setStageVelocity(const SPIM_PI_DEVICES dev, double velocity)
+{
+#ifdef DEMO_MODE
+    simulator().getStage(dev)->setVelocity(velocity);
+#else
+    getPIDevice(dev)->setVelocity(velocity);
+#endif
+}
+
+void SPIM::moveStage(const SPIM_PI_DEVICES dev, double pos)
+{
+    logger->info(QString("Moving %1 to %2").arg(getPIDevice(dev)->getVerboseName()).arg(pos));
+    commandedPositions[dev] = pos;
+#ifdef DEMO_MODE
+    simulator().getStage(dev)->move(pos);
+#else
+    getPIDevice(dev)->move(pos);
+#endif
+}
+
+bool SPIM::isStageOnTarget(const SPIM_PI_DEVICES dev) const
+{
+#ifdef DEMO_MODE
+    return simulator().getStage(dev)->isOnTarget();
+#else
+    return getPIDevice(dev)->isOnTarget();
+#endif
+}
+
+void SPIM::startCameras()
+{
+    for (int i = 0; i < SPIM_NCAMS; ++i) {
+        camList.at(i)->cap_start();
+#ifdef DEMO_MODE
+        simulator().getCamera(i)->cap_start();
+#endif
+    }
+}
+
+void SPIM::stopCameras()
+{
+    for (int i = 0; i < SPIM_NCAMS; ++i) {
+        OrcaFlash *orca = camList.at(i);
+        if (orca->isOpen()) {
+            orca->cap_stop();
+        }
+#ifdef DEMO_MODE
+        simulator().getCamera(i)->cap_stop();
+#endif
+    }
+}
+
 void SPIM::emergencyStop()
 {
     haltStages();
@@ -339,14 +712,34 @@ void SPIM::startFreeRun()
     _startCapture();
 }
 
-void SPIM::startAcquisition()
+/**
+ * @brief Runs test stacks at the first tile to find the highest trigger rate the cameras follow
+ * without losing frames at the current exposure time and binning (see TriggerCalibration).
+ *
+ * Test stacks go through the whole acquisition pipeline and are written, overwriting each
+ * other, to a trigger_calibration directory in the output paths.
+ */
+void SPIM::startTriggerCalibration()
 {
-    freeRun = false;
-    logger->info("Start acquisition");
+    if (positionTrigger) {
+        logger->warning("Trigger calibration does not apply to position triggering");
+        return;
+    }
+    logger->info("Start trigger calibration");
+    triggerCalibration.start(exposureTime, binning);
+    calibrating = true;
+    startAcquisition();
+}
 
+/**
+ * @brief Computes the enabled mosaic stages, the number of steps along each axis and the total
+ * number of stacks from the scan ranges, and resets the tile counters.
+ */
+void SPIM::setupScan()
+{
     enabledMosaicStages.clear();
     for (const SPIM_PI_DEVICES d_enum : mosaicStages) {
-        if (enabledMosaicStageMap[d_enum]) {
+        if (enabledMosaicStageMap[d_enum] && !calibrating) {
             enabledMosaicStages << d_enum;
         }
     }
@@ -354,10 +747,7 @@ void SPIM::startAcquisition()
     QList<SPIM_PI_DEVICES> stageEnumList;
     stageEnumList << enabledMosaicStages << stackStage;
 
-    QList<PIDevice *> stageList;
     for (const SPIM_PI_DEVICES d_enum : stageEnumList) {
-        stageList << getPIDevice(d_enum);
-
         int from = static_cast<int>(scanRangeMap[d_enum]->at(SPIM_RANGE_FROM_IDX)
                                     * pow(10, SPIM_SCAN_DECIMALS));
         int to = static_cast<int>(scanRangeMap[d_enum]->at(SPIM_RANGE_TO_IDX)
@@ -377,14 +767,135 @@ void SPIM::startAcquisition()
         totalSteps *= nSteps[d_enum];
         currentSteps[d_enum] = 0;
     }
+    if (calibrating) {
+        nSteps[stackStage] = std::min(nSteps[stackStage], triggerCalibration.getTrialFrames());
+        totalSteps = TriggerCalibration::MAX_TRIALS;
+    }
+}
+
+/**
+ * @brief Dry run of the acquisition configured in the scan ranges (see AcquisitionPlanner).
+ *
+ * Tile moves are predicted by the MotionMonitor, which has learned the actual response of each
+ * axis, with the average dead time per tile of the last acquisition as a lower bound. The disk
+ * behind each output path is benchmarked. The report is logged and carried by
+ * acquisitionPlanned().
+ */
+void SPIM::planAcquisition()
+{
+    logger->info("Planning acquisition");
+    try {
+        setupScan();
+        _setExposureTime(exposureTime / 1000.);
+    } catch (std::runtime_error e) {
+        onError(e.what());
+        return;
+    }
+
+    int frames = nSteps[stackStage];
+    double pyramidFraction = 0;
+    for (int l = 1; l <= pyramidLevels; ++l) {
+        pyramidFraction += 1. / (1 << (2 * l)) / (pyramidZDecimation ? 1 << l : 1);
+    }
+
+    AcquisitionPlanner planner(SPIM_NCAMS);
+    planner.setStackFrames(frames);
+    planner.setTriggerRate(triggerRate);
+    QList<QStringList> paths;
+    QList<QVector<int>> weights;
+    for (int i = 0; i < SPIM_NCAMS; ++i) {
+        QVector<int> w;
+        paths << getStripeRoots(i, &w); // the run directories do not exist yet
+        weights << w;
+    }
+    planner.setOutputPaths(paths, weights);
+    planner.benchmarkDisks();
+
+    for (int i = 0; i < SPIM_NCAMS; ++i) {
+        OrcaFlash *orca = camList.at(i);
+        double frameBytes = 2. * (orca->getImageWidth() / binning)
+                            * (orca->getImageHeight() / binning);
+        int nProjections = (mipEnabled ? 1 : 0) + (meanProjectionEnabled ? 1 : 0);
+        planner.setFrameBytes(i, frameBytes);
+        planner.setStackBytes(i, frameBytes * (frames * (1 + pyramidFraction) + nProjections));
+    }
+
+    // DCAM buffers that planBuffers() will allocate
+    BufferPlanner bufferPlanner = makeBufferPlanner();
+    for (int i = 0; i < SPIM_NCAMS; ++i) {
+        OrcaFlash *orca = camList.at(i);
+        bufferPlanner.setFrameBytes(size_t(2) * orca->getImageWidth() * orca->getImageHeight());
+        planner.setBufferFrames(i, bufferPlanner.plan().frames);
+    }
+
+    // moves after each stack: mosaic axes to the next tile, stack axis back to its start
+    QVector<double> moves;
+    QMap<SPIM_PI_DEVICES, int> steps = currentSteps;
+    for (int k = 0; k + 1 < totalSteps; ++k) {
+        QMap<SPIM_PI_DEVICES, int> next = steps;
+        stepTile(next);
+        double t = 0;
+        for (const SPIM_PI_DEVICES d_enum : enabledMosaicStages) {
+            double step = scanRangeMap[d_enum]->at(SPIM_RANGE_STEP_IDX);
+            double distance = fabs((next[d_enum] - steps[d_enum]) * step);
+            t = std::max(t, motionMonitor->predictedDuration(d_enum, distance, scanVelocity));
+        }
+        double from = scanRangeMap[stackStage]->at(SPIM_RANGE_FROM_IDX);
+        double to = scanRangeMap[stackStage]->at(SPIM_RANGE_TO_IDX);
+        double end = isStackReversed(k) ? from : to;
+        double start = isStackReversed(k + 1) ? to : from;
+        t = std::max(t,
+                     motionMonitor->predictedDuration(stackStage, fabs(start - end), scanVelocity));
+        moves << t * 1e-3;
+        steps = next;
+    }
+    planner.setTileMoves(moves);
+    planner.setTileOverhead(overheadCount > 0 ? motionOverhead / overheadCount : 0);
+
+    planner.run();
+    QString report = planner.report();
+    if (writeThroughput > 0) {
+        report += QString("\nDCAM buffers sized for the write throughput measured on the last "
+                          "stacks (%1 MB/s per camera), not for the disk benchmark")
+                      .arg(writeThroughput / 1e6, 0, 'f', 1);
+    } else {
+        report += "\nDCAM buffers sized for an unknown write throughput (not measured yet): "
+                  "each holds a whole stack if memory allows";
+    }
+    if (ioBackend == StackWriter::BACKEND_COMPRESSED) {
+        report += "\nData volume is an upper bound: compression is not taken into account";
+    }
+    logger->info("Acquisition plan:\n" + report);
+    emit acquisitionPlanned(report);
+}
+
+void SPIM::startAcquisition()
+{
+    freeRun = false;
+    logger->info("Start acquisition");
+
+    setupScan();
     logger->info(QString("Total number of stacks to acquire: %1 (with %2 frames in each)")
                      .arg(totalSteps)
                      .arg(nSteps[stackStage]));
 
     currentStep = 0;
+    tileAdvanced = tileMoveIssued = lastStackCounted = saveFailed = false;
+    pendingSaves = 0;
+    motionOverhead = 0;
+    overheadCount = 0;
+    tileTimer.start();
+    savedFrames = 0;
+    savedBytes = 0;
+    captureTime = 0;
+    acquisitionTimer.start();
+
     // create output directories
     for (int i = 0; i < SPIM_NCAMS; ++i) {
-        getFullOutputDir(i).mkpath(".");
+        QVector<int> weights;
+        for (const QString &root : getStripeRoots(i, &weights)) {
+            fullOutputDir(root).mkpath(".");
+        }
     }
 
     _startCapture();
@@ -396,6 +907,9 @@ void SPIM::_startCapture()
 
     try {
         _setExposureTime(exposureTime / 1000.);
+        if (!freeRun) {
+            planBuffers();
+        }
     } catch (std::runtime_error e) {
         onError(e.what());
         return;
@@ -407,8 +921,9 @@ void SPIM::_startCapture()
         stateMap[STATE_CAPTURING]->setInitialState(stateMap[STATE_ACQUISITION]);
     }
 
-    tasks->clearTasks();
+    tasks->stop();
     tasks->getCameraTrigger()->setFreeRunEnabled(freeRun);
+    tasks->getCameraTrigger()->setPositionTriggerEnabled(positionTrigger && !freeRun);
     tasks->getCameraTrigger()->setNPulses(nSteps[stackStage]);
 
     emit captureStarted();
@@ -447,10 +962,7 @@ void SPIM::setupStateMachine()
     QState *freeRunState = newState(STATE_FREERUN, capturingState);
     connect(freeRunState, &QState::entered, this, [=]() {
         try {
-            for (OrcaFlash *orca : camList) {
-                orca->cap_start();
-            }
-
+            startCameras();
             tasks->start();
         } catch (std::runtime_error e) {
             onError(e.what());
@@ -459,15 +971,6 @@ void SPIM::setupStateMachine()
 
     /* acquisition to file */
 
-    QList<SPIM_PI_DEVICES> stageEnumList;
-    stageEnumList << stackStage << mosaicStages;
-    std::sort(stageEnumList.begin(), stageEnumList.end());
-
-    QList<PIDevice *> stageList;
-    for (const SPIM_PI_DEVICES d_enum : stageEnumList) {
-        stageList << getPIDevice(d_enum);
-    }
-
     QState *acquisitionState = newState(STATE_ACQUISITION, capturingState);
 
     QState *precaptureState = newState(STATE_PRECAPTURE, acquisitionState);
@@ -499,26 +1002,16 @@ void SPIM::setupStateMachine()
         camBusyState->addTransition(ssWorker, &SaveStackWorker::captureCompleted, finalState);
     }
 
-    // polling timer used to check when stages have reached target
-    QTimer *pollTimer = new QTimer(this);
-    connect(pollTimer, &QTimer::timeout, this, [=]() {
-        QList<SPIM_PI_DEVICES> myStageEnumList;
-        myStageEnumList << enabledMosaicStages << stackStage;
-        try {
-            for (const SPIM_PI_DEVICES d_enum : myStageEnumList) {
-                if (!getPIDevice(d_enum)->isOnTarget()) {
-                    return;
-                }
-            }
-        } catch (std::runtime_error e) {
-            onError(e.what());
-        }
-
-        emit onTarget();
-    });
+    // stages are on target when all axes have settled and the previous stack has been saved
+    motionMonitor = new MotionMonitor(this);
+    motionMonitor->setQueryFunction(
+        [this](int axis) { return isStageOnTarget(static_cast<SPIM_PI_DEVICES>(axis)); });
+    connect(motionMonitor, &MotionMonitor::settled, this, &SPIM::onStagesSettled);
+    connect(motionMonitor, &MotionMonitor::error, this, &SPIM::onError);
 
     connect(acquisitionState, &QState::exited, this, [=]() {
-        pollTimer->stop();
+        motionMonitor->stop();
+        waitingOnTarget = false;
         haltStages();
     });
 
@@ -529,59 +1022,23 @@ void SPIM::setupStateMachine()
         tasks->stop();
         completedJobs = successJobs = 0;
 
-        // compute target position
-        QMap<SPIM_PI_DEVICES, double> targetPositions;
-        targetPositions[stackStage] = scanRangeMap[stackStage]->at(SPIM_RANGE_FROM_IDX);
-        QList<SPIM_PI_DEVICES> myStageEnumList;
-        myStageEnumList << enabledMosaicStages << stackStage;
-        for (const SPIM_PI_DEVICES d_enum : myStageEnumList) {
-            double from = scanRangeMap[d_enum]->at(SPIM_RANGE_FROM_IDX);
-            double step = scanRangeMap[d_enum]->at(SPIM_RANGE_STEP_IDX);
-            targetPositions[d_enum] = from + currentSteps[d_enum] * step;
+        if (currentStep >= totalSteps) {
+            // last stack captured, waiting for it to be saved (see onStackSaved())
+            return;
         }
 
-        try {
-            // move stages to target position
-            for (SPIM_PI_DEVICES d_enum : myStageEnumList) {
-                PIDevice *dev = getPIDevice(d_enum);
-                dev->setVelocity(scanVelocity);
-
-                double pos = targetPositions[d_enum];
-                logger->info(QString("Moving %1 to %2").arg(dev->getVerboseName()).arg(pos));
-                dev->move(pos);
-            }
-
-            QString fname;
-            QStringList axis = {"x_", "y_", "z_"};
-            QStringList side = {"l", "r"};
-            int k = 0;
-            for (SPIM_PI_DEVICES d_enum : stageEnumList) {
-                double pos = targetPositions[d_enum];
-                fname += axis.at(k)
-                         + QString("%1").arg(pos,
-                                             (4 + SPIM_SCAN_DECIMALS),
-                                             'f',
-                                             SPIM_SCAN_DECIMALS,
-                                             '0');
-                k += 1;
-                fname += "_";
-            }
-
-            // prepare and start acquisition thread
-            for (int i = 0; i < SPIM_NCAMS; ++i) {
-                SaveStackWorker *ssWorker = ssWorkerList.at(i);
-                ssWorker->setTimeout(2 * 1e6 / getTriggerRate());
-                ssWorker->setOutputPath(getFullOutputDir(i).absolutePath());
-                ssWorker->setOutputFileName(fname + "_cam_" + side.at(i));
-                ssWorker->setFrameCount(nSteps[stackStage]);
-                ssWorker->setBinning(binning);
+        if (!tileMoveIssued) {
+            try {
+                moveToTile(currentStep);
+            } catch (std::runtime_error e) {
+                onError(e.what());
+                return;
             }
-        } catch (std::runtime_error e) {
-            onError(e.what());
-            return;
         }
 
-        pollTimer->start(200);
+        // the stages may have settled already while the previous stack was being captured
+        waitingOnTarget = true;
+        QTimer::singleShot(0, this, &SPIM::tryEmitOnTarget);
     });
 
     // when stage is on target: start cameras, galvos and trigger
@@ -591,26 +1048,63 @@ void SPIM::setupStateMachine()
         &QState::entered,
         this,
         [=] {
-            pollTimer->stop();
+            waitingOnTarget = false;
+            tileAdvanced = tileMoveIssued = lastStackCounted = saveFailed = false;
+            acquiredSteps = currentSteps;
 
             try {
+                // prepare acquisition threads (the previous stack has been saved already)
+                ThreadPlacement::global().placeBackgroundThreads();
+                QStringList side = {"l", "r"};
+                for (int i = 0; i < SPIM_NCAMS; ++i) {
+                    SaveStackWorker *ssWorker = ssWorkerList.at(i);
+                    ssWorker->setTimeout(2 * 1e6 / getTriggerRate());
+                    ssWorker->setOutputPath(getFullOutputDir(i).absolutePath());
+                    ssWorker->setOutputFileName(tileFileName + "_cam_" + side.at(i));
+                    ssWorker->setFrameCount(nSteps[stackStage]);
+                    ssWorker->setBinning(binning);
+                    ssWorker->setRingDepth(frameRingDepth);
+                    ssWorker->setWriterThreads(writerThreads);
+                    ssWorker->setZeroCopy(zeroCopy);
+                    ssWorker->setIOBackend(ioBackend);
+                    ssWorker->setCompression(compressionLevel, compressionThreads);
+                    ssWorker->setWritebackWindow(static_cast<size_t>(writebackWindow) << 20);
+                    QVector<int> weights;
+                    QStringList stripeDirs;
+                    for (const QString &root : getStripeRoots(i, &weights)) {
+                        stripeDirs << fullOutputDir(root).absolutePath();
+                    }
+                    ssWorker->setStripes(stripeDirs, weights);
+                    ssWorker->setReversed(isStackReversed(currentStep));
+                    ssWorker->setProjections(mipEnabled, meanProjectionEnabled);
+                    ssWorker->setPyramid(pyramidLevels, pyramidZDecimation);
+                }
+
                 // move stack axis to end position
-                double stackTo = scanRangeMap[stackStage]->at(SPIM_RANGE_TO_IDX);
+                double stackFrom, stackTo;
+                stackEnds(currentStep, &stackFrom, &stackTo);
+                stackTo += stackOvertravel(currentStep);
                 double stackStep = scanRangeMap[stackStage]->at(SPIM_RANGE_STEP_IDX);
+                if (calibrating) {
+                    // test stacks only cover their first planes
+                    stackTo = scanRangeMap[stackStage]->at(SPIM_RANGE_FROM_IDX)
+                              + nSteps[stackStage] * stackStep;
+                }
 
-                PIDevice *dev = getPIDevice(stackStage);
-                dev->setVelocity(triggerRate * stackStep);
+                setupStageTrigger(currentStep);
+                setStageVelocity(stackStage, triggerRate * stackStep);
                 logger->info(QString("Start acquisition of stack: %1/%2")
                                  .arg(currentStep + 1)
                                  .arg(totalSteps));
-                logger->info(QString("Moving %1 to %2").arg(dev->getVerboseName()).arg(stackTo));
 
+                startCameras();
+                pendingSaves = SPIM_NCAMS;
                 for (int i = 0; i < SPIM_NCAMS; ++i) {
-                    camList.at(i)->cap_start();
                     QMetaObject::invokeMethod(ssWorkerList.at(i), &SaveStackWorker::start);
                 }
+                captureTimer.start();
                 tasks->start();
-                dev->move(stackTo);
+                moveStage(stackStage, stackTo);
             } catch (std::runtime_error e) {
                 onError(e.what());
                 return;
@@ -632,17 +1126,21 @@ void SPIM::stop()
         for (SaveStackWorker *ssWorker : ssWorkerList) {
             ssWorker->stop();
         }
-        for (OrcaFlash *orca : camList) {
-            if (orca->isOpen()) {
-                orca->cap_stop();
-            }
-        }
-        tasks->clearTasks();
+        stopCameras();
+        tasks->stop(); // tasks stay committed for the next acquisition
     } catch (std::runtime_error e) {
         emit error(e.what());
         return;
     }
 
+    if (!freeRun) {
+        logThroughputReport();
+    }
+    if (calibrating) {
+        calibrating = false;
+        triggerCalibration.abort(); // no-op if the search is over
+    }
+
     emit stopped();
 }
 
@@ -675,13 +1173,18 @@ void SPIM::_setExposureTime(double expTime)
         double sampRate = 1 / lineInterval;
 
         double frameRate = 1 / (expTime + (nOfLines + 10) * lineInterval);
-        double fraction = 0.95;
+        // with position triggering the stage velocity sets the pulse rate, so it keeps the same
+        // margin below the frame rate as the timed pulse train
+        double fraction = calibrating ? triggerCalibration.getCurrentFraction()
+                                      : triggerCalibration.getFraction(exposureTime, binning);
         triggerRate = fraction * frameRate;
 
         logger->info(QString("Exposure time: %1 ms").arg(expTime * 1000));
         logger->info(QString("Line interval: %1 us").arg(lineInterval));
         logger->info(QString("Achievable frame rate: %1 Hz").arg(frameRate));
-        logger->info(QString("Acquisition rate: %1 Hz").arg(triggerRate));
+        logger->info(QString("Acquisition rate: %1 Hz (%2 of frame rate)")
+                         .arg(triggerRate)
+                         .arg(fraction, 0, 'f', 3));
 
         uint64_t nSamples = static_cast<uint64_t>(sampRate / triggerRate);
 
@@ -707,36 +1210,496 @@ void SPIM::incrementCompleted(bool ok)
         tasks->stop();
     }
     if (++completedJobs == SPIM_NCAMS) {
+        if (positionTrigger) {
+            // no "done" from the retriggerable camera trigger: stop here
+            stopCameras();
+        }
+        if (calibrating) {
+            onCalibrationStackCompleted();
+            return;
+        }
         if (successJobs == SPIM_NCAMS) {
             currentStep++;
+            captureTime += captureTimer.nsecsElapsed() * 1e-9;
+            lastStackFrames = 0;
+            lastStackBytes = 0;
+            for (int i = 0; i < SPIM_NCAMS; ++i) {
+                OrcaFlash *orca = camList.at(i);
+                qint64 frames = ssWorkerList.at(i)->getReadFrames();
+                lastStackFrames += frames;
+                lastStackBytes += 2. * frames * (orca->getImageWidth() / binning)
+                                  * (orca->getImageHeight() / binning);
+            }
+            savedFrames += lastStackFrames;
+            savedBytes += lastStackBytes;
+            lastStackCounted = true;
+
+            // no-op if the stages already left on trigger completion
+            advanceToNextTile();
 
             // check exit condition
-            if (currentStep >= totalSteps) {
+            if (currentStep >= totalSteps && pendingSaves == 0) {
                 logger->info("Acquisition completed");
                 stop();
                 return;
             }
-
-            SPIM_PI_DEVICES xAxis = enabledMosaicStages.at(0);
-
-            int newX = currentSteps[xAxis] + 1;
-            if (newX >= nSteps[xAxis]) {
-                newX = 0;
-                if (enabledMosaicStages.size() > 1) {
-                    SPIM_PI_DEVICES yAxis = enabledMosaicStages.at(1);
-                    currentSteps[yAxis]++;
-                }
-            }
-            currentSteps[xAxis] = newX;
         } else if (capturing) { // if not stopped
+            // go back to the tile of the failed stack
+            currentSteps = acquiredSteps;
+            tileAdvanced = true;
+            tileMoveIssued = false;
             logger->warning(
                 QString("Re-acquiring stack: %1/%2").arg(currentStep + 1).arg(totalSteps));
         }
         logger->info(QString("Success jobs: %1/%2").arg(successJobs).arg(SPIM_NCAMS));
+        tileTimer.start();
         emit jobsCompleted();
     }
 }
 
+/**
+ * @brief Feeds the outcome of a test stack to the trigger calibration and starts the next one
+ * at the fraction it picks, or stops when the search is over.
+ *
+ * Stacks with lost frames are not acquired again: they are the unstable trials of the search.
+ */
+void SPIM::onCalibrationStackCompleted()
+{
+    double maxInterval = 0;
+    for (SaveStackWorker *ssWorker : ssWorkerList) {
+        maxInterval = std::max(maxInterval, ssWorker->getMaxFrameInterval());
+    }
+    bool done = triggerCalibration.addTrial(successJobs == SPIM_NCAMS, maxInterval, triggerRate);
+    currentStep++;
+    if (done || !capturing) {
+        stop();
+        return;
+    }
+
+    try {
+        _setExposureTime(exposureTime / 1000.);
+    } catch (std::runtime_error e) {
+        onError(e.what());
+        return;
+    }
+
+    // every test stack is acquired at the first tile
+    tileMoveIssued = false;
+    tileTimer.start();
+    emit jobsCompleted();
+}
+
+/**
+ * @brief Called when a SaveStackWorker has finished writing its stack to disk.
+ *
+ * Stacks that were captured correctly but could not be saved are acquired again: the tile
+ * counters are rolled back and the stages are sent back to the tile of the failed stack.
+ */
+void SPIM::onStackSaved(bool ok)
+{
+    if (freeRun || !capturing || pendingSaves == 0) {
+        return;
+    }
+    if (!ok) {
+        saveFailed = true;
+    }
+    if (--pendingSaves > 0) {
+        return;
+    }
+    updateWriteThroughput();
+    if (ThreadPlacement::global().isEnabled()) {
+        logger->info(ThreadPlacement::global().backgroundReport());
+    }
+
+    if (saveFailed && lastStackCounted) {
+        saveFailed = lastStackCounted = false;
+        currentStep--;
+        savedFrames -= lastStackFrames;
+        savedBytes -= lastStackBytes;
+        currentSteps = acquiredSteps;
+        logger->warning(QString("Cannot save stack, re-acquiring stack: %1/%2")
+                            .arg(currentStep + 1)
+                            .arg(totalSteps));
+        try {
+            moveToTile(currentStep);
+        } catch (std::runtime_error e) {
+            onError(e.what());
+            return;
+        }
+        waitingOnTarget = true;
+        return;
+    }
+
+    tryEmitOnTarget();
+
+    if (currentStep >= totalSteps) {
+        logger->info("Acquisition completed");
+        stop();
+    }
+}
+
+void SPIM::onStagesSettled(const QMap<int, double> &times)
+{
+    settleTimes = times;
+    stagesSettled = true;
+    Telemetry::global().setSettleTimes(times);
+    tryEmitOnTarget();
+}
+
+/**
+ * @brief Emits onTarget() once the stages have settled on the new tile and the previous stack
+ * has been saved, and logs the dead time between the two stacks.
+ */
+void SPIM::tryEmitOnTarget()
+{
+    if (!waitingOnTarget || !stagesSettled || pendingSaves > 0) {
+        return;
+    }
+    waitingOnTarget = false;
+
+    double overhead = tileTimer.nsecsElapsed() * 1e-6;
+    motionOverhead += overhead * 1e-3;
+    overheadCount++;
+
+    QStringList axes;
+    for (auto it = settleTimes.constBegin(); it != settleTimes.constEnd(); ++it) {
+        axes << QString("%1 %2 ms")
+                    .arg(getPIDevice(it.key())->getVerboseName())
+                    .arg(it.value(), 0, 'f', 1);
+    }
+    logger->info(QString("Motion overhead: %1 ms (settle times: %2)")
+                     .arg(overhead, 0, 'f', 1)
+                     .arg(axes.join(", ")));
+
+    emit onTarget();
+}
+
+/**
+ * @brief Advances the mosaic counters to the tile following the stack being acquired and starts
+ * moving the stages there.
+ */
+void SPIM::advanceToNextTile()
+{
+    if (tileAdvanced || calibrating) {
+        return;
+    }
+    tileAdvanced = true;
+    int nextStack = currentStep + (lastStackCounted ? 0 : 1);
+    if (nextStack >= totalSteps) {
+        return; // last stack: nowhere to go
+    }
+
+    stepTile(currentSteps);
+
+    try {
+        moveToTile(nextStack);
+    } catch (std::runtime_error e) {
+        onError(e.what());
+    }
+}
+
+/**
+ * @brief Advances the mosaic counters \a steps to the next tile.
+ */
+void SPIM::stepTile(QMap<SPIM_PI_DEVICES, int> &steps) const
+{
+    SPIM_PI_DEVICES xAxis = enabledMosaicStages.at(0);
+    bool hasYAxis = enabledMosaicStages.size() > 1;
+    SPIM_PI_DEVICES yAxis = hasYAxis ? enabledMosaicStages.at(1) : xAxis;
+
+    // serpentine: odd rows are traversed backwards, so that the next row starts where the
+    // previous one ended
+    bool backwards = serpentine && hasYAxis && steps[yAxis] % 2;
+    int newX = steps[xAxis] + (backwards ? -1 : 1);
+    if (newX < 0 || newX >= nSteps[xAxis]) {
+        newX = serpentine ? steps[xAxis] : 0;
+        if (hasYAxis) {
+            steps[yAxis]++;
+        }
+    }
+    steps[xAxis] = newX;
+}
+
+/**
+ * @brief Moves mosaic stages and stack stage to the start position of the tile given by
+ * currentSteps and computes the corresponding output file name.
+ *
+ * \a stackIndex is the acquisition index of the stack that will be acquired at this tile, which
+ * determines the scan direction in serpentine mode.
+ */
+void SPIM::moveToTile(int stackIndex)
+{
+    QList<SPIM_PI_DEVICES> stageEnumList;
+    stageEnumList << stackStage << mosaicStages;
+    std::sort(stageEnumList.begin(), stageEnumList.end());
+
+    // compute target position
+    QMap<SPIM_PI_DEVICES, double> targetPositions;
+    targetPositions[stackStage] = scanRangeMap[stackStage]->at(SPIM_RANGE_FROM_IDX);
+    for (const SPIM_PI_DEVICES d_enum : enabledMosaicStages) {
+        double from = scanRangeMap[d_enum]->at(SPIM_RANGE_FROM_IDX);
+        double step = scanRangeMap[d_enum]->at(SPIM_RANGE_STEP_IDX);
+        targetPositions[d_enum] = from + currentSteps[d_enum] * step;
+    }
+
+    // file names always refer to the "from" end of the stack
+    QString fname;
+    QStringList axis = {"x_", "y_", "z_"};
+    int k = 0;
+    for (SPIM_PI_DEVICES d_enum : stageEnumList) {
+        double pos = targetPositions[d_enum];
+        fname += axis.at(k)
+                 + QString("%1").arg(pos, (4 + SPIM_SCAN_DECIMALS), 'f', SPIM_SCAN_DECIMALS, '0');
+        k += 1;
+        fname += "_";
+    }
+
+    double stackTo;
+    stackEnds(stackIndex, &targetPositions[stackStage], &stackTo);
+    targetPositions[stackStage] -= stackOvertravel(stackIndex);
+
+    // move stages to target position
+    QList<SPIM_PI_DEVICES> myStageEnumList;
+    myStageEnumList << enabledMosaicStages << stackStage;
+    motionMonitor->clear();
+    stagesSettled = false;
+    for (SPIM_PI_DEVICES d_enum : myStageEnumList) {
+        double pos = targetPositions[d_enum];
+        double distance = fabs(pos - commandedPositions.value(d_enum, pos));
+        setStageVelocity(d_enum, scanVelocity);
+        moveStage(d_enum, pos);
+        motionMonitor->addMove(d_enum, distance, scanVelocity);
+    }
+    motionMonitor->start();
+    tileMoveIssued = true;
+
+    tileFileName = fname;
+}
+
+/**
+ * @brief In serpentine mode odd stacks are acquired from "to" to "from".
+ */
+bool SPIM::isStackReversed(int stackIndex) const
+{
+    return serpentine && !calibrating && stackIndex % 2;
+}
+
+/**
+ * @brief Distance the stack stage travels beyond each end of the stack, signed along the scan
+ * direction of stack \a stackIndex.
+ *
+ * In position trigger mode the stage starts one step before the first plane and stops one step
+ * after the last one (see stackEnds()), so that the position pulses at both ends are emitted
+ * while in motion.
+ */
+double SPIM::stackOvertravel(int stackIndex) const
+{
+    if (!positionTrigger) {
+        return 0;
+    }
+    double from = scanRangeMap[stackStage]->at(SPIM_RANGE_FROM_IDX);
+    double to = scanRangeMap[stackStage]->at(SPIM_RANGE_TO_IDX);
+    double step = fabs(scanRangeMap[stackStage]->at(SPIM_RANGE_STEP_IDX));
+    double dir = to >= from ? 1 : -1;
+    return isStackReversed(stackIndex) ? -dir * step : dir * step;
+}
+
+/**
+ * @brief Positions of the first and last plane of stack \a stackIndex, in scan order.
+ *
+ * In position trigger mode the last plane is nSteps - 1 steps past "from", which falls short of
+ * "to" when the range is not a multiple of the step, so that the controller emits exactly as many
+ * pulses as the cameras expect frames. Otherwise these are the ends of the scan range.
+ */
+void SPIM::stackEnds(int stackIndex, double *first, double *last) const
+{
+    double from = scanRangeMap[stackStage]->at(SPIM_RANGE_FROM_IDX);
+    double to = scanRangeMap[stackStage]->at(SPIM_RANGE_TO_IDX);
+    if (positionTrigger) {
+        double step = fabs(scanRangeMap[stackStage]->at(SPIM_RANGE_STEP_IDX));
+        int planes = std::max(nSteps[stackStage] - 1, 0);
+        to = from + (to >= from ? 1 : -1) * planes * step;
+    }
+    bool reversed = isStackReversed(stackIndex);
+    *first = reversed ? to : from;
+    *last = reversed ? from : to;
+}
+
+/**
+ * @brief Configures trigger output 1 of the stack stage controller.
+ *
+ * In position trigger mode the controller emits a pulse every step between the first and the
+ * last plane of the stack (PositionDistance mode), otherwise it signals motion (InMotion mode),
+ * which starts the timed pulse train of CameraTrigger.
+ */
+void SPIM::setupStageTrigger(int stackIndex)
+{
+#ifndef DEMO_MODE
+    PIDevice *dev = getPIDevice(stackStage);
+    if (!positionTrigger) {
+        if (stageTriggerArmed) {
+            dev->setTriggerOutput(PIDevice::OUTPUT_1, PIDevice::TriggerMode, PIDevice::InMotion);
+            stageTriggerArmed = false;
+        }
+        return;
+    }
+
+    double first, last;
+    stackEnds(stackIndex, &first, &last);
+    double step = fabs(scanRangeMap[stackStage]->at(SPIM_RANGE_STEP_IDX));
+
+    // GCS CTO parameters 1 (TriggerStep), 8 (StartThreshold), 9 (StopThreshold), mode 0
+    dev->setTriggerOutput(PIDevice::OUTPUT_1, PIDevice::TriggerStep, step);
+    dev->setTriggerOutput(PIDevice::OUTPUT_1, PIDevice::StartThreshold, first);
+    dev->setTriggerOutput(PIDevice::OUTPUT_1, PIDevice::StopThreshold, last);
+    dev->setTriggerOutput(PIDevice::OUTPUT_1, PIDevice::TriggerMode, PIDevice::PositionDistance);
+    stageTriggerArmed = true;
+#else
+    Q_UNUSED(stackIndex)
+#endif
+}
+
+/**
+ * @brief BufferPlanner for the acquisition set up by setupScan(), frame size excepted: shared by
+ * planBuffers() and the dry run of planAcquisition(), so that both size the buffers alike.
+ */
+BufferPlanner SPIM::makeBufferPlanner() const
+{
+    // buffers are released before being reallocated: their memory is available too
+    size_t available = BufferPlanner::availableMemory();
+    for (OrcaFlash *orca : camList) {
+        available += size_t(orca->nFramesInBuffer()) * 2 * orca->getImageWidth()
+                     * orca->getImageHeight();
+    }
+
+    BufferPlanner planner;
+    planner.setAvailableMemory(available);
+    planner.setCameraCount(SPIM_NCAMS);
+    planner.setFramesPerStack(nSteps[stackStage]);
+    planner.setTriggerRate(triggerRate);
+    planner.setBinning(binning);
+    planner.setWriteThroughput(writeThroughput);
+    return planner;
+}
+
+/**
+ * @brief Resizes the DCAM buffer of each camera for the acquisition about to start (see
+ * BufferPlanner) and warns if it cannot absorb the difference between trigger rate and write
+ * rate over a whole stack. Throws if there is not even room for BufferPlanner::MIN_FRAMES frames
+ * (or for a whole stack, if shorter).
+ *
+ * Buffers are only reallocated when their size changes.
+ */
+void SPIM::planBuffers()
+{
+    BufferPlanner planner = makeBufferPlanner();
+
+    // all plans are checked before any buffer is released
+    QVector<BufferPlanner::Plan> plans;
+    for (int i = 0; i < SPIM_NCAMS; ++i) {
+        OrcaFlash *orca = camList.at(i);
+        size_t frameBytes = size_t(2) * orca->getImageWidth() * orca->getImageHeight();
+        planner.setFrameBytes(frameBytes);
+        BufferPlanner::Plan plan = planner.plan();
+        int minFrames = std::min<int>(BufferPlanner::MIN_FRAMES, plan.neededFrames);
+        if (plan.frames < minFrames) {
+            throw std::runtime_error(QString("Camera %1: not enough memory for the DCAM buffer "
+                                             "(room for %2 frames of %3 MB, at least %4 needed)")
+                                         .arg(i)
+                                         .arg(plan.frames)
+                                         .arg(frameBytes / 1e6, 0, 'f', 1)
+                                         .arg(minFrames)
+                                         .toStdString());
+        }
+        plans << plan;
+    }
+
+    for (int i = 0; i < SPIM_NCAMS; ++i) {
+        OrcaFlash *orca = camList.at(i);
+        planner.setFrameBytes(size_t(2) * orca->getImageWidth() * orca->getImageHeight());
+        const BufferPlanner::Plan &plan = plans.at(i);
+        logger->info(QString("Camera %1 buffer: %2").arg(i).arg(planner.describe(plan)));
+        if (!plan.sustainable && plan.fillTime >= 0) {
+            logger->warning(QString("Camera %1: not enough memory to sustain %2 Hz: frames will "
+                                    "be lost after %3 s")
+                                .arg(i)
+                                .arg(triggerRate, 0, 'f', 1)
+                                .arg(plan.fillTime, 0, 'f', 1));
+        } else if (!plan.sustainable) {
+            logger->warning(QString("Camera %1: write throughput not measured yet and the buffer "
+                                    "cannot hold a whole stack: frames may be lost")
+                                .arg(i));
+        }
+        if (plan.frames == orca->nFramesInBuffer()) {
+            continue;
+        }
+        orca->buf_release();
+        orca->buf_alloc(plan.frames);
+#ifdef DEMO_MODE
+        simulator().getCamera(i)->setBufferFrames(plan.frames);
+#endif
+    }
+}
+
+/**
+ * @brief Updates the write throughput with the one the slowest camera sustained on the last
+ * stack (moving average).
+ */
+void SPIM::updateWriteThroughput()
+{
+    double measured = 0;
+    for (SaveStackWorker *ssWorker : ssWorkerList) {
+        double t = ssWorker->getWriteThroughput();
+        if (t <= 0) {
+            return;
+        }
+        measured = measured == 0 ? t : std::min(measured, t);
+    }
+    writeThroughput = writeThroughput > 0 ? 0.7 * writeThroughput + 0.3 * measured : measured;
+}
+
+double SPIM::getWriteThroughput() const
+{
+    return writeThroughput;
+}
+
+void SPIM::setWriteThroughput(double value)
+{
+    writeThroughput = value;
+}
+
+/**
+ * @brief Logs frames and bytes saved, average rates and the fraction of time spent outside
+ * stack capture (stage moves, writer flush, ...).
+ */
+void SPIM::logThroughputReport()
+{
+    if (!acquisitionTimer.isValid()) {
+        return;
+    }
+    double elapsed = acquisitionTimer.nsecsElapsed() * 1e-9;
+    acquisitionTimer.invalidate();
+    if (elapsed <= 0) {
+        return;
+    }
+
+    logger->info(QString("Throughput: %1/%2 stacks, %3 frames, %4 GB in %5 s")
+                     .arg(currentStep)
+                     .arg(totalSteps)
+                     .arg(savedFrames)
+                     .arg(savedBytes / 1e9, 0, 'f', 2)
+                     .arg(elapsed, 0, 'f', 1));
+    logger->info(QString("Throughput: %1 frames/s, %2 MB/s, %3 s/stack, dead time %4%")
+                     .arg(savedFrames / elapsed, 0, 'f', 1)
+                     .arg(savedBytes / elapsed / 1e6, 0, 'f', 1)
+                     .arg(currentStep > 0 ? elapsed / currentStep : 0., 0, 'f', 2)
+                     .arg(100 * (1 - captureTime / elapsed), 0, 'f', 1));
+    if (overheadCount > 0) {
+        logger->info(QString("Throughput: average motion overhead %1 ms/stack")
+                         .arg(1000 * motionOverhead / overheadCount, 0, 'f', 1));
+    }
+}
+
 QStringList SPIM::getOutputPathList() const
 {
     return outputPath;
@@ -775,7 +1738,64 @@ void SPIM::onError(const QString &errMsg)
 
 QDir SPIM::getFullOutputDir(int cam)
 {
-    return QDir::cleanPath(outputPath.at(cam) + QDir::separator() + runName);
+    return fullOutputDir(outputPath.at(cam));
+}
+
+/**
+ * @brief Directory of the current run under the output root \a root.
+ */
+QDir SPIM::fullOutputDir(const QString &root) const
+{
+    if (calibrating) {
+        return QDir::cleanPath(root + QDir::separator() + "trigger_calibration");
+    }
+    return QDir::cleanPath(root + QDir::separator() + runName);
+}
+
+QStringList SPIM::getStripePathList() const
+{
+    return stripePath;
+}
+
+/**
+ * @brief Sets, for each camera, the additional output roots its stacks are striped over: a list
+ * of "dir" or "dir*weight" separated by ";" (see getStripeRoots()). Empty to disable striping.
+ */
+void SPIM::setStripePathList(const QStringList &sl)
+{
+    stripePath = sl;
+}
+
+/**
+ * @brief Output roots of camera \a cam: its output path followed by its stripe paths, with the
+ * weight of each one in \a weights. The output path has weight 1 unless it is listed among the
+ * stripe paths with a different weight.
+ */
+QStringList SPIM::getStripeRoots(int cam, QVector<int> *weights) const
+{
+    QStringList roots = {QDir::cleanPath(outputPath.at(cam))};
+    *weights = {1};
+    for (const QString &entry : stripePath.value(cam).split(';', QString::SkipEmptyParts)) {
+        QString dir = entry.trimmed();
+        int weight = 1;
+        int star = dir.lastIndexOf('*');
+        if (star >= 0) {
+            weight = std::max(dir.mid(star + 1).toInt(), 1);
+            dir = dir.left(star).trimmed();
+        }
+        if (dir.isEmpty()) {
+            continue;
+        }
+        dir = QDir::cleanPath(dir);
+        int i = roots.indexOf(dir);
+        if (i < 0) {
+            roots << dir;
+            *weights << weight;
+        } else {
+            (*weights)[i] = weight;
+        }
+    }
+    return roots;
 }
 
 SPIM &spim()
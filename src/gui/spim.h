@@ -1,11 +1,19 @@
 #ifndef SPIMHUB_H
 #define SPIMHUB_H
 
+#include "bufferplanner.h"
+#include "stackwriter.h"
+#include "triggercalibration.h"
+
 #include <QDir>
+#include <QElapsedTimer>
 #include <QMap>
 #include <QObject>
 #include <QStateMachine>
 #include <QThread>
+#include <QVector>
+
+#include <functional>
 
 #ifndef SPIM_NCAMS
 #define SPIM_NCAMS 2
@@ -33,6 +41,7 @@ class Cobolt;
 class FilterWheel;
 class AA_MPDSnCxx;
 class Tasks;
+class MotionMonitor;
 
 enum SPIM_PI_DEVICES : int {
     PI_DEVICE_X_AXIS,
@@ -89,6 +98,10 @@ public:
     QStringList getOutputPathList() const;
     void setOutputPathList(const QStringList &sl);
 
+    QStringList getStripePathList() const;
+    void setStripePathList(const QStringList &sl);
+    QStringList getStripeRoots(int cam, QVector<int> *weights) const;
+
     QState *getState(const MACHINE_STATE stateEnum);
 
     int getCurrentStep() const;
@@ -115,9 +128,55 @@ public:
     int getBinning() const;
     void setBinning(uint value);
 
+    int getFrameRingDepth() const;
+    void setFrameRingDepth(int value);
+
+    int getWriterThreads() const;
+    void setWriterThreads(int value);
+
+    bool isZeroCopyEnabled() const;
+    void setZeroCopyEnabled(bool enable);
+
+    StackWriter::Backend getIOBackend() const;
+    void setIOBackend(StackWriter::Backend value);
+
+    int getCompressionLevel() const;
+    void setCompressionLevel(int value);
+
+    int getCompressionThreads() const;
+    void setCompressionThreads(int value);
+
+    int getWritebackWindow() const;
+    void setWritebackWindow(int value);
+
+    bool isSerpentineEnabled() const;
+    void setSerpentineEnabled(bool enable);
+
+    bool isMIPEnabled() const;
+    void setMIPEnabled(bool enable);
+
+    bool isMeanProjectionEnabled() const;
+    void setMeanProjectionEnabled(bool enable);
+
+    bool isPositionTriggerEnabled() const;
+    void setPositionTriggerEnabled(bool enable);
+
+    int getPyramidLevels() const;
+    void setPyramidLevels(int value);
+
+    bool isPyramidZDecimationEnabled() const;
+    void setPyramidZDecimationEnabled(bool enable);
+
+    TriggerCalibration *getTriggerCalibration();
+
+    double getWriteThroughput() const;
+    void setWriteThroughput(double value);
+
 public slots:
     void startFreeRun();
     void startAcquisition();
+    void startTriggerCalibration();
+    void planAcquisition();
     void stop();
     void haltStages();
     void emergencyStop();
@@ -131,6 +190,7 @@ signals:
     void jobsCompleted() const;
     void error(const QString) const;
     void onTarget();
+    void acquisitionPlanned(const QString &report) const;
 
 private:
     Tasks *tasks;
@@ -138,6 +198,13 @@ private:
     double exposureTime; // in ms
     double triggerRate;
     int binning = 1;
+    int frameRingDepth = 32;
+    int writerThreads = 1;
+    bool zeroCopy = false;
+    StackWriter::Backend ioBackend = StackWriter::BACKEND_BUFFERED;
+    int compressionLevel = 1;
+    int compressionThreads = 4; // per camera
+    int writebackWindow = 32;   // MB, 0 = page cache writeback left to the kernel
 
     QList<PIDevice *> piDevList;
     QList<OrcaFlash *> camList;
@@ -148,6 +215,8 @@ private:
 
     QStateMachine *sm = nullptr;
 
+    double writeThroughput = 0; // bytes/s per camera, measured on the last stacks, 0 = unknown
+
     SPIM_PI_DEVICES stackStage;
     QList<SPIM_PI_DEVICES> mosaicStages;
     QList<SPIM_PI_DEVICES> enabledMosaicStages;
@@ -159,23 +228,90 @@ private:
     QMap<SPIM_PI_DEVICES, int> currentSteps;
     QMap<SPIM_PI_DEVICES, QList<double> *> scanRangeMap;
     double scanVelocity = 1;
+    bool serpentine = false;
+    bool mipEnabled = false;
+    bool meanProjectionEnabled = false;
+    bool positionTrigger = false;  // camera triggered by stage position pulses
+    bool stageTriggerArmed = false; // stack stage trigger output in position mode
+    int pyramidLevels = 0;          // 0 = no pyramid
+    bool pyramidZDecimation = false;
 
     QStringList outputPath;
+    QStringList stripePath; // per camera, see setStripePathList()
     QString runName;
 
     bool freeRun = true;
     bool capturing = false;
 
+    TriggerCalibration triggerCalibration;
+    bool calibrating = false; // test stacks of a trigger rate calibration are being acquired
+
     int completedJobs;
     int successJobs;
 
+    // tile pipelining: stages move to the next tile while the previous stack is being saved
+    QMap<SPIM_PI_DEVICES, int> acquiredSteps; // tile of the last triggered stack
+    MotionMonitor *motionMonitor = nullptr;
+    QMap<SPIM_PI_DEVICES, double> commandedPositions;
+    QMap<int, double> settleTimes; // ms, per axis
+    QElapsedTimer tileTimer;       // dead time between two stacks
+    bool stagesSettled = false;
+    bool waitingOnTarget = false;
+    double motionOverhead = 0; // s
+    int overheadCount = 0;
+    QString tileFileName;
+    bool tileAdvanced = false;
+    bool tileMoveIssued = false;
+    bool lastStackCounted = false;
+    bool saveFailed = false;
+    int pendingSaves = 0;
+    qint64 lastStackFrames = 0;
+    double lastStackBytes = 0;
+
+    QElapsedTimer acquisitionTimer;
+    QElapsedTimer captureTimer;
+    double captureTime = 0; // s
+    qint64 savedFrames = 0;
+    double savedBytes = 0;
+
     QMap<MACHINE_STATE, QState *> stateMap;
 
+    void connectPIDevice(PIDevice *dev);
+    static void runInThread(QObject *obj, const std::function<void()> &f);
+
+    BufferPlanner makeBufferPlanner() const;
+    void planBuffers();
+    void updateWriteThroughput();
+
+    QDir fullOutputDir(const QString &root) const;
+
+    void setupScan();
+    void stepTile(QMap<SPIM_PI_DEVICES, int> &steps) const;
+
     void _setExposureTime(double expTime);
     void _startCapture();
     void setupStateMachine();
 
     void incrementCompleted(bool ok);
+    void onCalibrationStackCompleted();
+    void onStackSaved(bool ok);
+    void onStagesSettled(const QMap<int, double> &times);
+    void tryEmitOnTarget();
+    void advanceToNextTile();
+    void moveToTile(int stackIndex);
+    bool isStackReversed(int stackIndex) const;
+    double stackOvertravel(int stackIndex) const;
+    void stackEnds(int stackIndex, double *first, double *last) const;
+    void setupStageTrigger(int stackIndex);
+
+    void setStageVelocity(const SPIM_PI_DEVICES dev, double velocity);
+    void moveStage(const SPIM_PI_DEVICES dev, double pos);
+    bool isStageOnTarget(const SPIM_PI_DEVICES dev) const;
+
+    void startCameras();
+    void stopCameras();
+
+    void logThroughputReport();
 
 private slots:
     void onError(const QString &errMsg);
@@ -0,0 +1,465 @@
+#include "stackwriter.h"
+
+#include "compressedstackwriter.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <qtlab/core/logger.h>
+
+#ifdef WITH_LIBURING
+#include <liburing.h>
+#endif
+
+#define STACKWRITER_ALIGNMENT 4096
+
+static Logger *logger = getLogger("StackWriter");
+
+StackWriter *StackWriter::create(Backend backend)
+{
+    Backend actual = available(backend);
+    if (actual != backend) {
+        logger->warning(QString("%1 backend not available in this build, using %2")
+                            .arg(backendName(backend))
+                            .arg(backendName(actual)));
+    }
+    switch (actual) {
+    case BACKEND_DIRECT:
+        return new DirectStackWriter();
+#ifdef WITH_LIBURING
+    case BACKEND_URING:
+        return new UringStackWriter();
+#endif
+#ifdef WITH_ZSTD
+    case BACKEND_COMPRESSED:
+        return new CompressedStackWriter();
+#endif
+    case BACKEND_BUFFERED:
+    default:
+        return new BufferedStackWriter();
+    }
+}
+
+/**
+ * @brief \a backend if it is compiled in, otherwise the backend create() falls back to (O_DIRECT
+ * for io_uring, buffered I/O for zstd).
+ */
+StackWriter::Backend StackWriter::available(Backend backend)
+{
+    switch (backend) {
+#ifndef WITH_LIBURING
+    case BACKEND_URING:
+        return BACKEND_DIRECT;
+#endif
+#ifndef WITH_ZSTD
+    case BACKEND_COMPRESSED:
+        return BACKEND_BUFFERED;
+#endif
+    default:
+        return backend;
+    }
+}
+
+QString StackWriter::backendName(Backend backend)
+{
+    return backendNames().value(backend);
+}
+
+StackWriter::Backend StackWriter::backendFromName(const QString &name)
+{
+    int idx = backendNames().indexOf(name);
+    return idx < 0 ? BACKEND_BUFFERED : static_cast<Backend>(idx);
+}
+
+QStringList StackWriter::backendNames()
+{
+    return {"buffered", "direct", "io_uring", "zstd"};
+}
+
+QString StackWriter::fileExtension(Backend backend)
+{
+#ifdef WITH_ZSTD
+    if (backend == BACKEND_COMPRESSED) {
+        return "zraw";
+    }
+#else
+    Q_UNUSED(backend)
+#endif
+    return "raw";
+}
+
+StackWriter::~StackWriter() {}
+
+bool StackWriter::supportsConcurrentWrites() const
+{
+    return false;
+}
+
+QString StackWriter::report() const
+{
+    return QString();
+}
+
+QString StackWriter::errorString() const
+{
+    return errString;
+}
+
+/**
+ * @brief Size of the windows in which backends writing through the page cache flush the file
+ * and drop it from the cache while it is written (see Writeback), 0 to leave it to the kernel.
+ */
+void StackWriter::setWritebackWindow(size_t bytes)
+{
+    writeback.setWindowBytes(bytes);
+}
+
+void StackWriter::setErrno(const QString &what)
+{
+    errString = QString("%1: %2").arg(what).arg(strerror(errno));
+}
+
+/* BufferedStackWriter */
+
+BufferedStackWriter::~BufferedStackWriter()
+{
+    close();
+}
+
+StackWriter::Backend BufferedStackWriter::backend() const
+{
+    return BACKEND_BUFFERED;
+}
+
+bool BufferedStackWriter::open(const QString &fileName, size_t frameBytes, size_t frameCount)
+{
+    this->frameBytes = frameBytes;
+    this->frameCount = frameCount;
+    fd = ::open(fileName.toLatin1(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        setErrno(QString("Cannot create output file %1").arg(fileName));
+        return false;
+    }
+    writeback.start(fd);
+    return true;
+}
+
+bool BufferedStackWriter::writeFrame(size_t index, const void *data)
+{
+    const off_t frameOffset = static_cast<off_t>(index) * frameBytes;
+    const uint8_t *buf = static_cast<const uint8_t *>(data);
+    size_t bytes = frameBytes;
+    off_t offset = frameOffset;
+    while (bytes > 0) {
+        ssize_t written = pwrite(fd, buf, bytes, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            setErrno(QString("written %1/%2 bytes").arg(frameBytes - bytes).arg(frameBytes));
+            return false;
+        }
+        buf += written;
+        bytes -= static_cast<size_t>(written);
+        offset += written;
+    }
+    writeback.completed(static_cast<uint64_t>(frameOffset), frameBytes);
+    return true;
+}
+
+bool BufferedStackWriter::close()
+{
+    if (fd < 0) {
+        return true;
+    }
+    bool ok = writeback.finish();
+    if (!ok) {
+        setErrno("writeback");
+    }
+    int ret = ::close(fd);
+    fd = -1;
+    if (ret != 0) {
+        setErrno("close");
+        return false;
+    }
+    return ok;
+}
+
+bool BufferedStackWriter::supportsConcurrentWrites() const
+{
+    return true;
+}
+
+QString BufferedStackWriter::report() const
+{
+    return writeback.report();
+}
+
+/* DirectStackWriter */
+
+DirectStackWriter::DirectStackWriter(size_t chunkBytes, int poolSize)
+    : chunkBytes(chunkBytes / STACKWRITER_ALIGNMENT * STACKWRITER_ALIGNMENT)
+    , poolSize(poolSize)
+{}
+
+DirectStackWriter::~DirectStackWriter()
+{
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+StackWriter::Backend DirectStackWriter::backend() const
+{
+    return BACKEND_DIRECT;
+}
+
+bool DirectStackWriter::open(const QString &fileName, size_t frameBytes, size_t frameCount)
+{
+    this->frameBytes = frameBytes;
+    this->frameCount = frameCount;
+
+    while (static_cast<int>(pool.size()) < poolSize) {
+        try {
+            pool.push_back(FramePool::global().acquire(chunkBytes));
+        } catch (std::bad_alloc) {
+            errString = "Cannot allocate aligned write buffers";
+            return false;
+        }
+    }
+
+    QByteArray fname = fileName.toLatin1();
+    fd = ::open(fname, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0666);
+    if (fd < 0 && errno == EINVAL) {
+        logger->warning(QString("O_DIRECT not supported for %1, using buffered I/O").arg(fileName));
+        fd = ::open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    }
+    if (fd < 0) {
+        setErrno(QString("Cannot create output file %1").arg(fileName));
+        return false;
+    }
+
+    currentBuffer = 0;
+    fill = 0;
+    chunkOffset = 0;
+    nextFrame = 0;
+    return true;
+}
+
+bool DirectStackWriter::writeFrame(size_t index, const void *data)
+{
+    if (index != nextFrame) {
+        errString = QString("frame %1 written out of order (expected %2)")
+                        .arg(index)
+                        .arg(nextFrame);
+        return false;
+    }
+
+    const uint8_t *src = static_cast<const uint8_t *>(data);
+    size_t remaining = frameBytes;
+    while (remaining > 0) {
+        size_t n = std::min(remaining, chunkBytes - fill);
+        memcpy(buffer(currentBuffer) + fill, src, n);
+        fill += n;
+        src += n;
+        remaining -= n;
+        if (fill == chunkBytes && !flushChunk(false)) {
+            return false;
+        }
+    }
+    nextFrame++;
+    return true;
+}
+
+bool DirectStackWriter::close()
+{
+    if (fd < 0) {
+        return true;
+    }
+    bool ok = true;
+    if (fill > 0) {
+        ok = flushChunk(true);
+    }
+    ok = drain() && ok;
+
+    // the last chunk was padded to the alignment
+    if (ftruncate(fd, static_cast<off_t>(nextFrame * frameBytes)) != 0) {
+        setErrno("ftruncate");
+        ok = false;
+    }
+    if (::close(fd) != 0) {
+        setErrno("close");
+        ok = false;
+    }
+    fd = -1;
+    return ok;
+}
+
+uint8_t *DirectStackWriter::buffer(int i) const
+{
+    return pool.at(static_cast<size_t>(i)).as<uint8_t>();
+}
+
+bool DirectStackWriter::flushChunk(bool last)
+{
+    size_t bytes = fill;
+    if (last) {
+        size_t padded = (fill + STACKWRITER_ALIGNMENT - 1) / STACKWRITER_ALIGNMENT
+                        * STACKWRITER_ALIGNMENT;
+        memset(buffer(currentBuffer) + fill, 0, padded - fill);
+        bytes = padded;
+    }
+    if (!submit(currentBuffer, bytes, chunkOffset)) {
+        return false;
+    }
+    chunkOffset += fill;
+    fill = 0;
+    currentBuffer = (currentBuffer + 1) % static_cast<int>(pool.size());
+    return reclaim(currentBuffer);
+}
+
+bool DirectStackWriter::submit(int bufferIndex, size_t bytes, off_t offset)
+{
+    const uint8_t *buf = buffer(bufferIndex);
+    while (bytes > 0) {
+        ssize_t written = pwrite(fd, buf, bytes, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            setErrno(QString("write at offset %1").arg(offset));
+            return false;
+        }
+        buf += written;
+        bytes -= static_cast<size_t>(written);
+        offset += written;
+    }
+    return true;
+}
+
+bool DirectStackWriter::reclaim(int bufferIndex)
+{
+    Q_UNUSED(bufferIndex)
+    return true;
+}
+
+bool DirectStackWriter::drain()
+{
+    return true;
+}
+
+/* UringStackWriter */
+
+#ifdef WITH_LIBURING
+
+UringStackWriter::UringStackWriter(size_t chunkBytes, int queueDepth)
+    : DirectStackWriter(chunkBytes, queueDepth)
+{}
+
+UringStackWriter::~UringStackWriter()
+{
+    if (ring != nullptr) {
+        drain();
+        io_uring_queue_exit(ring);
+        delete ring;
+    }
+}
+
+StackWriter::Backend UringStackWriter::backend() const
+{
+    return BACKEND_URING;
+}
+
+bool UringStackWriter::open(const QString &fileName, size_t frameBytes, size_t frameCount)
+{
+    if (ring == nullptr) {
+        ring = new io_uring;
+        int ret = io_uring_queue_init(static_cast<unsigned>(poolSize), ring, 0);
+        if (ret < 0) {
+            delete ring;
+            ring = nullptr;
+            errString = QString("io_uring_queue_init: %1").arg(strerror(-ret));
+            return false;
+        }
+    }
+    inFlight.assign(static_cast<size_t>(poolSize), 0);
+    nInFlight = 0;
+    return DirectStackWriter::open(fileName, frameBytes, frameCount);
+}
+
+bool UringStackWriter::submit(int bufferIndex, size_t bytes, off_t offset)
+{
+    io_uring_sqe *sqe;
+    while ((sqe = io_uring_get_sqe(ring)) == nullptr) {
+        if (!reap(true)) {
+            return false;
+        }
+    }
+    io_uring_prep_write(sqe, fd, buffer(bufferIndex), static_cast<unsigned>(bytes), offset);
+    io_uring_sqe_set_data(sqe, reinterpret_cast<void *>(static_cast<intptr_t>(bufferIndex)));
+    inFlight[static_cast<size_t>(bufferIndex)] = bytes;
+    nInFlight++;
+
+    int ret = io_uring_submit(ring);
+    if (ret < 0) {
+        errString = QString("io_uring_submit: %1").arg(strerror(-ret));
+        return false;
+    }
+    return true;
+}
+
+bool UringStackWriter::reclaim(int bufferIndex)
+{
+    while (inFlight[static_cast<size_t>(bufferIndex)] != 0) {
+        if (!reap(true)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool UringStackWriter::drain()
+{
+    bool ok = true;
+    while (nInFlight > 0) {
+        ok = reap(true) && ok;
+    }
+    return ok;
+}
+
+bool UringStackWriter::reap(bool wait)
+{
+    io_uring_cqe *cqe;
+    int ret = wait ? io_uring_wait_cqe(ring, &cqe) : io_uring_peek_cqe(ring, &cqe);
+    if (ret < 0) {
+        if (ret == -EINTR || ret == -EAGAIN) {
+            return true;
+        }
+        errString = QString("io_uring_wait_cqe: %1").arg(strerror(-ret));
+        nInFlight = 0;
+        return false;
+    }
+
+    size_t idx = static_cast<size_t>(reinterpret_cast<intptr_t>(io_uring_cqe_get_data(cqe)));
+    size_t expected = inFlight[idx];
+    int res = cqe->res;
+    io_uring_cqe_seen(ring, cqe);
+    inFlight[idx] = 0;
+    nInFlight--;
+
+    if (res < 0) {
+        errString = QString("asynchronous write: %1").arg(strerror(-res));
+        return false;
+    }
+    if (static_cast<size_t>(res) != expected) {
+        errString = QString("asynchronous write: written %1/%2 bytes").arg(res).arg(expected);
+        return false;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef STACKWRITER_H
+#define STACKWRITER_H
+
+#include "framepool.h"
+#include "writeback.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+#include <vector>
+
+#include <QString>
+#include <QStringList>
+
+/**
+ * @brief Output backend used by SaveStackWorker to write a stack to a .raw file.
+ *
+ * Frames are identified by their index in the stack, so that a backend can write them at the
+ * right offset regardless of the order in which writer threads hand them over.
+ */
+class StackWriter
+{
+public:
+    enum Backend : int {
+        BACKEND_BUFFERED,
+        BACKEND_DIRECT,
+        BACKEND_URING,
+        BACKEND_COMPRESSED,
+    };
+
+    static StackWriter *create(Backend backend);
+    static Backend available(Backend backend);
+    static QString backendName(Backend backend);
+    static Backend backendFromName(const QString &name);
+    static QStringList backendNames();
+    static QString fileExtension(Backend backend);
+
+    virtual ~StackWriter();
+
+    virtual Backend backend() const = 0;
+    virtual bool open(const QString &fileName, size_t frameBytes, size_t frameCount) = 0;
+    virtual bool writeFrame(size_t index, const void *data) = 0;
+    virtual bool close() = 0;
+
+    /**
+     * @brief Whether writeFrame() may be called by several threads at the same time.
+     */
+    virtual bool supportsConcurrentWrites() const;
+
+    /**
+     * @brief Backend specific statistics about the last stack, logged by SaveStackWorker.
+     */
+    virtual QString report() const;
+
+    QString errorString() const;
+
+    void setWritebackWindow(size_t bytes);
+
+protected:
+    QString errString;
+    size_t frameBytes = 0;
+    size_t frameCount = 0;
+    Writeback writeback;
+
+    void setErrno(const QString &what);
+};
+
+/**
+ * @brief Plain open()/pwrite() through the page cache, with explicit writeback of the written
+ * ranges (see Writeback).
+ */
+class BufferedStackWriter : public StackWriter
+{
+public:
+    virtual ~BufferedStackWriter() override;
+
+    virtual Backend backend() const override;
+    virtual bool open(const QString &fileName, size_t frameBytes, size_t frameCount) override;
+    virtual bool writeFrame(size_t index, const void *data) override;
+    virtual bool close() override;
+    virtual bool supportsConcurrentWrites() const override;
+    virtual QString report() const override;
+
+protected:
+    int fd = -1;
+};
+
+/**
+ * @brief O_DIRECT writer: frames are coalesced into large aligned chunks taken from a buffer
+ * pool that is kept across stacks (chunks come from the global FramePool). Frames must be written
+ * in order.
+ */
+class DirectStackWriter : public StackWriter
+{
+public:
+    DirectStackWriter(size_t chunkBytes = 32 << 20, int poolSize = 1);
+    virtual ~DirectStackWriter() override;
+
+    virtual Backend backend() const override;
+    virtual bool open(const QString &fileName, size_t frameBytes, size_t frameCount) override;
+    virtual bool writeFrame(size_t index, const void *data) override;
+    virtual bool close() override;
+
+protected:
+    int fd = -1;
+    size_t chunkBytes;
+    int poolSize;
+    std::vector<FramePool::Buffer> pool;
+    int currentBuffer = 0;
+    size_t fill = 0;        // bytes in the current chunk
+    off_t chunkOffset = 0;  // file offset of the current chunk
+    size_t nextFrame = 0;
+
+    uint8_t *buffer(int i) const;
+    bool flushChunk(bool last);
+
+    // write \a bytes (aligned) from pool buffer \a bufferIndex at \a offset
+    virtual bool submit(int bufferIndex, size_t bytes, off_t offset);
+    // make sure pool buffer \a bufferIndex can be filled again
+    virtual bool reclaim(int bufferIndex);
+    // wait for all submitted writes to complete
+    virtual bool drain();
+};
+
+#ifdef WITH_LIBURING
+struct io_uring;
+
+/**
+ * @brief io_uring writer: same chunking as DirectStackWriter, but keeps up to \a queueDepth
+ * chunk writes in flight.
+ */
+class UringStackWriter : public DirectStackWriter
+{
+public:
+    UringStackWriter(size_t chunkBytes = 32 << 20, int queueDepth = 4);
+    virtual ~UringStackWriter() override;
+
+    virtual Backend backend() const override;
+    virtual bool open(const QString &fileName, size_t frameBytes, size_t frameCount) override;
+
+protected:
+    virtual bool submit(int bufferIndex, size_t bytes, off_t offset) override;
+    virtual bool reclaim(int bufferIndex) override;
+    virtual bool drain() override;
+
+private:
+    io_uring *ring = nullptr;
+    std::vector<size_t> inFlight; // bytes being written from each buffer (0 = free)
+    int nInFlight = 0;
+
+    bool reap(bool wait);
+};
+#endif
+
+#endif // STACKWRITER_H
@@ -0,0 +1,307 @@
+#include "stripedstackwriter.h"
+
+#include "compressedstackwriter.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+
+#define STRIPEDSTACK_VERSION 1
+
+constexpr size_t StripedStackWriter::DEFAULT_BLOCK_FRAMES;
+
+/**
+ * @brief Takes ownership of \a writers, one per stripe, with the given \a weights.
+ */
+StripedStackWriter::StripedStackWriter(const QVector<StackWriter *> &writers,
+                                       const QVector<int> &weights,
+                                       size_t blockFrames)
+    : writers(writers)
+    , blockFrames(std::max<size_t>(blockFrames, 1))
+{
+    for (int i = 0; i < writers.size(); ++i) {
+        this->weights << std::max(weights.value(i, 1), 1);
+    }
+    buildPattern(this->weights, &pattern, &rank);
+}
+
+StripedStackWriter::~StripedStackWriter()
+{
+    qDeleteAll(writers);
+}
+
+/**
+ * @brief Directory of each stripe file, to be set before open(). Stripes without a directory
+ * are written next to the manifest.
+ */
+void StripedStackWriter::setDirectories(const QStringList &dirs)
+{
+    this->dirs = dirs;
+}
+
+int StripedStackWriter::stripeCount() const
+{
+    return writers.size();
+}
+
+QVector<int> StripedStackWriter::getWeights() const
+{
+    return weights;
+}
+
+StackWriter *StripedStackWriter::stripe(int i) const
+{
+    return writers.at(i);
+}
+
+StackWriter::Backend StripedStackWriter::backend() const
+{
+    return writers.at(0)->backend();
+}
+
+bool StripedStackWriter::open(const QString &fileName, size_t frameBytes, size_t frameCount)
+{
+    this->frameBytes = frameBytes;
+    this->frameCount = frameCount;
+
+    // frames held by each stripe
+    QVector<size_t> counts(writers.size(), 0);
+    for (size_t i = 0; i < frameCount; i += blockFrames) {
+        size_t last = std::min(i + blockFrames, frameCount) - 1;
+        int s;
+        size_t local = localIndex(last, blockFrames, weights, pattern, rank, &s);
+        counts[s] = std::max(counts[s], local + 1);
+    }
+
+    QFileInfo fi(fileName);
+    QStringList stripeFiles;
+    for (int k = 0; k < writers.size(); ++k) {
+        QDir dir = k < dirs.size() ? QDir(dirs.at(k)) : fi.dir();
+        stripeFiles << QFileInfo(dir.filePath(QString("%1_s%2.%3")
+                                                  .arg(fi.completeBaseName())
+                                                  .arg(k)
+                                                  .arg(StackWriter::fileExtension(
+                                                      writers.at(k)->backend()))))
+                           .absoluteFilePath();
+    }
+
+    QFile manifest(fileName);
+    if (!manifest.open(QIODevice::WriteOnly)) {
+        errString = QString("Cannot create output file %1").arg(fileName);
+        return false;
+    }
+    QTextStream out(&manifest);
+    out << "StripeVersion = " << STRIPEDSTACK_VERSION << endl;
+    out << "FrameBytes = " << frameBytes << endl;
+    out << "FrameCount = " << frameCount << endl;
+    out << "BlockFrames = " << blockFrames << endl;
+    QStringList w;
+    for (int weight : weights) {
+        w << QString::number(weight);
+    }
+    out << "Weights = " << w.join(" ") << endl;
+    for (const QString &f : stripeFiles) {
+        out << "Stripe = " << f << endl;
+    }
+    manifest.close();
+
+    for (int k = 0; k < writers.size(); ++k) {
+        if (!writers.at(k)->open(stripeFiles.at(k), frameBytes, counts.at(k))) {
+            errString = writers.at(k)->errorString();
+            for (int j = 0; j < k; ++j) {
+                writers.at(j)->close();
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+bool StripedStackWriter::writeFrame(size_t index, const void *data)
+{
+    int s;
+    size_t local = localIndex(index, blockFrames, weights, pattern, rank, &s);
+    if (!writers.at(s)->writeFrame(local, data)) {
+        errString = QString("stripe %1: %2").arg(s).arg(writers.at(s)->errorString());
+        return false;
+    }
+    return true;
+}
+
+bool StripedStackWriter::close()
+{
+    bool ok = true;
+    for (int k = 0; k < writers.size(); ++k) {
+        if (!writers.at(k)->close()) {
+            errString = QString("stripe %1: %2").arg(k).arg(writers.at(k)->errorString());
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+bool StripedStackWriter::supportsConcurrentWrites() const
+{
+    for (StackWriter *w : writers) {
+        if (!w->supportsConcurrentWrites()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+QString StripedStackWriter::report() const
+{
+    QStringList reports;
+    for (int k = 0; k < writers.size(); ++k) {
+        QString r = writers.at(k)->report();
+        if (!r.isEmpty()) {
+            reports << QString("stripe %1: %2").arg(k).arg(r);
+        }
+    }
+    return reports.join("; ");
+}
+
+QString StripedStackWriter::fileExtension()
+{
+    return "stripes";
+}
+
+/**
+ * @brief Reads frame \a index of the striped stack described by \a manifest into \a out.
+ *
+ * Stripe files that are not found at the recorded path are looked for next to the manifest, so
+ * that a stack can be gathered in a single directory.
+ */
+bool StripedStackWriter::readFrame(
+    const QString &manifest, size_t index, void *out, size_t outBytes, QString *errorString)
+{
+    auto fail = [errorString](const QString &msg) {
+        if (errorString != nullptr) {
+            *errorString = msg;
+        }
+        return false;
+    };
+
+    QFile f(manifest);
+    if (!f.open(QIODevice::ReadOnly)) {
+        return fail(QString("Cannot open %1").arg(manifest));
+    }
+    size_t frameBytes = 0, frameCount = 0, blockFrames = 0;
+    QVector<int> weights;
+    QStringList stripeFiles;
+    QTextStream in(&f);
+    while (!in.atEnd()) {
+        QString line = in.readLine();
+        int eq = line.indexOf('=');
+        if (eq < 0) {
+            continue;
+        }
+        QString key = line.left(eq).trimmed();
+        QString value = line.mid(eq + 1).trimmed();
+        if (key == "FrameBytes") {
+            frameBytes = value.toULongLong();
+        } else if (key == "FrameCount") {
+            frameCount = value.toULongLong();
+        } else if (key == "BlockFrames") {
+            blockFrames = value.toULongLong();
+        } else if (key == "Weights") {
+            for (const QString &w : value.split(' ', QString::SkipEmptyParts)) {
+                weights << std::max(w.toInt(), 1);
+            }
+        } else if (key == "Stripe") {
+            stripeFiles << value;
+        }
+    }
+    if (blockFrames == 0 || stripeFiles.isEmpty() || weights.size() != stripeFiles.size()) {
+        return fail(QString("%1: invalid manifest").arg(manifest));
+    }
+    if (index >= frameCount) {
+        return fail(QString("frame %1 out of range (%2 frames)").arg(index).arg(frameCount));
+    }
+    if (outBytes < frameBytes) {
+        return fail(
+            QString("output buffer too small (%1 < %2 bytes)").arg(outBytes).arg(frameBytes));
+    }
+
+    QVector<int> pattern, rank;
+    buildPattern(weights, &pattern, &rank);
+    int s;
+    size_t local = localIndex(index, blockFrames, weights, pattern, rank, &s);
+
+    QString fileName = stripeFiles.at(s);
+    if (!QFileInfo::exists(fileName)) {
+        fileName = QFileInfo(manifest).dir().filePath(QFileInfo(fileName).fileName());
+    }
+#ifdef WITH_ZSTD
+    if (fileName.endsWith("." + StackWriter::fileExtension(BACKEND_COMPRESSED))) {
+        return CompressedStackWriter::readFrame(fileName, local, out, outBytes, errorString);
+    }
+#endif
+
+    int fd = ::open(fileName.toLatin1(), O_RDONLY);
+    if (fd < 0) {
+        return fail(QString("Cannot open %1: %2").arg(fileName).arg(strerror(errno)));
+    }
+    ssize_t n = pread(fd, out, frameBytes, static_cast<off_t>(local * frameBytes));
+    ::close(fd);
+    if (n != static_cast<ssize_t>(frameBytes)) {
+        return fail(QString("%1: short read of frame %2").arg(fileName).arg(local));
+    }
+    return true;
+}
+
+/**
+ * @brief Maps frame \a index of the stack to its index in the file of stripe \a *stripe.
+ */
+size_t StripedStackWriter::localIndex(size_t index,
+                                      size_t blockFrames,
+                                      const QVector<int> &weights,
+                                      const QVector<int> &pattern,
+                                      const QVector<int> &rank,
+                                      int *stripe)
+{
+    size_t block = index / blockFrames;
+    size_t cycle = block / static_cast<size_t>(pattern.size());
+    int pos = static_cast<int>(block % static_cast<size_t>(pattern.size()));
+    *stripe = pattern.at(pos);
+    size_t localBlock = cycle * static_cast<size_t>(weights.at(*stripe)) + rank.at(pos);
+    return localBlock * blockFrames + index % blockFrames;
+}
+
+/**
+ * @brief Smooth weighted round robin: one cycle has sum(weights) blocks, each stripe gets as many
+ * blocks as its weight, spread as evenly as possible.
+ */
+void StripedStackWriter::buildPattern(const QVector<int> &weights,
+                                      QVector<int> *pattern,
+                                      QVector<int> *rank)
+{
+    int total = 0;
+    for (int w : weights) {
+        total += w;
+    }
+    QVector<int> current(weights.size(), 0);
+    QVector<int> taken(weights.size(), 0);
+    pattern->clear();
+    rank->clear();
+    for (int k = 0; k < total; ++k) {
+        int best = 0;
+        for (int i = 0; i < weights.size(); ++i) {
+            current[i] += weights.at(i);
+            if (current.at(i) > current.at(best)) {
+                best = i;
+            }
+        }
+        current[best] -= total;
+        *pattern << best;
+        *rank << taken[best]++;
+    }
+}
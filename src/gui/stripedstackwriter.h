@@ -0,0 +1,79 @@
+#ifndef STRIPEDSTACKWRITER_H
+#define STRIPEDSTACKWRITER_H
+
+#include "stackwriter.h"
+
+#include <QVector>
+
+/**
+ * @brief Distributes the frames of a stack over several stack writers, one per disk, so that a
+ * camera is not limited by the bandwidth of a single volume.
+ *
+ * Frames are grouped in blocks of blockFrames consecutive frames; blocks are assigned to the
+ * stripes by smooth weighted round robin (a stripe of weight 2 gets twice as many blocks as one
+ * of weight 1, interleaved as evenly as possible). Each stripe holds its blocks in stack order in
+ * a file written by its own backend (<name>_s<k>.<ext> in the stripe directory).
+ *
+ * A manifest (text, "key = value" lines like a .mhd header) written in place of the stack file
+ * records the layout:
+ *
+ *     StripeVersion = 1
+ *     FrameBytes = <bytes per frame>
+ *     FrameCount = <frames>
+ *     BlockFrames = <frames per block>
+ *     Weights = <weight of each stripe>
+ *     Stripe = <path of the file of stripe 0>
+ *     Stripe = ...
+ *
+ * readFrame() uses it to read any frame back. Since the manifest is not pixel data, the stack
+ * header is a .txt sidecar (DataFormat = Stripes) instead of a .mhd header.
+ */
+class StripedStackWriter : public StackWriter
+{
+public:
+    static constexpr size_t DEFAULT_BLOCK_FRAMES = 16;
+
+    StripedStackWriter(const QVector<StackWriter *> &writers,
+                       const QVector<int> &weights,
+                       size_t blockFrames = DEFAULT_BLOCK_FRAMES);
+    virtual ~StripedStackWriter() override;
+
+    void setDirectories(const QStringList &dirs);
+    int stripeCount() const;
+    QVector<int> getWeights() const;
+    StackWriter *stripe(int i) const;
+
+    virtual Backend backend() const override;
+    virtual bool open(const QString &fileName, size_t frameBytes, size_t frameCount) override;
+    virtual bool writeFrame(size_t index, const void *data) override;
+    virtual bool close() override;
+    virtual bool supportsConcurrentWrites() const override;
+    virtual QString report() const override;
+
+    static QString fileExtension();
+    static bool readFrame(const QString &manifest,
+                          size_t index,
+                          void *out,
+                          size_t outBytes,
+                          QString *errorString = nullptr);
+
+private:
+    QVector<StackWriter *> writers;
+    QVector<int> weights;
+    size_t blockFrames;
+    QStringList dirs;
+    QVector<int> pattern; // stripe of each block in a cycle
+    QVector<int> rank;    // index of each block of a cycle among the blocks of its stripe
+
+    static size_t localIndex(size_t index,
+                             size_t blockFrames,
+                             const QVector<int> &weights,
+                             const QVector<int> &pattern,
+                             const QVector<int> &rank,
+                             int *stripe);
+    static void buildPattern(const QVector<int> &weights,
+                             QVector<int> *pattern,
+                             QVector<int> *rank);
+};
+
+#endif // STRIPEDSTACKWRITER_H
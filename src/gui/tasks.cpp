@@ -2,8 +2,13 @@
 
 #include "cameratrigger.h"
 #include "galvoramp.h"
+#include "simulator.h"
 #include "spim.h"
 
+#include <qtlab/core/logger.h>
+
+static Logger *logger = getLogger("Tasks");
+
 Tasks::Tasks(QObject *parent)
     : QObject(parent)
 {
@@ -11,25 +16,58 @@ Tasks::Tasks(QObject *parent)
     galvoRamp = new GalvoRamp;
 }
 
+/**
+ * @brief Builds and commits the tasks whose parameters have changed since they were last built.
+ *
+ * Tasks stay committed (with their output buffers on the card) across start() / stop() cycles,
+ * so that re-arming for the next stack only restarts them. If only the galvo waveform
+ * parameters have changed, the waveform is rewritten without rebuilding the task.
+ */
 void Tasks::init()
 {
-    clearTasks();
-    cameraTrigger->initializeTask();
+    if (cameraTrigger->needsRebuild()) {
+        logger->info("Building camera trigger task");
+        cameraTrigger->initializeTask();
+        cameraTrigger->taskControl(DAQmx_Val_Task_Commit);
+    }
+
     galvoRamp->setTriggerTerm(cameraTrigger->getPulseTerms().at(0));
-    galvoRamp->initializeTask();
+    if (galvoRamp->needsRebuild()) {
+        logger->info("Building galvo ramp task");
+        galvoRamp->initializeTask();
+        galvoRamp->taskControl(DAQmx_Val_Task_Commit);
+    } else if (galvoRamp->isWaveformChanged()) {
+        logger->info("Updating galvo ramp waveform");
+        galvoRamp->commitWaveform();
+    }
+
+    initialized = true;
+}
+
+bool Tasks::isInitialized() const
+{
+    return initialized;
 }
 
 void Tasks::start()
 {
-    if (!initialized) {
-        init();
-    }
+#ifdef DEMO_MODE
+    simulator().startTrigger(cameraTrigger->getPulseFreq(),
+                             cameraTrigger->isFreeRunEnabled() ? -1
+                                                               : cameraTrigger->getNPulses());
+    return;
+#endif
+    init();
     galvoRamp->startTask();
     cameraTrigger->startTask();
 }
 
 void Tasks::stop()
 {
+#ifdef DEMO_MODE
+    simulator().stopTrigger();
+    return;
+#endif
     QList<NITask *> list;
     list << cameraTrigger;
     list << galvoRamp;
@@ -43,6 +81,10 @@ void Tasks::stop()
 void Tasks::clearTasks()
 {
     initialized = false;
+#ifdef DEMO_MODE
+    simulator().stopTrigger();
+    return;
+#endif
     QList<NITask *> list;
     list << cameraTrigger;
     list << galvoRamp;
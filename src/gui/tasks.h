@@ -14,6 +14,7 @@ class Tasks : public QObject
 public:
     explicit Tasks(QObject *parent = nullptr);
     void init();
+    bool isInitialized() const;
     void clearTasks();
     void start();
     void stop();
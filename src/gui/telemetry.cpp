@@ -0,0 +1,305 @@
+#include "telemetry.h"
+
+#include "spim.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+
+#include <qtlab/core/logger.h>
+
+#include <QSaveFile>
+#include <QTextStream>
+
+static Logger *logger = getLogger("Telemetry");
+
+constexpr int Telemetry::Histogram::BUCKETS;
+
+/**
+ * @brief Counts of \a h since \a previous, which is updated to the current counts.
+ */
+static std::vector<uint64_t> countsSince(const Telemetry::Histogram &h,
+                                         std::vector<uint64_t> *previous)
+{
+    std::vector<uint64_t> counts(Telemetry::Histogram::BUCKETS);
+    h.load(counts.data());
+    previous->resize(counts.size(), 0);
+    std::vector<uint64_t> delta(counts.size());
+    for (size_t i = 0; i < counts.size(); ++i) {
+        delta[i] = counts[i] - previous->at(i);
+    }
+    previous->swap(counts);
+    return delta;
+}
+
+/* Telemetry::Histogram */
+
+Telemetry::Histogram::Histogram()
+    : max(0)
+{
+    for (int i = 0; i < BUCKETS; ++i) {
+        buckets[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void Telemetry::Histogram::add(double us)
+{
+    uint64_t v = us > 0 ? static_cast<uint64_t>(us) : 0;
+    int bucket = static_cast<int>(v);
+    if (v >= 4) {
+        int octave = 63 - __builtin_clzll(v);
+        bucket = (octave - 1) * 4 + static_cast<int>((v >> (octave - 2)) & 3);
+    }
+    buckets[std::min(bucket, BUCKETS - 1)].fetch_add(1, std::memory_order_relaxed);
+
+    int64_t m = max.load(std::memory_order_relaxed);
+    while (static_cast<int64_t>(v) > m
+           && !max.compare_exchange_weak(m, static_cast<int64_t>(v), std::memory_order_relaxed)) {
+    }
+}
+
+/**
+ * @brief Copies the counts of all buckets to \a counts (BUCKETS elements).
+ */
+void Telemetry::Histogram::load(uint64_t *counts) const
+{
+    for (int i = 0; i < BUCKETS; ++i) {
+        counts[i] = buckets[i].load(std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Largest value added since the last call, in us.
+ */
+int64_t Telemetry::Histogram::takeMax()
+{
+    return max.exchange(0, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Upper bound of the bucket holding the \a q quantile of \a counts, 0 if empty.
+ */
+double Telemetry::Histogram::quantile(const uint64_t *counts, double q)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < BUCKETS; ++i) {
+        total += counts[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t target = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * total)));
+    uint64_t cumulative = 0;
+    for (int i = 0; i < BUCKETS; ++i) {
+        cumulative += counts[i];
+        if (cumulative >= target) {
+            return upperBound(i);
+        }
+    }
+    return upperBound(BUCKETS - 1);
+}
+
+double Telemetry::Histogram::upperBound(int bucket)
+{
+    if (bucket < 4) {
+        return bucket + 1;
+    }
+    int octave = bucket / 4 + 1;
+    return std::ldexp(5 + bucket % 4, octave - 2);
+}
+
+/* Telemetry::Camera */
+
+Telemetry::Camera::Camera()
+    : framesCaptured(0)
+    , framesWritten(0)
+    , bytesWritten(0)
+    , dcamBacklog(0)
+    , dcamFrames(0)
+    , queueDepth(0)
+    , queueCapacity(0)
+{}
+
+/* Telemetry */
+
+Telemetry::Telemetry(int nCameras)
+{
+    for (int i = 0; i < nCameras; ++i) {
+        cameras.emplace_back(new Camera());
+    }
+    previous.resize(cameras.size());
+}
+
+Telemetry::Camera &Telemetry::camera(int index)
+{
+    return *cameras.at(static_cast<size_t>(index));
+}
+
+/**
+ * @brief Settle time of each stage axis at the last tile move, in ms.
+ */
+void Telemetry::setSettleTimes(const QMap<int, double> &value)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    settleTimes = value;
+}
+
+/**
+ * @brief File each sample() is written to (atomically replaced).
+ */
+void Telemetry::setPublishPath(const QString &value)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    publishPath = value;
+    errorMsg.clear();
+}
+
+QString Telemetry::getPublishPath() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return publishPath;
+}
+
+QString Telemetry::errorString() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return errorMsg;
+}
+
+/**
+ * @brief Reads all counters, computes rates and percentiles over the time elapsed since the
+ * previous call and publishes the result.
+ */
+Telemetry::Sample Telemetry::sample()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Sample s;
+    s.interval = timer.isValid() ? timer.nsecsElapsed() * 1e-9 : 0;
+    timer.start();
+    s.settleTimes = settleTimes;
+
+    for (size_t i = 0; i < cameras.size(); ++i) {
+        Camera &c = *cameras[i];
+        Previous &p = previous[i];
+        CameraSample cs;
+
+        cs.framesCaptured = c.framesCaptured.load(std::memory_order_relaxed);
+        cs.framesWritten = c.framesWritten.load(std::memory_order_relaxed);
+        int64_t bytes = c.bytesWritten.load(std::memory_order_relaxed);
+        if (s.interval > 0) {
+            cs.frameRate = (cs.framesCaptured - p.framesCaptured) / s.interval;
+            cs.byteRate = (bytes - p.bytesWritten) / s.interval;
+        }
+        p.framesCaptured = cs.framesCaptured;
+        p.bytesWritten = bytes;
+
+        cs.dcamBacklog = c.dcamBacklog.load(std::memory_order_relaxed);
+        cs.dcamFrames = c.dcamFrames.load(std::memory_order_relaxed);
+        cs.queueDepth = c.queueDepth.load(std::memory_order_relaxed);
+        cs.queueCapacity = c.queueCapacity.load(std::memory_order_relaxed);
+
+        std::vector<uint64_t> counts = countsSince(c.writeLatency, &p.latency);
+        cs.latencyP50 = Histogram::quantile(counts.data(), 0.5);
+        cs.latencyP99 = Histogram::quantile(counts.data(), 0.99);
+        cs.latencyMax = c.writeLatency.takeMax();
+
+        counts = countsSince(c.jitter, &p.jitter);
+        cs.jitterP99 = Histogram::quantile(counts.data(), 0.99);
+        cs.jitterMax = c.jitter.takeMax();
+
+        s.cameras << cs;
+    }
+
+    if (!publishPath.isEmpty()) {
+        publish(s);
+    }
+    return s;
+}
+
+/**
+ * @brief Writes \a s to publishPath in Prometheus text format. Called with the mutex held.
+ */
+bool Telemetry::publish(const Sample &s)
+{
+    QSaveFile file(publishPath);
+    if (file.open(QIODevice::WriteOnly)) {
+        QTextStream out(&file);
+
+        auto metric = [&](const QString &name,
+                          const QString &type,
+                          const std::function<double(const CameraSample &)> &value) {
+            out << "# TYPE spimlab_" << name << " " << type << "\n";
+            for (int i = 0; i < s.cameras.size(); ++i) {
+                out << QString("spimlab_%1{camera=\"%2\"} %3\n")
+                           .arg(name)
+                           .arg(i)
+                           .arg(value(s.cameras.at(i)), 0, 'g', 10);
+            }
+        };
+
+        metric("frames_captured_total", "counter", [](const CameraSample &c) {
+            return c.framesCaptured;
+        });
+        metric("frames_written_total", "counter", [](const CameraSample &c) {
+            return c.framesWritten;
+        });
+        metric("frame_rate", "gauge", [](const CameraSample &c) { return c.frameRate; });
+        metric("write_bytes_per_second", "gauge", [](const CameraSample &c) {
+            return c.byteRate;
+        });
+        metric("dcam_backlog_frames", "gauge", [](const CameraSample &c) {
+            return c.dcamBacklog;
+        });
+        metric("dcam_buffer_frames", "gauge", [](const CameraSample &c) { return c.dcamFrames; });
+        metric("queue_depth_frames", "gauge", [](const CameraSample &c) { return c.queueDepth; });
+        metric("queue_capacity_frames", "gauge", [](const CameraSample &c) {
+            return c.queueCapacity;
+        });
+        metric("write_latency_p50_us", "gauge", [](const CameraSample &c) {
+            return c.latencyP50;
+        });
+        metric("write_latency_p99_us", "gauge", [](const CameraSample &c) {
+            return c.latencyP99;
+        });
+        metric("write_latency_max_us", "gauge", [](const CameraSample &c) {
+            return c.latencyMax;
+        });
+        metric("jitter_p99_us", "gauge", [](const CameraSample &c) { return c.jitterP99; });
+        metric("jitter_max_us", "gauge", [](const CameraSample &c) { return c.jitterMax; });
+
+        out << "# TYPE spimlab_stage_settle_ms gauge\n";
+        for (auto it = s.settleTimes.constBegin(); it != s.settleTimes.constEnd(); ++it) {
+            out << QString("spimlab_stage_settle_ms{axis=\"%1\"} %2\n")
+                       .arg(it.key())
+                       .arg(it.value(), 0, 'g', 10);
+        }
+        out.flush();
+    }
+
+    if (!file.commit()) {
+        // warn once, not once per second
+        if (errorMsg.isEmpty()) {
+            logger->warning(QString("Cannot publish telemetry to %1: %2")
+                                .arg(publishPath)
+                                .arg(file.errorString()));
+        }
+        errorMsg = file.errorString();
+        return false;
+    }
+    errorMsg.clear();
+    return true;
+}
+
+int64_t Telemetry::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+Telemetry &Telemetry::global()
+{
+    static Telemetry instance(SPIM_NCAMS);
+    return instance;
+}
@@ -0,0 +1,128 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <QElapsedTimer>
+#include <QMap>
+#include <QString>
+#include <QVector>
+
+/**
+ * @brief Live counters of the acquisition, for the operator and for monitoring scripts.
+ *
+ * The capture and writer threads update the counters of their camera with relaxed atomic
+ * operations only, so that the per-frame path never takes a lock. sample() reads them (typically
+ * once per second, see TelemetryWidget), turns them into rates and percentiles over the last
+ * interval and publishes the result as a text file in Prometheus exposition format, by default
+ * on /dev/shm, that scripts can poll (or that a node_exporter textfile collector can serve).
+ */
+class Telemetry
+{
+public:
+    /**
+     * @brief Lock-free histogram of durations in microseconds, with four buckets per power of
+     * two (values are known within 25%).
+     */
+    class Histogram
+    {
+    public:
+        static constexpr int BUCKETS = 128;
+
+        Histogram();
+
+        void add(double us);
+        void load(uint64_t *counts) const;
+        int64_t takeMax();
+
+        static double quantile(const uint64_t *counts, double q);
+        static double upperBound(int bucket);
+
+    private:
+        std::atomic<uint64_t> buckets[BUCKETS];
+        std::atomic<int64_t> max;
+    };
+
+    /**
+     * @brief Counters of a camera, updated by its capture and writer threads.
+     */
+    struct Camera
+    {
+        Camera();
+
+        std::atomic<int64_t> framesCaptured;
+        std::atomic<int64_t> framesWritten;
+        std::atomic<int64_t> bytesWritten;
+        std::atomic<int32_t> dcamBacklog; // frames the camera is ahead of the capture thread
+        std::atomic<int32_t> dcamFrames;  // size of the DCAM buffer
+        std::atomic<int32_t> queueDepth;  // frames in the frame ring, waiting for the writers
+        std::atomic<int32_t> queueCapacity;
+        Histogram writeLatency; // from the capture of a frame to the end of its write
+        Histogram jitter;       // deviation of the time stamp deltas from the frame period
+    };
+
+    struct CameraSample
+    {
+        int64_t framesCaptured = 0;
+        int64_t framesWritten = 0;
+        double frameRate = 0; // frames/s captured
+        double byteRate = 0;  // bytes/s written
+        int32_t dcamBacklog = 0;
+        int32_t dcamFrames = 0;
+        int32_t queueDepth = 0;
+        int32_t queueCapacity = 0;
+        double latencyP50 = 0; // us
+        double latencyP99 = 0; // us
+        double latencyMax = 0; // us
+        double jitterP99 = 0;  // us
+        double jitterMax = 0;  // us
+    };
+
+    struct Sample
+    {
+        double interval = 0; // s
+        QVector<CameraSample> cameras;
+        QMap<int, double> settleTimes; // ms, per axis, of the last tile move
+    };
+
+    explicit Telemetry(int nCameras);
+
+    Camera &camera(int index);
+
+    void setSettleTimes(const QMap<int, double> &value);
+
+    void setPublishPath(const QString &value); // empty disables publishing
+    QString getPublishPath() const;
+    QString errorString() const;
+
+    Sample sample();
+
+    static int64_t now(); // ns, monotonic
+    static Telemetry &global();
+
+private:
+    struct Previous
+    {
+        int64_t framesCaptured = 0;
+        int64_t bytesWritten = 0;
+        std::vector<uint64_t> latency;
+        std::vector<uint64_t> jitter;
+    };
+
+    std::vector<std::unique_ptr<Camera>> cameras;
+
+    mutable std::mutex mutex; // everything below
+    QMap<int, double> settleTimes;
+    QString publishPath;
+    QString errorMsg;
+    std::vector<Previous> previous;
+    QElapsedTimer timer;
+
+    bool publish(const Sample &s);
+};
+
+#endif // TELEMETRY_H
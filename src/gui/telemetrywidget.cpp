@@ -0,0 +1,114 @@
+#include "telemetrywidget.h"
+
+#include "spim.h"
+#include "telemetry.h"
+
+#include <qtlab/hw/pi/pidevice.h>
+
+#include <QGridLayout>
+#include <QGroupBox>
+#include <QLabel>
+#include <QTimer>
+
+TelemetryWidget::TelemetryWidget(QWidget *parent)
+    : QWidget(parent)
+{
+    setupUI();
+}
+
+void TelemetryWidget::setupUI()
+{
+    QStringList rowNames = {
+        "Frame rate",
+        "Write throughput",
+        "DCAM backlog",
+        "Writer queue",
+        "Write latency p50 / p99",
+        "Write latency max",
+        "Jitter p99 / max",
+        "Frames captured / written",
+    };
+
+    QGridLayout *grid = new QGridLayout();
+    for (int row = 0; row < rowNames.size(); ++row) {
+        grid->addWidget(new QLabel(rowNames.at(row)), row + 1, 0);
+    }
+
+    // one column per camera
+    QList<QList<QLabel *>> labels;
+    for (int i = 0; i < SPIM_NCAMS; ++i) {
+        QLabel *title = new QLabel(QString("Camera %1").arg(i));
+        title->setStyleSheet("QLabel {font-weight: bold;}");
+        grid->addWidget(title, 0, i + 1, Qt::AlignRight);
+        QList<QLabel *> column;
+        for (int row = 0; row < rowNames.size(); ++row) {
+            QLabel *l = new QLabel("-");
+            l->setAlignment(Qt::AlignRight | Qt::AlignVCenter);
+            grid->addWidget(l, row + 1, i + 1);
+            column << l;
+        }
+        labels << column;
+    }
+
+    QLabel *settleLabel = new QLabel();
+    QLabel *publishLabel = new QLabel();
+    publishLabel->setWordWrap(true);
+
+    QVBoxLayout *vLayout = new QVBoxLayout();
+    vLayout->addLayout(grid);
+    vLayout->addWidget(settleLabel);
+    vLayout->addWidget(publishLabel);
+    vLayout->addStretch();
+
+    QGroupBox *gb = new QGroupBox("Telemetry");
+    gb->setLayout(vLayout);
+
+    QBoxLayout *layout = new QVBoxLayout();
+    layout->addWidget(gb);
+    setLayout(layout);
+
+    // runs while the widget is hidden too: monitoring scripts read the published samples
+    QTimer *timer = new QTimer(this);
+    connect(timer, &QTimer::timeout, this, [=]() {
+        Telemetry::Sample s = Telemetry::global().sample();
+
+        for (int i = 0; i < s.cameras.size() && i < labels.size(); ++i) {
+            const Telemetry::CameraSample &c = s.cameras.at(i);
+            const QList<QLabel *> &column = labels.at(i);
+            int row = 0;
+            column.at(row++)->setText(QString("%1 fps").arg(c.frameRate, 0, 'f', 1));
+            column.at(row++)->setText(QString("%1 MB/s").arg(c.byteRate / (1 << 20), 0, 'f', 0));
+            column.at(row++)->setText(
+                QString("%1 / %2 frames").arg(c.dcamBacklog).arg(c.dcamFrames));
+            column.at(row++)->setText(
+                QString("%1 / %2 frames").arg(c.queueDepth).arg(c.queueCapacity));
+            column.at(row++)->setText(QString("%1 / %2 ms")
+                                          .arg(c.latencyP50 * 1e-3, 0, 'f', 1)
+                                          .arg(c.latencyP99 * 1e-3, 0, 'f', 1));
+            column.at(row++)->setText(QString("%1 ms").arg(c.latencyMax * 1e-3, 0, 'f', 1));
+            column.at(row++)->setText(
+                QString("%1 / %2 us").arg(c.jitterP99, 0, 'f', 0).arg(c.jitterMax, 0, 'f', 0));
+            column.at(row++)->setText(
+                QString("%1 / %2").arg(c.framesCaptured).arg(c.framesWritten));
+        }
+
+        QStringList axes;
+        for (auto it = s.settleTimes.constBegin(); it != s.settleTimes.constEnd(); ++it) {
+            axes << QString("%1 %2 ms")
+                        .arg(spim().getPIDevice(it.key())->getVerboseName())
+                        .arg(it.value(), 0, 'f', 1);
+        }
+        settleLabel->setText(QString("Stage settle times: %1").arg(axes.join(", ")));
+
+        QString path = Telemetry::global().getPublishPath();
+        QString error = Telemetry::global().errorString();
+        if (path.isEmpty()) {
+            publishLabel->setText("Not published");
+        } else if (!error.isEmpty()) {
+            publishLabel->setText(QString("Cannot publish to %1: %2").arg(path).arg(error));
+        } else {
+            publishLabel->setText(QString("Published to %1").arg(path));
+        }
+    });
+    timer->start(1000);
+}
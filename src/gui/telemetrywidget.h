@@ -0,0 +1,20 @@
+#ifndef TELEMETRYWIDGET_H
+#define TELEMETRYWIDGET_H
+
+#include <QWidget>
+
+/**
+ * @brief Live view of the acquisition telemetry; its timer also drives the publication of the
+ * samples (see Telemetry::sample()).
+ */
+class TelemetryWidget : public QWidget
+{
+    Q_OBJECT
+public:
+    explicit TelemetryWidget(QWidget *parent = nullptr);
+
+private:
+    void setupUI();
+};
+
+#endif // TELEMETRYWIDGET_H
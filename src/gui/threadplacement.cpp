@@ -0,0 +1,479 @@
+#include "threadplacement.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <sched.h>
+#include <string>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <qtlab/core/logger.h>
+
+#include <QDir>
+#include <QMap>
+
+static Logger *logger = getLogger("ThreadPlacement");
+
+static int64_t threadCpuTime()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static QVector<int> intersect(const QVector<int> &a, const QVector<int> &b)
+{
+    QVector<int> out;
+    for (int cpu : a) {
+        if (b.contains(cpu)) {
+            out << cpu;
+        }
+    }
+    return out;
+}
+
+QString ThreadPlacement::policyName(Policy policy)
+{
+    return policyNames().value(policy);
+}
+
+ThreadPlacement::Policy ThreadPlacement::policyFromName(const QString &name)
+{
+    int idx = policyNames().indexOf(name);
+    return idx < 0 ? POLICY_OTHER : static_cast<Policy>(idx);
+}
+
+QStringList ThreadPlacement::policyNames()
+{
+    return {"other", "fifo", "rr"};
+}
+
+/* ThreadPlacement::Scope */
+
+ThreadPlacement::Scope::Scope(Role role, int camera, const QString &name)
+    : tid(currentThreadId())
+    , name(name)
+{
+    scheduling = global().place(tid, role, camera);
+    cpuStart = threadCpuTime();
+    timer.start();
+}
+
+ThreadPlacement::Scope::~Scope()
+{
+    global().unplace(tid);
+}
+
+ThreadPlacement::Usage ThreadPlacement::Scope::usage() const
+{
+    Usage u;
+    u.name = name;
+    u.cpu = sched_getcpu();
+    u.cpuTime = (threadCpuTime() - cpuStart) * 1e-6;
+    u.wallTime = timer.nsecsElapsed() * 1e-6;
+    u.scheduling = scheduling;
+    return u;
+}
+
+/* ThreadPlacement */
+
+ThreadPlacement::ThreadPlacement()
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) {
+                allowedCpus << cpu;
+            }
+        }
+    }
+    // setAffinity() can extend a thread beyond the startup affinity
+    onlineCpus = readCpuListFile("/sys/devices/system/cpu/online");
+    if (onlineCpus.isEmpty()) {
+        onlineCpus = allowedCpus;
+    }
+    backgroundTimer.start();
+    resolve();
+}
+
+void ThreadPlacement::setEnabled(bool enable)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    enabled = enable;
+    resolve();
+}
+
+bool ThreadPlacement::isEnabled() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return enabled;
+}
+
+/**
+ * @brief CPUs of each camera: a CPU list, "node<n>" for the isolated CPUs of NUMA node n, or
+ * empty for the isolated CPUs of any node.
+ */
+void ThreadPlacement::setCameraCpus(const QStringList &value)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    cameraSpecs = value;
+    resolve();
+}
+
+QStringList ThreadPlacement::getCameraCpus() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return cameraSpecs;
+}
+
+/**
+ * @brief Scheduling policy of the capture and writer threads.
+ */
+void ThreadPlacement::setDrainPolicy(Policy value)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    drainPolicy = value;
+}
+
+ThreadPlacement::Policy ThreadPlacement::getDrainPolicy() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return drainPolicy;
+}
+
+/**
+ * @brief Real-time priority (1-99) of the capture and writer threads with a real-time drain
+ * policy.
+ */
+void ThreadPlacement::setDrainPriority(int value)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    drainPriority = value;
+}
+
+int ThreadPlacement::getDrainPriority() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return drainPriority;
+}
+
+/**
+ * @brief CPUs reserved for the threads of \a camera, empty if they are not pinned.
+ */
+QVector<int> ThreadPlacement::cameraCpus(int camera) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return cameraSets.value(camera);
+}
+
+QVector<int> ThreadPlacement::backgroundCpus() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return backgroundSet;
+}
+
+/**
+ * @brief Computes the CPU set of each camera and the background set. Called with the mutex held.
+ */
+void ThreadPlacement::resolve()
+{
+    cameraSets = QVector<QVector<int>>(cameraSpecs.size());
+    backgroundSet = allowedCpus;
+    if (!enabled) {
+        return;
+    }
+
+    // cameras with the same automatic setting share its candidate CPUs
+    QVector<int> isolated = intersect(readCpuListFile("/sys/devices/system/cpu/isolated"),
+                                      onlineCpus);
+    QMap<QString, QVector<int>> autoCameras;
+    for (int cam = 0; cam < cameraSpecs.size(); ++cam) {
+        QString spec = cameraSpecs.at(cam).trimmed();
+        if (spec.isEmpty() || spec.startsWith("node")) {
+            autoCameras[spec] << cam;
+        } else {
+            cameraSets[cam] = intersect(parseCpuList(spec), onlineCpus);
+        }
+    }
+    for (auto it = autoCameras.constBegin(); it != autoCameras.constEnd(); ++it) {
+        QVector<int> candidates = isolated;
+        if (!it.key().isEmpty()) {
+            QString path = QString("/sys/devices/system/node/%1/cpulist").arg(it.key());
+            candidates = intersect(candidates, readCpuListFile(path));
+        }
+        const QVector<int> &cams = it.value();
+        int n = candidates.size();
+        int m = cams.size();
+        for (int k = 0; k < m; ++k) {
+            cameraSets[cams.at(k)] = candidates.mid(k * n / m, (k + 1) * n / m - k * n / m);
+        }
+    }
+
+    // background threads stay out of the isolated CPUs, as at startup
+    QVector<int> background;
+    for (int cpu : allowedCpus) {
+        bool reserved = false;
+        for (const QVector<int> &set : cameraSets) {
+            reserved = reserved || set.contains(cpu);
+        }
+        if (!reserved) {
+            background << cpu;
+        }
+    }
+    if (!background.isEmpty()) {
+        backgroundSet = background;
+    }
+
+    for (int cam = 0; cam < cameraSets.size(); ++cam) {
+        if (cameraSets.at(cam).isEmpty()) {
+            logger->warning(QString("Camera %1: no CPU available for \"%2\", threads not pinned")
+                                .arg(cam)
+                                .arg(cameraSpecs.at(cam)));
+        }
+    }
+}
+
+/**
+ * @brief Applies the placement of \a role for \a camera to thread \a tid.
+ *
+ * @return A description of the placement, for usage reports.
+ */
+QString ThreadPlacement::place(int tid, Role role, int camera)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    placed[tid] = false;
+    QVector<int> set = cameraSets.value(camera);
+    if (!enabled || set.isEmpty()) {
+        return QString();
+    }
+
+    // the capture thread gets a CPU of its own when there is more than one
+    QVector<int> cpus = set.mid(0, 1);
+    if (role == ROLE_WRITER) {
+        cpus = set.size() > 1 ? set.mid(1) : set;
+    }
+    setAffinity(tid, cpus);
+    QString desc = QString("cpu %1").arg(formatCpuList(cpus));
+
+    if (drainPolicy != POLICY_OTHER) {
+        int policy = drainPolicy == POLICY_FIFO ? SCHED_FIFO : SCHED_RR;
+        sched_param param;
+        param.sched_priority = std::max(sched_get_priority_min(policy),
+                                        std::min(drainPriority, sched_get_priority_max(policy)));
+        // threads started by a drain thread (e.g. pools) must not inherit the real-time policy
+        if (sched_setscheduler(tid, policy | SCHED_RESET_ON_FORK, &param) == 0) {
+            placed[tid] = true;
+            desc += QString(", %1 %2").arg(policyName(drainPolicy)).arg(param.sched_priority);
+        } else if (!warnedPolicy) {
+            logger->warning(QString("Cannot set %1 scheduling (%2): CAP_SYS_NICE or an rtprio "
+                                    "limit is needed")
+                                .arg(policyName(drainPolicy))
+                                .arg(strerror(errno)));
+            warnedPolicy = true;
+        }
+    }
+    return desc;
+}
+
+/**
+ * @brief Gives thread \a tid back the normal scheduling policy; its affinity is left alone until
+ * the next placeBackgroundThreads().
+ */
+void ThreadPlacement::unplace(int tid)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = placed.find(tid);
+    if (it == placed.end()) {
+        return;
+    }
+    if (it->second) {
+        sched_param param;
+        param.sched_priority = 0;
+        sched_setscheduler(tid, SCHED_OTHER, &param);
+    }
+    placed.erase(it);
+}
+
+/**
+ * @brief Moves all the threads of the process that are not capture or writer threads to the
+ * background CPUs (or back to all CPUs if placement is disabled), and starts measuring their CPU
+ * usage for backgroundReport().
+ */
+void ThreadPlacement::placeBackgroundThreads()
+{
+    std::map<int, TaskTime> tasks = taskTimes();
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto &task : tasks) {
+        if (placed.count(task.first) == 0) {
+            setAffinity(task.first, backgroundSet);
+        }
+    }
+    backgroundStart = tasks;
+    backgroundTimer.start();
+}
+
+/**
+ * @brief CPU usage of the \a maxThreads busiest threads other than the capture and writer threads
+ * since the last placeBackgroundThreads().
+ */
+QString ThreadPlacement::backgroundReport(int maxThreads) const
+{
+    std::map<int, TaskTime> tasks = taskTimes();
+    std::lock_guard<std::mutex> lock(mutex);
+    double wall = backgroundTimer.nsecsElapsed() * 1e-6;
+
+    QVector<Usage> usage;
+    double total = 0;
+    for (const auto &task : tasks) {
+        if (placed.count(task.first) > 0) {
+            continue;
+        }
+        auto it = backgroundStart.find(task.first);
+        Usage u;
+        u.name = task.second.name;
+        u.cpuTime = task.second.cpuTime - (it != backgroundStart.end() ? it->second.cpuTime : 0);
+        u.wallTime = wall;
+        total += u.cpuTime;
+        usage << u;
+    }
+    std::sort(usage.begin(), usage.end(), [](const Usage &a, const Usage &b) {
+        return a.cpuTime > b.cpuTime;
+    });
+    usage.resize(std::min(usage.size(), maxThreads));
+
+    return QString("background threads %1% of a CPU on cpu %2: %3")
+        .arg(wall > 0 ? 100 * total / wall : 0, 0, 'f', 0)
+        .arg(formatCpuList(backgroundSet))
+        .arg(formatUsage(usage));
+}
+
+/**
+ * @brief Formats \a usage as "name 42% (cpu 3, fifo 10), ...".
+ */
+QString ThreadPlacement::formatUsage(const QVector<Usage> &usage)
+{
+    QStringList sl;
+    for (const Usage &u : usage) {
+        QString s = QString("%1 %2%")
+                        .arg(u.name)
+                        .arg(u.wallTime > 0 ? 100 * u.cpuTime / u.wallTime : 0, 0, 'f', 0);
+        QStringList details;
+        if (!u.scheduling.isEmpty()) {
+            details << u.scheduling;
+        } else if (u.cpu >= 0) {
+            details << QString("last on cpu %1").arg(u.cpu);
+        }
+        if (!details.isEmpty()) {
+            s += QString(" (%1)").arg(details.join(", "));
+        }
+        sl << s;
+    }
+    return sl.join(", ");
+}
+
+/**
+ * @brief Parses a CPU list in the kernel format ("0-3,8,10-11").
+ */
+QVector<int> ThreadPlacement::parseCpuList(const QString &list)
+{
+    QVector<int> cpus;
+    for (const QString &range : list.split(",", QString::SkipEmptyParts)) {
+        QStringList ends = range.trimmed().split("-");
+        bool ok1 = false, ok2 = false;
+        int from = ends.at(0).toInt(&ok1);
+        int to = ends.size() > 1 ? ends.at(1).toInt(&ok2) : from;
+        if (!ok1 || (ends.size() > 1 && !ok2)) {
+            continue;
+        }
+        for (int cpu = from; cpu <= to; ++cpu) {
+            if (!cpus.contains(cpu)) {
+                cpus << cpu;
+            }
+        }
+    }
+    std::sort(cpus.begin(), cpus.end());
+    return cpus;
+}
+
+QString ThreadPlacement::formatCpuList(const QVector<int> &cpus)
+{
+    QStringList sl;
+    for (int i = 0; i < cpus.size();) {
+        int j = i;
+        while (j + 1 < cpus.size() && cpus.at(j + 1) == cpus.at(j) + 1) {
+            j++;
+        }
+        sl << (j > i ? QString("%1-%2").arg(cpus.at(i)).arg(cpus.at(j))
+                     : QString::number(cpus.at(i)));
+        i = j + 1;
+    }
+    return sl.join(",");
+}
+
+int ThreadPlacement::currentThreadId()
+{
+    return static_cast<int>(syscall(SYS_gettid));
+}
+
+ThreadPlacement &ThreadPlacement::global()
+{
+    static ThreadPlacement instance;
+    return instance;
+}
+
+bool ThreadPlacement::setAffinity(int tid, const QVector<int> &cpus)
+{
+    if (cpus.isEmpty()) {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        CPU_SET(cpu, &set);
+    }
+    return sched_setaffinity(tid, sizeof(set), &set) == 0;
+}
+
+/**
+ * @brief Name and CPU time (user + system) of every thread of the process, by tid.
+ */
+std::map<int, ThreadPlacement::TaskTime> ThreadPlacement::taskTimes()
+{
+    std::map<int, TaskTime> tasks;
+    const double msPerTick = 1e3 / sysconf(_SC_CLK_TCK);
+    QDir dir("/proc/self/task");
+    for (const QString &entry : dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        std::ifstream stat(dir.filePath(entry + "/stat").toStdString());
+        std::string line;
+        if (!std::getline(stat, line)) {
+            continue; // thread exited meanwhile
+        }
+        // tid (comm) state ... utime stime ...; comm may contain spaces and parentheses
+        size_t open = line.find('(');
+        size_t close = line.rfind(')');
+        if (open == std::string::npos || close == std::string::npos) {
+            continue;
+        }
+        QStringList fields = QString::fromStdString(line.substr(close + 2)).split(" ");
+        if (fields.size() < 13) {
+            continue;
+        }
+        TaskTime t;
+        t.name = QString::fromStdString(line.substr(open + 1, close - open - 1));
+        t.cpuTime = (fields.at(11).toDouble() + fields.at(12).toDouble()) * msPerTick;
+        tasks[entry.toInt()] = t;
+    }
+    return tasks;
+}
+
+QVector<int> ThreadPlacement::readCpuListFile(const QString &path)
+{
+    std::ifstream in(path.toStdString());
+    std::string line;
+    std::getline(in, line);
+    return parseCpuList(QString::fromStdString(line));
+}
@@ -0,0 +1,132 @@
+#ifndef THREADPLACEMENT_H
+#define THREADPLACEMENT_H
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+#include <QElapsedTimer>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+/**
+ * @brief CPU affinity and scheduling policy of the acquisition threads.
+ *
+ * Each camera gets a set of CPUs, either given explicitly as a CPU list ("4-7,12") or chosen
+ * among the isolated CPUs (isolcpus, /sys/devices/system/cpu/isolated) of a NUMA node ("node1",
+ * the node of the camera's frame grabber) or of any node (empty list); cameras with the same
+ * automatic setting share the candidate CPUs evenly.
+ *
+ * The capture thread of a camera (SaveStackWorker::captureFrames()) is pinned to the first CPU
+ * of the set and its writer threads to the others; both can run under SCHED_FIFO or SCHED_RR
+ * (drain policy). All other threads (GUI, SPIM, display, compression and binning pools,
+ * writeback, logging, lasers) are kept on the remaining CPUs by placeBackgroundThreads(). Threads
+ * created by a placed thread inherit its affinity (not its real-time policy) until the next call.
+ */
+class ThreadPlacement
+{
+public:
+    enum Role : int {
+        ROLE_CAPTURE,
+        ROLE_WRITER,
+    };
+
+    enum Policy : int {
+        POLICY_OTHER,
+        POLICY_FIFO,
+        POLICY_RR,
+    };
+
+    static QString policyName(Policy policy);
+    static Policy policyFromName(const QString &name);
+    static QStringList policyNames();
+
+    /**
+     * @brief CPU time of a thread over an interval.
+     */
+    struct Usage
+    {
+        QString name;
+        int cpu = -1;        // CPU the thread last ran on
+        double cpuTime = 0;  // ms
+        double wallTime = 0; // ms
+        QString scheduling;
+    };
+
+    /**
+     * @brief Places the calling thread for its lifetime and measures its CPU usage.
+     */
+    class Scope
+    {
+    public:
+        Scope(Role role, int camera, const QString &name);
+        ~Scope();
+
+        Usage usage() const; // to be called by the same thread
+
+    private:
+        int tid;
+        QString name;
+        QString scheduling;
+        int64_t cpuStart;
+        QElapsedTimer timer;
+    };
+
+    ThreadPlacement();
+
+    void setEnabled(bool enable);
+    bool isEnabled() const;
+    void setCameraCpus(const QStringList &value);
+    QStringList getCameraCpus() const;
+    void setDrainPolicy(Policy value);
+    Policy getDrainPolicy() const;
+    void setDrainPriority(int value);
+    int getDrainPriority() const;
+
+    QVector<int> cameraCpus(int camera) const;
+    QVector<int> backgroundCpus() const;
+
+    void placeBackgroundThreads();
+    QString backgroundReport(int maxThreads = 5) const;
+
+    static QString formatUsage(const QVector<Usage> &usage);
+    static QVector<int> parseCpuList(const QString &list);
+    static QString formatCpuList(const QVector<int> &cpus);
+    static int currentThreadId();
+
+    static ThreadPlacement &global();
+
+private:
+    struct TaskTime
+    {
+        QString name;
+        double cpuTime; // ms
+    };
+
+    mutable std::mutex mutex;
+    bool enabled = false;
+    QStringList cameraSpecs;
+    Policy drainPolicy = POLICY_OTHER;
+    int drainPriority = 10;
+
+    QVector<int> onlineCpus;  // candidates for the cameras, isolated CPUs included
+    QVector<int> allowedCpus; // process affinity at startup, which excludes isolated CPUs
+    QVector<QVector<int>> cameraSets;
+    QVector<int> backgroundSet;
+    std::map<int, bool> placed; // tid of each thread with a Scope -> real-time policy set
+    bool warnedPolicy = false;
+
+    std::map<int, TaskTime> backgroundStart;
+    QElapsedTimer backgroundTimer;
+
+    void resolve();
+    QString place(int tid, Role role, int camera);
+    void unplace(int tid);
+
+    static bool setAffinity(int tid, const QVector<int> &cpus);
+    static std::map<int, TaskTime> taskTimes();
+    static QVector<int> readCpuListFile(const QString &path);
+};
+
+#endif // THREADPLACEMENT_H
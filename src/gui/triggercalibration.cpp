@@ -0,0 +1,184 @@
+#include "triggercalibration.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <qtlab/core/logger.h>
+
+static Logger *logger = getLogger("TriggerCalibration");
+
+#define RESOLUTION 0.005
+
+constexpr double TriggerCalibration::DEFAULT_FRACTION;
+constexpr double TriggerCalibration::MIN_FRACTION;
+constexpr double TriggerCalibration::MAX_FRACTION;
+constexpr int TriggerCalibration::MAX_TRIALS;
+
+QString TriggerCalibration::key(double expTime, int binning)
+{
+    return QString("%1ms_bin%2").arg(expTime, 0, 'f', 3).arg(binning);
+}
+
+/**
+ * @brief Calibrated fraction for \a expTime (ms) and \a binning, or DEFAULT_FRACTION if that
+ * combination has not been calibrated.
+ */
+double TriggerCalibration::getFraction(double expTime, int binning) const
+{
+    return table.value(key(expTime, binning), DEFAULT_FRACTION).toDouble();
+}
+
+bool TriggerCalibration::hasFraction(double expTime, int binning) const
+{
+    return table.contains(key(expTime, binning));
+}
+
+QVariantMap TriggerCalibration::getTable() const
+{
+    return table;
+}
+
+void TriggerCalibration::setTable(const QVariantMap &value)
+{
+    table = value;
+}
+
+/**
+ * @brief Starts a new search for \a expTime (ms) and \a binning, from the fraction currently in
+ * the table.
+ */
+void TriggerCalibration::start(double expTime, int binning)
+{
+    currentKey = key(expTime, binning);
+    current = getFraction(expTime, binning);
+    step = 0.02;
+    stableFraction = unstableFraction = 0;
+    passes = trials = 0;
+    running = true;
+    logger->info(QString("Calibrating trigger rate for %1, starting from %2")
+                     .arg(currentKey)
+                     .arg(current, 0, 'f', 3));
+}
+
+void TriggerCalibration::abort()
+{
+    if (running) {
+        logger->warning("Trigger calibration aborted");
+    }
+    running = false;
+}
+
+bool TriggerCalibration::isRunning() const
+{
+    return running;
+}
+
+/**
+ * @brief Records the outcome of a test stack acquired at getCurrentFraction() and picks the
+ * fraction for the next one.
+ *
+ * A stack is stable if all its frames arrived with contiguous frame stamps (\a complete) and no
+ * two consecutive time stamps are further apart than 1.5 trigger periods (\a maxInterval in us,
+ * \a triggerRate in Hz), i.e. no trigger pulse was missed by the cameras.
+ *
+ * @return true when the search is over (see getResult()).
+ */
+bool TriggerCalibration::addTrial(bool complete, double maxInterval, double triggerRate)
+{
+    if (!running) {
+        return true;
+    }
+    trials++;
+    bool stable = complete && maxInterval <= 1.5e6 / triggerRate;
+    logger->info(QString("Trial %1: fraction %2, max frame interval %3 us (period %4 us): %5")
+                     .arg(trials)
+                     .arg(current, 0, 'f', 3)
+                     .arg(maxInterval, 0, 'f', 1)
+                     .arg(1e6 / triggerRate, 0, 'f', 1)
+                     .arg(stable ? "stable" : "unstable"));
+
+    if (stable) {
+        if (++passes < repeats && trials < MAX_TRIALS) {
+            return false; // same fraction again
+        }
+        stableFraction = current;
+    } else {
+        unstableFraction = current;
+    }
+    passes = 0;
+
+    double next;
+    if (unstableFraction == 0) {
+        next = std::min(stableFraction + step, MAX_FRACTION);
+    } else if (stableFraction == 0) {
+        next = current - step;
+        step *= 2;
+    } else {
+        next = 0.5 * (stableFraction + unstableFraction);
+    }
+
+    bool done = trials >= MAX_TRIALS || (stable && current >= MAX_FRACTION)
+                || next < MIN_FRACTION
+                || (unstableFraction != 0 && stableFraction != 0
+                    && unstableFraction - stableFraction <= RESOLUTION);
+    if (done) {
+        finish();
+        return true;
+    }
+    current = next;
+    return false;
+}
+
+void TriggerCalibration::finish()
+{
+    running = false;
+    if (stableFraction == 0) {
+        logger->warning(QString("Trigger calibration for %1 failed: no stable fraction down to %2")
+                            .arg(currentKey)
+                            .arg(MIN_FRACTION));
+        return;
+    }
+    table[currentKey] = stableFraction;
+    logger->info(QString("Trigger calibration for %1: %2 of the frame rate (%3 trials)")
+                     .arg(currentKey)
+                     .arg(stableFraction, 0, 'f', 3)
+                     .arg(trials));
+}
+
+double TriggerCalibration::getCurrentFraction() const
+{
+    return current;
+}
+
+/**
+ * @brief Highest stable fraction found by the last search, 0 if none.
+ */
+double TriggerCalibration::getResult() const
+{
+    return stableFraction;
+}
+
+int TriggerCalibration::getTrialCount() const
+{
+    return trials;
+}
+
+int TriggerCalibration::getTrialFrames() const
+{
+    return trialFrames;
+}
+
+void TriggerCalibration::setTrialFrames(int value)
+{
+    trialFrames = value;
+}
+
+int TriggerCalibration::getRepeats() const
+{
+    return repeats;
+}
+
+void TriggerCalibration::setRepeats(int value)
+{
+    repeats = value;
+}
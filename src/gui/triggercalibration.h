@@ -0,0 +1,63 @@
+#ifndef TRIGGERCALIBRATION_H
+#define TRIGGERCALIBRATION_H
+
+#include <QString>
+#include <QVariantMap>
+
+/**
+ * @brief Table of the highest stable trigger rate, as a fraction of the achievable camera frame
+ * rate, for each exposure time and binning, and the search that fills it.
+ *
+ * The search is driven by test stacks acquired through the normal acquisition pipeline: after
+ * each stack addTrial() is told whether all frames arrived with contiguous frame stamps and what
+ * the largest time stamp delta was. The fraction is stepped up while stacks are stable and
+ * bisected between the highest stable and the lowest unstable fraction once a stack fails.
+ */
+class TriggerCalibration
+{
+public:
+    static constexpr double DEFAULT_FRACTION = 0.95;
+    static constexpr double MIN_FRACTION = 0.5;
+    static constexpr double MAX_FRACTION = 1.0;
+    static constexpr int MAX_TRIALS = 30;
+
+    double getFraction(double expTime, int binning) const; // expTime in ms
+    bool hasFraction(double expTime, int binning) const;
+
+    QVariantMap getTable() const;
+    void setTable(const QVariantMap &value);
+
+    void start(double expTime, int binning);
+    void abort();
+    bool isRunning() const;
+    bool addTrial(bool complete, double maxInterval, double triggerRate);
+    double getCurrentFraction() const;
+    double getResult() const;
+    int getTrialCount() const;
+
+    int getTrialFrames() const;
+    void setTrialFrames(int value);
+
+    int getRepeats() const;
+    void setRepeats(int value);
+
+private:
+    QVariantMap table; // key(expTime, binning) -> fraction
+
+    bool running = false;
+    QString currentKey;
+    double current = DEFAULT_FRACTION;
+    double step = 0.02;
+    double stableFraction = 0;   // highest stable fraction found so far (0 = none)
+    double unstableFraction = 0; // lowest unstable fraction found so far (0 = none)
+    int passes = 0;
+    int trials = 0;
+
+    int trialFrames = 200;
+    int repeats = 2; // consecutive stable stacks required to accept a fraction
+
+    static QString key(double expTime, int binning);
+    void finish();
+};
+
+#endif // TRIGGERCALIBRATION_H
@@ -0,0 +1,112 @@
+#include "workerpool.h"
+
+WorkerPool::WorkerPool(int nThreads)
+{
+    setThreadCount(nThreads);
+}
+
+WorkerPool::~WorkerPool()
+{
+    stopThreads();
+}
+
+/**
+ * @brief Sets the number of pool threads, not counting the thread calling run().
+ */
+void WorkerPool::setThreadCount(int nThreads)
+{
+    std::lock_guard<std::mutex> runLock(runMutex);
+    if (nThreads == static_cast<int>(threads.size())) {
+        return;
+    }
+    stopThreads();
+    quit = false;
+    for (int i = 0; i < nThreads; ++i) {
+        threads.emplace_back(&WorkerPool::threadLoop, this);
+    }
+}
+
+int WorkerPool::threadCount() const
+{
+    return static_cast<int>(threads.size());
+}
+
+void WorkerPool::run(int nTasks, const std::function<void(int)> &task)
+{
+    if (nTasks <= 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> runLock(runMutex);
+    if (threads.empty() || nTasks == 1) {
+        for (int i = 0; i < nTasks; ++i) {
+            task(i);
+        }
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    job = &task;
+    this->nTasks = nTasks;
+    nextTask = 0;
+    pending = nTasks;
+    generation++;
+    cv.notify_all();
+
+    while (runOne(lock)) {
+    }
+    doneCv.wait(lock, [this]() { return pending == 0; });
+    job = nullptr;
+}
+
+WorkerPool &WorkerPool::global()
+{
+    static WorkerPool instance(static_cast<int>(std::thread::hardware_concurrency() / 2));
+    return instance;
+}
+
+void WorkerPool::threadLoop()
+{
+    unsigned long seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        cv.wait(lock, [&]() { return quit || (generation != seen && nextTask < nTasks); });
+        if (quit) {
+            break;
+        }
+        seen = generation;
+        while (runOne(lock)) {
+        }
+    }
+}
+
+/**
+ * @brief Runs the next pending task (if any) with the mutex released.
+ */
+bool WorkerPool::runOne(std::unique_lock<std::mutex> &lock)
+{
+    if (job == nullptr || nextTask >= nTasks) {
+        return false;
+    }
+    int idx = nextTask++;
+    const std::function<void(int)> *f = job;
+    lock.unlock();
+    (*f)(idx);
+    lock.lock();
+    if (--pending == 0) {
+        doneCv.notify_all();
+    }
+    return true;
+}
+
+void WorkerPool::stopThreads()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    cv.notify_all();
+    for (std::thread &t : threads) {
+        t.join();
+    }
+    threads.clear();
+}
@@ -0,0 +1,47 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Small pool of persistent threads used to split per-frame work into bands.
+ *
+ * run() hands out task indices 0..nTasks-1 to the pool threads and to the calling thread,
+ * and returns when all of them have completed.
+ */
+class WorkerPool
+{
+public:
+    explicit WorkerPool(int nThreads = 0);
+    ~WorkerPool();
+
+    void setThreadCount(int nThreads);
+    int threadCount() const;
+
+    void run(int nTasks, const std::function<void(int)> &task);
+
+    static WorkerPool &global();
+
+private:
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable cv, doneCv;
+    std::mutex runMutex;
+
+    const std::function<void(int)> *job = nullptr;
+    int nTasks = 0;
+    int nextTask = 0;
+    int pending = 0;
+    unsigned long generation = 0;
+    bool quit = false;
+
+    void threadLoop();
+    bool runOne(std::unique_lock<std::mutex> &lock);
+    void stopThreads();
+};
+
+#endif // WORKERPOOL_H
@@ -0,0 +1,267 @@
+#include "writeback.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+
+constexpr size_t Writeback::DEFAULT_WINDOW_BYTES;
+
+Writeback::Writeback() {}
+
+Writeback::~Writeback()
+{
+    finish();
+}
+
+void Writeback::setWindowBytes(size_t value)
+{
+    windowBytes = value;
+}
+
+size_t Writeback::getWindowBytes() const
+{
+    return windowBytes;
+}
+
+/**
+ * @brief Number of windows whose writeback may be in progress before the writeback thread waits
+ * for the oldest one.
+ */
+void Writeback::setMaxInFlight(int value)
+{
+    maxInFlight = std::max(value, 1);
+}
+
+bool Writeback::isEnabled() const
+{
+    return windowBytes > 0;
+}
+
+/**
+ * @brief Starts tracking \a fd, which must stay open until finish() has returned.
+ */
+void Writeback::start(int fd)
+{
+    finish();
+    this->fd = fd;
+    filling.clear();
+    ready.clear();
+    inFlight.clear();
+    finishing = false;
+    errorNumber = 0;
+
+    windowCount = 0;
+    flushTime = maxFlush = finalFlush = 0;
+    dirtyStart = dirtyPeak = dirtyBytes();
+    clock.start();
+
+    if (isEnabled()) {
+        thread = std::thread(&Writeback::threadLoop, this);
+    }
+}
+
+/**
+ * @brief Reports that \a bytes at \a offset have been written. Thread safe.
+ */
+void Writeback::completed(uint64_t offset, size_t bytes)
+{
+    if (!isEnabled() || fd < 0) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    bool notify = false;
+    while (bytes > 0) {
+        uint64_t index = offset / windowBytes;
+        size_t n = static_cast<size_t>(
+            std::min<uint64_t>(bytes, (index + 1) * windowBytes - offset));
+        size_t &filled = filling[index];
+        filled += n;
+        if (filled >= windowBytes) {
+            filling.erase(index);
+            ready.push_back(index);
+            notify = true;
+        }
+        offset += n;
+        bytes -= n;
+    }
+    lock.unlock();
+    if (notify) {
+        cv.notify_one();
+    }
+}
+
+/**
+ * @brief Waits for the whole file to be on disk and drops it from the page cache.
+ *
+ * @return false if writeback failed, with errno set.
+ */
+bool Writeback::finish()
+{
+    if (fd < 0) {
+        return true;
+    }
+    if (thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finishing = true;
+        }
+        cv.notify_all();
+        thread.join();
+    }
+
+    if (isEnabled()) {
+        while (!inFlight.empty()) {
+            retire();
+        }
+        // partially filled windows, and whatever the writer wrote without reporting it
+        qint64 start = clock.nsecsElapsed();
+        syncRange(0,
+                  0,
+                  SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE
+                      | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        finalFlush = (clock.nsecsElapsed() - start) * 1e-6;
+    }
+    fd = -1;
+
+    if (errorNumber != 0) {
+        errno = errorNumber;
+        return false;
+    }
+    return true;
+}
+
+void Writeback::threadLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        cv.wait(lock, [this]() { return !ready.empty() || finishing; });
+        if (ready.empty()) {
+            break;
+        }
+        uint64_t index = ready.front();
+        ready.pop_front();
+        lock.unlock();
+
+        submit(index);
+        while (static_cast<int>(inFlight.size()) > maxInFlight) {
+            retire();
+        }
+        dirtyPeak = std::max(dirtyPeak, dirtyBytes());
+
+        lock.lock();
+    }
+}
+
+/**
+ * @brief Starts the writeback of window \a index without waiting for it.
+ */
+void Writeback::submit(uint64_t index)
+{
+    syncRange(index * windowBytes, windowBytes, SYNC_FILE_RANGE_WRITE);
+    inFlight.push_back({index, clock.nsecsElapsed()});
+}
+
+/**
+ * @brief Waits for the oldest window in flight to be on disk and drops it from the page cache.
+ */
+void Writeback::retire()
+{
+    Window w = inFlight.front();
+    inFlight.pop_front();
+    off_t offset = static_cast<off_t>(w.index * windowBytes);
+    syncRange(offset,
+              windowBytes,
+              SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    posix_fadvise(fd, offset, static_cast<off_t>(windowBytes), POSIX_FADV_DONTNEED);
+
+    double latency = (clock.nsecsElapsed() - w.issued) * 1e-6;
+    flushTime += latency;
+    maxFlush = std::max(maxFlush, latency);
+    windowCount++;
+}
+
+/**
+ * @brief sync_file_range(), falling back to fdatasync() for the waiting calls on file systems
+ * that do not support it. \a bytes = 0 means up to the end of the file.
+ */
+bool Writeback::syncRange(uint64_t offset, uint64_t bytes, unsigned int flags)
+{
+    if (rangeSync) {
+        if (sync_file_range(fd, static_cast<off64_t>(offset), static_cast<off64_t>(bytes), flags)
+            == 0) {
+            return true;
+        }
+        if (errno != ENOSYS && errno != ESPIPE && errno != EINVAL) {
+            errorNumber = errno;
+            return false;
+        }
+        rangeSync = false;
+    }
+    if (!(flags & SYNC_FILE_RANGE_WAIT_AFTER)) {
+        return true; // no way to start writeback asynchronously
+    }
+    if (fdatasync(fd) != 0) {
+        errorNumber = errno;
+        return false;
+    }
+    return true;
+}
+
+int Writeback::getWindowCount() const
+{
+    return windowCount;
+}
+
+double Writeback::getMeanFlushLatency() const
+{
+    return windowCount > 0 ? flushTime / windowCount : 0;
+}
+
+double Writeback::getMaxFlushLatency() const
+{
+    return maxFlush;
+}
+
+double Writeback::getFinalFlushTime() const
+{
+    return finalFlush;
+}
+
+double Writeback::getDirtyGrowth() const
+{
+    return std::max(dirtyPeak - dirtyStart, 0.);
+}
+
+QString Writeback::report() const
+{
+    if (!isEnabled()) {
+        return QString();
+    }
+    return QString("writeback of %1 x %2 MB, flush latency mean %3 ms, max %4 ms, final flush "
+                   "%5 ms, dirty memory growth %6 MB")
+        .arg(windowCount)
+        .arg(windowBytes >> 20)
+        .arg(getMeanFlushLatency(), 0, 'f', 1)
+        .arg(maxFlush, 0, 'f', 1)
+        .arg(finalFlush, 0, 'f', 1)
+        .arg(getDirtyGrowth() / 1e6, 0, 'f', 0);
+}
+
+/**
+ * @brief Dirty memory waiting to be written back (Dirty in /proc/meminfo), in bytes.
+ */
+double Writeback::dirtyBytes()
+{
+    std::ifstream meminfo("/proc/meminfo");
+    std::string line;
+    while (std::getline(meminfo, line)) {
+        if (line.compare(0, 6, "Dirty:") == 0) {
+            return std::stod(line.substr(6)) * 1024; // kB
+        }
+    }
+    return 0;
+}
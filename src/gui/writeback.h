@@ -0,0 +1,91 @@
+#ifndef WRITEBACK_H
+#define WRITEBACK_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include <QElapsedTimer>
+#include <QString>
+
+/**
+ * @brief Explicit writeback of a file written through the page cache.
+ *
+ * The file is divided into windows of windowBytes. Writers report the byte ranges they have
+ * written with completed(), in any order; once a window is full, a background thread starts its
+ * writeback with sync_file_range(SYNC_FILE_RANGE_WRITE). When more than maxInFlight windows are
+ * being written back, the thread waits for the oldest one and drops it from the page cache with
+ * posix_fadvise(POSIX_FADV_DONTNEED). This keeps the amount of dirty memory bounded, so that the
+ * kernel does not throttle the writers and the page cache does not compete with the DCAM
+ * buffers.
+ *
+ * finish() flushes the whole file (fdatasync() where sync_file_range() is not supported) and
+ * drops it from the cache.
+ */
+class Writeback
+{
+public:
+    static constexpr size_t DEFAULT_WINDOW_BYTES = size_t(32) << 20;
+
+    Writeback();
+    ~Writeback();
+
+    void setWindowBytes(size_t value); // 0 disables writeback control
+    size_t getWindowBytes() const;
+    void setMaxInFlight(int value);
+    bool isEnabled() const;
+
+    void start(int fd);
+    void completed(uint64_t offset, size_t bytes);
+    bool finish();
+
+    int getWindowCount() const;
+    double getMeanFlushLatency() const; // ms
+    double getMaxFlushLatency() const;  // ms
+    double getFinalFlushTime() const;   // ms
+    double getDirtyGrowth() const;      // bytes, peak over the start of the file
+    QString report() const;
+
+    static double dirtyBytes();
+
+private:
+    struct Window
+    {
+        uint64_t index;
+        qint64 issued; // ns
+    };
+
+    size_t windowBytes = DEFAULT_WINDOW_BYTES;
+    int maxInFlight = 4;
+    int fd = -1;
+    bool rangeSync = true; // sync_file_range() supported
+    int errorNumber = 0;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::map<uint64_t, size_t> filling; // window index -> bytes written so far
+    std::deque<uint64_t> ready;         // full windows, not submitted yet
+    bool finishing = false;
+    std::thread thread;
+
+    std::deque<Window> inFlight; // only accessed by the writeback thread
+    QElapsedTimer clock;
+
+    int windowCount = 0;
+    double flushTime = 0;  // ms, summed over windows
+    double maxFlush = 0;   // ms
+    double finalFlush = 0; // ms
+    double dirtyStart = 0;
+    double dirtyPeak = 0;
+
+    void threadLoop();
+    void submit(uint64_t index);
+    void retire();
+    bool syncRange(uint64_t offset, uint64_t bytes, unsigned int flags);
+};
+
+#endif // WRITEBACK_H